@@ -0,0 +1,83 @@
+#include "AllocationCounter.h"
+
+#include <stdlib.h>
+#include <new>
+
+#ifdef RAYTRACER_COUNT_ALLOCATIONS
+
+static bool counting = false;
+static long allocations = 0;
+#pragma omp threadprivate(counting, allocations)
+
+static inline void* countedAlloc(size_t size)
+{
+	if (counting) {
+		allocations++;
+	}
+	void* p = malloc(size == 0 ? 1 : size);
+	if (p == NULL) {
+		throw std::bad_alloc();
+	}
+	return p;
+}
+
+void* operator new(size_t size)
+{
+	return countedAlloc(size);
+}
+
+void* operator new[](size_t size)
+{
+	return countedAlloc(size);
+}
+
+void operator delete(void* p) throw()
+{
+	free(p);
+}
+
+void operator delete[](void* p) throw()
+{
+	free(p);
+}
+
+namespace allocationCounter
+{
+	void begin()
+	{
+		allocations = 0;
+		counting = true;
+	}
+
+	long end()
+	{
+		counting = false;
+		return allocations;
+	}
+
+	bool enabled()
+	{
+		return true;
+	}
+}
+
+#else
+
+namespace allocationCounter
+{
+	void begin()
+	{
+	}
+
+	long end()
+	{
+		return 0;
+	}
+
+	bool enabled()
+	{
+		return false;
+	}
+}
+
+#endif
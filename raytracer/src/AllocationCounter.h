@@ -0,0 +1,13 @@
+#pragma once
+
+// Counts the heap allocations made by the calling thread between begin() and end(), by replacing
+// the global operator new. That changes the allocator of the whole module, so it is only compiled
+// in when RAYTRACER_COUNT_ALLOCATIONS is defined, as the standalone build does. For the Maya plugin
+// add it to the preprocessor definitions of msvc/raytracer.vcxproj. Otherwise end() always gives 0
+// and enabled() is false.
+namespace allocationCounter
+{
+	void	begin();
+	long	end();
+	bool	enabled();
+}
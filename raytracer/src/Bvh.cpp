@@ -0,0 +1,451 @@
+#include "Bvh.h"
+
+#include <algorithm>
+
+#define BVH_BIN_COUNT			16
+#define BVH_MAX_LEAF_SIZE		4
+#define BVH_MAX_DEPTH			64
+#define BVH_TRAVERSAL_COST		1.0
+#define BVH_INTERSECTION_COST	1.0
+
+static double surfaceArea(const double min[3], const double max[3])
+{
+	double dx = max[0] - min[0];
+	double dy = max[1] - min[1];
+	double dz = max[2] - min[2];
+	return 2 * (dx * dy + dy * dz + dz * dx);
+}
+
+static void resetBounds(double min[3], double max[3])
+{
+	for (int a = 0; a < 3; ++a) {
+		min[a] = DBL_MAX;
+		max[a] = -DBL_MAX;
+	}
+}
+
+static void growBounds(double min[3], double max[3], const double otherMin[3], const double otherMax[3])
+{
+	for (int a = 0; a < 3; ++a) {
+		min[a] = std::min(min[a], otherMin[a]);
+		max[a] = std::max(max[a], otherMax[a]);
+	}
+}
+
+Bvh::Bvh() : triangles(NULL)
+{
+}
+
+Bvh::~Bvh()
+{
+}
+
+void Bvh::clear()
+{
+	nodes.clear();
+	primitives.clear();
+	triangles = NULL;
+}
+
+void Bvh::swap(Bvh& other)
+{
+	nodes.swap(other.nodes);
+	primitives.swap(other.primitives);
+	std::swap(triangles, other.triangles);
+}
+
+void Bvh::save(CacheWriter& out) const
+{
+	out.putArray(nodes);
+	out.putArray(primitives);
+}
+
+bool Bvh::load(CacheReader& in, const vector<TriangleT>& triangleTable)
+{
+	clear();
+	if (!in.getArray(nodes) || !in.getArray(primitives)) {
+		clear();
+		return false;
+	}
+	triangles = &triangleTable;
+	return true;
+}
+
+void Bvh::build(const vector<MeshDataT>& meshesData, const vector<TriangleT>& triangleTable)
+{
+	clear();
+	triangles = &triangleTable;
+
+	vector<BuildPrimitiveT> buildPrims;
+	int firstTriangle = 0;
+	for (int mi = 0; mi < (int) meshesData.size(); ++mi)
+	{
+		const vector<Face>& faces = meshesData[mi].faces;
+		for (int fi = 0; fi < (int) faces.size(); ++fi)
+		{
+			const MPointArray& vertices = faces[fi].vertices;
+			if (vertices.length() != 3) {
+				continue;
+			}
+			BuildPrimitiveT p;
+			resetBounds(p.min, p.max);
+			for (int vi = 0; vi < 3; ++vi)
+			{
+				for (int a = 0; a < 3; ++a) {
+					p.min[a] = std::min(p.min[a], vertices[vi][a]);
+					p.max[a] = std::max(p.max[a], vertices[vi][a]);
+				}
+			}
+			for (int a = 0; a < 3; ++a) {
+				p.centroid[a] = (p.min[a] + p.max[a]) * 0.5;
+			}
+			p.meshIndex = mi;
+			p.faceIndex = fi;
+			p.triangle = firstTriangle + fi;
+			buildPrims.push_back(p);
+		}
+		firstTriangle += (int) faces.size();
+	}
+
+	if (buildPrims.empty()) {
+		return;
+	}
+
+	nodes.reserve(2 * buildPrims.size());
+	buildNode(buildPrims, 0, (int) buildPrims.size(), 0);
+
+	primitives.resize(buildPrims.size());
+	for (int i = 0; i < (int) buildPrims.size(); ++i)
+	{
+		primitives[i].meshIndex = buildPrims[i].meshIndex;
+		primitives[i].faceIndex = buildPrims[i].faceIndex;
+		primitives[i].triangle = buildPrims[i].triangle;
+	}
+}
+
+int Bvh::buildNode(vector<BuildPrimitiveT>& buildPrims, int begin, int end, int depth)
+{
+	int nodeIndex = (int) nodes.size();
+	nodes.push_back(NodeT());
+
+	NodeT node;
+	resetBounds(node.min, node.max);
+	for (int i = begin; i < end; ++i) {
+		growBounds(node.min, node.max, buildPrims[i].min, buildPrims[i].max);
+	}
+	node.offset = begin;
+	node.count = end - begin;
+	node.axis = 0;
+
+	int axis;
+	double splitPos, splitCost;
+	double leafCost = node.count * BVH_INTERSECTION_COST;
+	bool split = node.count > 1 && depth < BVH_MAX_DEPTH
+		&& findSahSplit(buildPrims, begin, end, surfaceArea(node.min, node.max), axis, splitPos, splitCost)
+		&& (splitCost < leafCost || node.count > BVH_MAX_LEAF_SIZE);
+
+	int mid = begin;
+	if (split)
+	{
+		BuildPrimitiveT* first = &buildPrims[0] + begin;
+		BuildPrimitiveT* last = &buildPrims[0] + end;
+		mid = begin + (int) (std::partition(first, last, [axis, splitPos](const BuildPrimitiveT& p) { return p.centroid[axis] < splitPos; }) - first);
+		split = (mid != begin && mid != end);
+	}
+
+	if (!split) {
+		nodes[nodeIndex] = node;
+		return nodeIndex;
+	}
+
+	node.count = 0;
+	node.axis = axis;
+	nodes[nodeIndex] = node;
+	buildNode(buildPrims, begin, mid, depth + 1);
+	int second = buildNode(buildPrims, mid, end, depth + 1);
+	nodes[nodeIndex].offset = second;
+	return nodeIndex;
+}
+
+bool Bvh::findSahSplit(vector<BuildPrimitiveT>& buildPrims, int begin, int end, const double nodeArea, int& axis, double& splitPos, double& cost)
+{
+	double cMin[3], cMax[3];
+	resetBounds(cMin, cMax);
+	for (int i = begin; i < end; ++i) {
+		growBounds(cMin, cMax, buildPrims[i].centroid, buildPrims[i].centroid);
+	}
+
+	bool found = false;
+	cost = DBL_MAX;
+	if (nodeArea <= 0) {
+		return false;
+	}
+
+	for (int a = 0; a < 3; ++a)
+	{
+		double extent = cMax[a] - cMin[a];
+		if (extent <= DOUBLE_NUMERICAL_THRESHHOLD) {
+			continue;
+		}
+
+		int		binCount[BVH_BIN_COUNT] = {0};
+		double	binMin[BVH_BIN_COUNT][3];
+		double	binMax[BVH_BIN_COUNT][3];
+		for (int b = 0; b < BVH_BIN_COUNT; ++b) {
+			resetBounds(binMin[b], binMax[b]);
+		}
+
+		double scale = BVH_BIN_COUNT / extent;
+		for (int i = begin; i < end; ++i)
+		{
+			int b = std::min(BVH_BIN_COUNT - 1, (int) ((buildPrims[i].centroid[a] - cMin[a]) * scale));
+			binCount[b]++;
+			growBounds(binMin[b], binMax[b], buildPrims[i].min, buildPrims[i].max);
+		}
+
+		// Sweep from the right to get the area and count of every right side
+		double	rightArea[BVH_BIN_COUNT];
+		int		rightCount[BVH_BIN_COUNT];
+		double	accMin[3], accMax[3];
+		int		accCount = 0;
+		resetBounds(accMin, accMax);
+		for (int b = BVH_BIN_COUNT - 1; b > 0; --b)
+		{
+			growBounds(accMin, accMax, binMin[b], binMax[b]);
+			accCount += binCount[b];
+			rightCount[b] = accCount;
+			rightArea[b] = accCount > 0 ? surfaceArea(accMin, accMax) : 0;
+		}
+
+		resetBounds(accMin, accMax);
+		accCount = 0;
+		for (int b = 1; b < BVH_BIN_COUNT; ++b)
+		{
+			growBounds(accMin, accMax, binMin[b - 1], binMax[b - 1]);
+			accCount += binCount[b - 1];
+			if (accCount == 0 || rightCount[b] == 0) {
+				continue;
+			}
+			double c = BVH_TRAVERSAL_COST + BVH_INTERSECTION_COST *
+				(surfaceArea(accMin, accMax) * accCount + rightArea[b] * rightCount[b]) / nodeArea;
+			if (c < cost)
+			{
+				cost = c;
+				axis = a;
+				splitPos = cMin[a] + b / scale;
+				found = true;
+			}
+		}
+	}
+	return found;
+}
+
+static inline bool rayIntersectsBox(const double min[3], const double max[3], const MPoint& src, const double invDir[3], double maxDist)
+{
+	double tNear = 0;
+	double tFar = maxDist;
+	for (int a = 0; a < 3; ++a)
+	{
+		double t0 = (min[a] - src[a]) * invDir[a];
+		double t1 = (max[a] - src[a]) * invDir[a];
+		if (t0 > t1) {
+			std::swap(t0, t1);
+		}
+		tNear = t0 > tNear ? t0 : tNear;
+		tFar = t1 < tFar ? t1 : tFar;
+		if (tNear > tFar) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool Bvh::closestIntersection(const MPoint& raySrc, const MVector& rayDir, double maxDist, int onlyMesh, int& meshIndex, int& faceIndex, MPoint& intersection, long& nodesVisited, long& testCount) const
+{
+	if (nodes.empty()) {
+		return false;
+	}
+
+	double invDir[3];
+	for (int a = 0; a < 3; ++a) {
+		invDir[a] = 1.0 / rayDir[a];
+	}
+
+	bool found = false;
+	double closest = maxDist;
+	double time;
+
+	int stack[BVH_MAX_DEPTH * 2 + 2];
+	int stackSize = 0;
+	stack[stackSize++] = 0;
+
+	while (stackSize > 0)
+	{
+		const NodeT& node = nodes[stack[--stackSize]];
+		nodesVisited++;
+
+		if (!rayIntersectsBox(node.min, node.max, raySrc, invDir, closest)) {
+			continue;
+		}
+
+		if (node.count > 0)
+		{
+			for (int i = node.offset; i < node.offset + node.count; ++i)
+			{
+				const PrimitiveT& p = primitives[i];
+				if (onlyMesh >= 0 && p.meshIndex != onlyMesh) {
+					continue;
+				}
+				testCount++;
+				if ((*triangles)[p.triangle].intersect(raySrc, rayDir, closest, time))
+				{
+					closest = time;
+					meshIndex = p.meshIndex;
+					faceIndex = p.faceIndex;
+					found = true;
+				}
+			}
+			continue;
+		}
+
+		// Visit the near child first so the far one is usually culled by closest
+		int first = (int) (&node - &nodes[0]) + 1;
+		int second = node.offset;
+		if (rayDir[node.axis] < 0) {
+			std::swap(first, second);
+		}
+		stack[stackSize++] = second;
+		stack[stackSize++] = first;
+	}
+
+	if (found) {
+		intersection = raySrc + rayDir * closest;
+	}
+	return found;
+}
+
+bool Bvh::occluded(const MPoint& raySrc, const MVector& rayDir, double maxDist, long& nodesVisited, long& testCount) const
+{
+	if (nodes.empty()) {
+		return false;
+	}
+
+	double invDir[3];
+	for (int a = 0; a < 3; ++a) {
+		invDir[a] = 1.0 / rayDir[a];
+	}
+
+	double time;
+	int stack[BVH_MAX_DEPTH * 2 + 2];
+	int stackSize = 0;
+	stack[stackSize++] = 0;
+
+	while (stackSize > 0)
+	{
+		const NodeT& node = nodes[stack[--stackSize]];
+		nodesVisited++;
+
+		if (!rayIntersectsBox(node.min, node.max, raySrc, invDir, maxDist)) {
+			continue;
+		}
+
+		if (node.count > 0)
+		{
+			for (int i = node.offset; i < node.offset + node.count; ++i)
+			{
+				const PrimitiveT& p = primitives[i];
+				testCount++;
+				if ((*triangles)[p.triangle].intersect(raySrc, rayDir, maxDist, time)) {
+					return true;
+				}
+			}
+			continue;
+		}
+
+		stack[stackSize++] = node.offset;
+		stack[stackSize++] = (int) (&node - &nodes[0]) + 1;
+	}
+
+	return false;
+}
+
+void Bvh::closestIntersectionPacket(const MPoint raySrc[], const MVector rayDir[], int count, bool found[], int meshIndex[], int faceIndex[], MPoint intersection[], long& nodesVisited, long& testCount) const
+{
+	double invDir[BVH_MAX_PACKET][3];
+	double closest[BVH_MAX_PACKET];
+	for (int r = 0; r < count; ++r)
+	{
+		found[r] = false;
+		closest[r] = DBL_MAX;
+		for (int a = 0; a < 3; ++a) {
+			invDir[r][a] = 1.0 / rayDir[r][a];
+		}
+	}
+	if (nodes.empty() || count < 1) {
+		return;
+	}
+
+	double time;
+	int stack[BVH_MAX_DEPTH * 2 + 2];
+	int stackSize = 0;
+	stack[stackSize++] = 0;
+
+	while (stackSize > 0)
+	{
+		const NodeT& node = nodes[stack[--stackSize]];
+		nodesVisited++;
+
+		int active = 0;
+		int firstActive = -1;
+		for (int r = 0; r < count; ++r)
+		{
+			if (rayIntersectsBox(node.min, node.max, raySrc[r], invDir[r], closest[r])) {
+				active |= 1 << r;
+				firstActive = (firstActive < 0) ? r : firstActive;
+			}
+		}
+		if (active == 0) {
+			continue;
+		}
+
+		if (node.count > 0)
+		{
+			for (int i = node.offset; i < node.offset + node.count; ++i)
+			{
+				const PrimitiveT& p = primitives[i];
+				const TriangleT& triangle = (*triangles)[p.triangle];
+				for (int r = firstActive; r < count; ++r)
+				{
+					if (!(active & (1 << r))) {
+						continue;
+					}
+					testCount++;
+					if (triangle.intersect(raySrc[r], rayDir[r], closest[r], time))
+					{
+						closest[r] = time;
+						meshIndex[r] = p.meshIndex;
+						faceIndex[r] = p.faceIndex;
+						found[r] = true;
+					}
+				}
+			}
+			continue;
+		}
+
+		// Near child first for the first ray that reached the node
+		int first = (int) (&node - &nodes[0]) + 1;
+		int second = node.offset;
+		if (rayDir[firstActive][node.axis] < 0) {
+			std::swap(first, second);
+		}
+		stack[stackSize++] = second;
+		stack[stackSize++] = first;
+	}
+
+	for (int r = 0; r < count; ++r)
+	{
+		if (found[r]) {
+			intersection[r] = raySrc[r] + rayDir[r] * closest[r];
+		}
+	}
+}
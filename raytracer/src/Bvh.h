@@ -0,0 +1,90 @@
+#pragma once
+
+#include <maya/MPoint.h>
+#include <maya/MVector.h>
+#include <vector>
+#include "Util.h"
+#include "Mesh.h"
+#include "Triangle.h"
+#include "CacheStream.h"
+
+using std::vector;
+using namespace util;
+
+#define BVH_MAX_PACKET			16
+
+// Bounding volume hierarchy over all the triangles of the scene, built with the
+// binned surface area heuristic. Nodes are stored depth first, so the first child
+// of an inner node directly follows it.
+class Bvh
+{
+	struct NodeT
+	{
+		double	min[3];
+		double	max[3];
+		int		offset;		// first primitive of a leaf, second child of an inner node
+		int		count;		// primitives in a leaf, 0 for an inner node
+		int		axis;		// split axis of an inner node
+	};
+
+	struct PrimitiveT
+	{
+		int		meshIndex;
+		int		faceIndex;
+		int		triangle;	// index in the triangle table
+	};
+
+	struct BuildPrimitiveT
+	{
+		double	min[3];
+		double	max[3];
+		double	centroid[3];
+		int		meshIndex;
+		int		faceIndex;
+		int		triangle;
+	};
+
+	vector<NodeT>				nodes;
+	vector<PrimitiveT>			primitives;
+	const vector<TriangleT>*	triangles;
+
+	int		buildNode(vector<BuildPrimitiveT>& buildPrims, int begin, int end, int depth);
+	bool	findSahSplit(vector<BuildPrimitiveT>& buildPrims, int begin, int end, const double nodeArea, int& axis, double& splitPos, double& cost);
+
+public:
+	Bvh();
+	~Bvh();
+
+	// triangleTable holds the faces of all the meshes one after the other
+	void	build(const vector<MeshDataT>& meshesData, const vector<TriangleT>& triangleTable);
+	void	clear();
+
+	// The built hierarchy, for the scene cache. load takes the triangle table it was built over.
+	void	save(CacheWriter& out) const;
+	bool	load(CacheReader& in, const vector<TriangleT>& triangleTable);
+
+	// The hierarchy keeps a pointer to its triangle table, so a table that was swapped
+	// into another vector has to be handed to it again
+	void	swap(Bvh& other);
+	inline void setTriangleTable(const vector<TriangleT>& triangleTable)
+	{
+		triangles = &triangleTable;
+	}
+
+	inline int nodeCount() const
+	{
+		return (int) nodes.size();
+	}
+
+	// Finds the closest triangle hit in (0, maxDist). When onlyMesh is not negative
+	// only the faces of that mesh are tested.
+	bool	closestIntersection(const MPoint& raySrc, const MVector& rayDir, double maxDist, int onlyMesh, int& meshIndex, int& faceIndex, MPoint& intersection, long& nodesVisited, long& testCount) const;
+
+	// Closest hits of up to BVH_MAX_PACKET rays traced together: a node is visited once for all
+	// the rays whose closest hit so far does not rule it out, and its triangles are tested against those rays.
+	// Gives the same hits as tracing the rays one by one.
+	void	closestIntersectionPacket(const MPoint raySrc[], const MVector rayDir[], int count, bool found[], int meshIndex[], int faceIndex[], MPoint intersection[], long& nodesVisited, long& testCount) const;
+
+	// True if any triangle is hit in (0, maxDist). Stops at the first hit found.
+	bool	occluded(const MPoint& raySrc, const MVector& rayDir, double maxDist, long& nodesVisited, long& testCount) const;
+};
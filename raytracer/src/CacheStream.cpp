@@ -0,0 +1,41 @@
+#include "CacheStream.h"
+
+#include <stdio.h>
+#include <string>
+
+bool readFile(const char* path, vector<char>& contents)
+{
+	contents.clear();
+	FILE* file = fopen(path, "rb");
+	if (file == NULL) {
+		return false;
+	}
+	bool ok = fseek(file, 0, SEEK_END) == 0;
+	long size = ok ? ftell(file) : -1;
+	ok = size > 0 && fseek(file, 0, SEEK_SET) == 0;
+	if (ok)
+	{
+		contents.resize((size_t) size);
+		ok = fread(&contents[0], 1, contents.size(), file) == contents.size();
+	}
+	fclose(file);
+	return ok;
+}
+
+bool writeFileReplacing(const char* path, const vector<char>& contents)
+{
+	std::string temporary = std::string(path) + ".tmp";
+	FILE* file = fopen(temporary.c_str(), "wb");
+	if (file == NULL) {
+		return false;
+	}
+	bool ok = contents.empty() || fwrite(&contents[0], 1, contents.size(), file) == contents.size();
+	ok = (fclose(file) == 0) && ok;
+	if (!ok) {
+		remove(temporary.c_str());
+		return false;
+	}
+	// rename does not replace an existing file everywhere
+	remove(path);
+	return rename(temporary.c_str(), path) == 0;
+}
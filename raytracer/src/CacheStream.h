@@ -0,0 +1,133 @@
+#pragma once
+
+#include <vector>
+#include <string.h>
+
+using std::vector;
+
+// 64 bit FNV-1a of everything added, for keying caches by content
+struct ContentHashT
+{
+	unsigned long long	value;
+
+	ContentHashT() : value(14695981039346656037ULL)
+	{
+	}
+
+	inline void add(const void* data, size_t size)
+	{
+		const unsigned char* bytes = (const unsigned char*) data;
+		for (size_t i = 0; i < size; ++i)
+		{
+			value ^= bytes[i];
+			value *= 1099511628211ULL;
+		}
+	}
+
+	template <typename T>
+	inline void add(const T& value)
+	{
+		add(&value, sizeof(T));
+	}
+};
+
+// Appends plain values, and arrays of them, to a byte buffer
+class CacheWriter
+{
+	vector<char>&	out;
+
+public:
+	CacheWriter(vector<char>& buffer) : out(buffer)
+	{
+	}
+
+	inline void putRaw(const void* data, size_t size)
+	{
+		const char* bytes = (const char*) data;
+		out.insert(out.end(), bytes, bytes + size);
+	}
+
+	template <typename T>
+	inline void put(const T& value)
+	{
+		putRaw(&value, sizeof(T));
+	}
+
+	template <typename T>
+	inline void putArray(const vector<T>& values)
+	{
+		put((long long) values.size());
+		if (!values.empty()) {
+			putRaw(&values[0], values.size() * sizeof(T));
+		}
+	}
+};
+
+// Reads back what CacheWriter wrote. A read past the end fails, and so does every read after it.
+class CacheReader
+{
+	const char*		pos;
+	const char*		end;
+	bool			good;
+
+public:
+	CacheReader(const char* data, size_t size) : pos(data), end(data + size), good(true)
+	{
+	}
+
+	inline bool getRaw(void* data, size_t size)
+	{
+		if (!good || (size_t) (end - pos) < size) {
+			good = false;
+			return false;
+		}
+		memcpy(data, pos, size);
+		pos += size;
+		return true;
+	}
+
+	template <typename T>
+	inline bool get(T& value)
+	{
+		return getRaw(&value, sizeof(T));
+	}
+
+	template <typename T>
+	inline bool getArray(vector<T>& values)
+	{
+		long long count;
+		if (!get(count) || count < 0 || (size_t) (end - pos) / sizeof(T) < (size_t) count) {
+			good = false;
+			return false;
+		}
+		values.resize((size_t) count);
+		return count == 0 || getRaw(&values[0], (size_t) count * sizeof(T));
+	}
+
+	// A count of things that take at least elementSize bytes each, failing when the bytes left could not
+	// hold that many, so a corrupt count is caught before anything is allocated for it
+	inline bool getCount(int& count, size_t elementSize)
+	{
+		if (!get(count) || count < 0 || (size_t) (end - pos) / elementSize < (size_t) count) {
+			good = false;
+			return false;
+		}
+		return true;
+	}
+
+	inline bool ok() const
+	{
+		return good;
+	}
+
+	inline bool atEnd() const
+	{
+		return pos == end;
+	}
+};
+
+// Reads the whole file into contents
+bool	readFile(const char* path, vector<char>& contents);
+
+// Writes next to path and renames over it, so readers never see half a file
+bool	writeFileReplacing(const char* path, const vector<char>& contents);
@@ -0,0 +1,116 @@
+#include "Checkpoint.h"
+
+#include <stdio.h>
+#include <string>
+
+#define		CHECKPOINT_MAGIC	0x4b435452	// "RTCK"
+#define		CHECKPOINT_VERSION	2
+
+bool CheckpointKeyT::operator==(const CheckpointKeyT& other) const
+{
+	return width == other.width && height == other.height && tileSize == other.tileSize && tileCount == other.tileCount
+		&& ssType == other.ssType && supersamplingCoeff == other.supersamplingCoeff && rayDepth == other.rayDepth
+		&& adaptiveMinSamples == other.adaptiveMinSamples && adaptiveMaxSamples == other.adaptiveMaxSamples
+		&& adaptiveTolerance == other.adaptiveTolerance && adaptiveErrorProbability == other.adaptiveErrorProbability
+		&& adaptiveTarget == other.adaptiveTarget && seed == other.seed
+		&& progressive == other.progressive && progressiveError == other.progressiveError;
+}
+
+template <typename T>
+static bool writeValue(FILE* file, const T& value)
+{
+	return fwrite(&value, sizeof(T), 1, file) == 1;
+}
+
+template <typename T>
+static bool readValue(FILE* file, T& value)
+{
+	return fread(&value, sizeof(T), 1, file) == 1;
+}
+
+// The key field by field, so padding never ends up in the file
+static bool writeKey(FILE* file, const CheckpointKeyT& key)
+{
+	return writeValue(file, key.width) && writeValue(file, key.height) && writeValue(file, key.tileSize) && writeValue(file, key.tileCount)
+		&& writeValue(file, key.ssType) && writeValue(file, key.supersamplingCoeff) && writeValue(file, key.rayDepth)
+		&& writeValue(file, key.adaptiveMinSamples) && writeValue(file, key.adaptiveMaxSamples)
+		&& writeValue(file, key.adaptiveTolerance) && writeValue(file, key.adaptiveErrorProbability)
+		&& writeValue(file, key.adaptiveTarget) && writeValue(file, key.seed)
+		&& writeValue(file, key.progressive) && writeValue(file, key.progressiveError);
+}
+
+static bool readKey(FILE* file, CheckpointKeyT& key)
+{
+	return readValue(file, key.width) && readValue(file, key.height) && readValue(file, key.tileSize) && readValue(file, key.tileCount)
+		&& readValue(file, key.ssType) && readValue(file, key.supersamplingCoeff) && readValue(file, key.rayDepth)
+		&& readValue(file, key.adaptiveMinSamples) && readValue(file, key.adaptiveMaxSamples)
+		&& readValue(file, key.adaptiveTolerance) && readValue(file, key.adaptiveErrorProbability)
+		&& readValue(file, key.adaptiveTarget) && readValue(file, key.seed)
+		&& readValue(file, key.progressive) && readValue(file, key.progressiveError);
+}
+
+// Bytes from the position in file to its end
+static long bytesLeft(FILE* file)
+{
+	long position = ftell(file);
+	if (position < 0 || fseek(file, 0, SEEK_END) != 0) {
+		return -1;
+	}
+	long end = ftell(file);
+	return (fseek(file, position, SEEK_SET) == 0) ? end - position : -1;
+}
+
+namespace checkpoint
+{
+	bool save(const char* path, const CheckpointKeyT& key, const vector<char>& doneTiles, const Framebuffer& image, const vector<char>& state)
+	{
+		std::string temporary = std::string(path) + ".tmp";
+		FILE* file = fopen(temporary.c_str(), "wb");
+		if (file == NULL) {
+			return false;
+		}
+		bool ok = writeValue(file, (int) CHECKPOINT_MAGIC) && writeValue(file, (int) CHECKPOINT_VERSION) && writeKey(file, key);
+		ok = ok && (doneTiles.empty() || fwrite(&doneTiles[0], 1, doneTiles.size(), file) == doneTiles.size());
+		ok = ok && image.write(file);
+		ok = ok && writeValue(file, (long long) state.size());
+		ok = ok && (state.empty() || fwrite(&state[0], 1, state.size(), file) == state.size());
+		ok = (fclose(file) == 0) && ok;
+		if (!ok) {
+			::remove(temporary.c_str());
+			return false;
+		}
+		// rename does not replace an existing file everywhere
+		::remove(path);
+		return rename(temporary.c_str(), path) == 0;
+	}
+
+	bool load(const char* path, const CheckpointKeyT& key, vector<char>& doneTiles, Framebuffer& image, vector<char>& state)
+	{
+		FILE* file = fopen(path, "rb");
+		if (file == NULL) {
+			return false;
+		}
+		int magic = 0, version = 0;
+		CheckpointKeyT saved;
+		bool ok = readValue(file, magic) && readValue(file, version) && magic == CHECKPOINT_MAGIC && version == CHECKPOINT_VERSION
+			&& readKey(file, saved) && saved == key;
+		if (ok) {
+			doneTiles.assign(key.tileCount, 0);
+			ok = doneTiles.empty() || fread(&doneTiles[0], 1, doneTiles.size(), file) == doneTiles.size();
+		}
+		ok = ok && image.read(file);
+		long long stateSize = -1;
+		ok = ok && readValue(file, stateSize) && stateSize >= 0 && stateSize <= bytesLeft(file);
+		if (ok) {
+			state.resize((size_t) stateSize);
+			ok = state.empty() || fread(&state[0], 1, state.size(), file) == state.size();
+		}
+		fclose(file);
+		return ok;
+	}
+
+	void remove(const char* path)
+	{
+		::remove(path);
+	}
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <vector>
+#include "Framebuffer.h"
+
+using std::vector;
+
+// Settings that decide the pixels of a render. A checkpoint is only resumed when they all match;
+// the scene itself is not checked.
+struct CheckpointKeyT
+{
+	int				width;
+	int				height;
+	int				tileSize;
+	int				tileCount;
+	int				ssType;
+	int				supersamplingCoeff;
+	int				rayDepth;
+	int				adaptiveMinSamples;
+	int				adaptiveMaxSamples;
+	double			adaptiveTolerance;
+	double			adaptiveErrorProbability;
+	double			adaptiveTarget;
+	unsigned int	seed;
+	int				progressive;		// 1 for the passes of renderProgressive
+	double			progressiveError;
+
+	bool	operator==(const CheckpointKeyT& other) const;
+};
+
+// The state of a render: which tiles are finished, the framebuffer with the colors, times and sample
+// counts of their pixels, and what else the renderer needs to go on (the pixel sums of the progressive
+// and adaptive tile renderers), empty for a tiled render. The samples of a pixel are drawn from a
+// generator seeded with the pixel index, so what is left can be rendered exactly as it would have been.
+namespace checkpoint
+{
+	// Written next to path first and then renamed, so a crash while saving keeps the previous one
+	bool	save(const char* path, const CheckpointKeyT& key, const vector<char>& doneTiles, const Framebuffer& image, const vector<char>& state);
+	// False when there is no checkpoint at path or it was made with other settings
+	bool	load(const char* path, const CheckpointKeyT& key, vector<char>& doneTiles, Framebuffer& image, vector<char>& state);
+	void	remove(const char* path);
+}
@@ -0,0 +1,445 @@
+#include "Framebuffer.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <algorithm>
+#include <maya/MImage.h>
+#include <maya/MString.h>
+
+Framebuffer::Framebuffer() : w(0), h(0), left(0), bottom(0), imageWidth(1)
+{
+}
+
+void Framebuffer::init(int width, int height)
+{
+	initWindow(0, 0, width, height, width);
+}
+
+void Framebuffer::initWindow(int x0, int y0, int x1, int y1, int imageWidth)
+{
+	w = x1 - x0;
+	h = y1 - y0;
+	left = x0;
+	bottom = y0;
+	this->imageWidth = std::max(1, imageWidth);
+	size_t count = (size_t) w * h;
+	rgb.assign(count * 3, 0.0f);
+	times.assign(count, 0.0);
+	sampleCounts.assign(count, 0);
+}
+
+static inline unsigned char quantize(float value)
+{
+	return (unsigned char) (std::min(1.0f, std::max(0.0f, value)) * 255.0f);
+}
+
+void Framebuffer::toBytes(unsigned char* rgba) const
+{
+	int count = w * h;
+	for (int i = 0; i < count; ++i)
+	{
+		for (int c = 0; c < 3; ++c) {
+			rgba[i * 4 + c] = quantize(rgb[i * 3 + c]);
+		}
+		rgba[i * 4 + 3] = 0;
+	}
+}
+
+template <typename T>
+static bool writeAll(FILE* file, const vector<T>& values)
+{
+	return values.empty() || fwrite(&values[0], sizeof(T), values.size(), file) == values.size();
+}
+
+template <typename T>
+static bool readAll(FILE* file, vector<T>& values)
+{
+	return values.empty() || fread(&values[0], sizeof(T), values.size(), file) == values.size();
+}
+
+void Framebuffer::copyPixels(const Framebuffer& source, int x0, int y0, int x1, int y1)
+{
+	for (int y = y0; y < y1; ++y)
+	{
+		for (int x = x0; x < x1; ++x)
+		{
+			int index = y * imageWidth + x;
+			int to = local(index);
+			int from = source.local(index);
+			for (int c = 0; c < 3; ++c) {
+				rgb[to * 3 + c] = source.rgb[from * 3 + c];
+			}
+			times[to] = source.times[from];
+			sampleCounts[to] = source.sampleCounts[from];
+		}
+	}
+}
+
+bool Framebuffer::write(FILE* file) const
+{
+	return writeAll(file, rgb) && writeAll(file, times) && writeAll(file, sampleCounts);
+}
+
+bool Framebuffer::read(FILE* file)
+{
+	return readAll(file, rgb) && readAll(file, times) && readAll(file, sampleCounts);
+}
+
+void PixelStatisticsT::clear()
+{
+	pixels = 0;
+	timeSum = timeSquares = 0;
+	sampleSum = sampleSquares = 0;
+}
+
+void PixelStatisticsT::add(const Framebuffer& image)
+{
+	int count = image.width() * image.height();
+	for (int i = 0; i < count; ++i)
+	{
+		double time = image.pixelTime(i);
+		double samples = image.pixelSamples(i);
+		timeSum += time;
+		timeSquares += time * time;
+		sampleSum += samples;
+		sampleSquares += samples * samples;
+	}
+	pixels += count;
+}
+
+void PixelStatisticsT::add(const PixelStatisticsT& other)
+{
+	pixels += other.pixels;
+	timeSum += other.timeSum;
+	timeSquares += other.timeSquares;
+	sampleSum += other.sampleSum;
+	sampleSquares += other.sampleSquares;
+}
+
+// Top row first, three bytes per pixel
+static void topDownBytes(const Framebuffer& image, vector<unsigned char>& bytes)
+{
+	int width = image.width();
+	int height = image.height();
+	bytes.resize((size_t) width * height * 3);
+	for (int y = 0; y < height; ++y)
+	{
+		unsigned char* row = &bytes[(size_t) (height - 1 - y) * width * 3];
+		for (int x = 0; x < width; ++x)
+		{
+			const float* p = image.pixel(y * width + x);
+			for (int c = 0; c < 3; ++c) {
+				row[x * 3 + c] = quantize(p[c]);
+			}
+		}
+	}
+}
+
+// Portable float map, little endian. Its rows go bottom up like ours.
+static bool writePfm(const Framebuffer& image, const char* path)
+{
+	FILE* f = fopen(path, "wb");
+	if (f == NULL) {
+		return false;
+	}
+	fprintf(f, "PF\n%d %d\n-1.0\n", image.width(), image.height());
+	size_t count = (size_t) image.width() * image.height();
+	bool ok = count == 0 || fwrite(image.pixel(0), sizeof(float) * 3, count, f) == count;
+	return (fclose(f) == 0) && ok;
+}
+
+static bool writePpm(const Framebuffer& image, const char* path)
+{
+	vector<unsigned char> bytes;
+	topDownBytes(image, bytes);
+	FILE* f = fopen(path, "wb");
+	if (f == NULL) {
+		return false;
+	}
+	fprintf(f, "P6\n%d %d\n255\n", image.width(), image.height());
+	bool ok = bytes.empty() || fwrite(&bytes[0], 1, bytes.size(), f) == bytes.size();
+	return (fclose(f) == 0) && ok;
+}
+
+#pragma region PNG
+static unsigned int crcTable[256];
+
+static void initCrcTable()
+{
+	for (unsigned int n = 0; n < 256; ++n)
+	{
+		unsigned int c = n;
+		for (int k = 0; k < 8; ++k) {
+			c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+		}
+		crcTable[n] = c;
+	}
+}
+
+static unsigned int crc(unsigned int c, const unsigned char* data, size_t length)
+{
+	for (size_t i = 0; i < length; ++i) {
+		c = crcTable[(c ^ data[i]) & 0xff] ^ (c >> 8);
+	}
+	return c;
+}
+
+static void putBigEndian(vector<unsigned char>& out, unsigned int value)
+{
+	out.push_back((unsigned char) (value >> 24));
+	out.push_back((unsigned char) (value >> 16));
+	out.push_back((unsigned char) (value >> 8));
+	out.push_back((unsigned char) value);
+}
+
+static bool writeChunk(FILE* f, const char* type, const vector<unsigned char>& data)
+{
+	vector<unsigned char> chunk;
+	putBigEndian(chunk, (unsigned int) data.size());
+	chunk.insert(chunk.end(), type, type + 4);
+	chunk.insert(chunk.end(), data.begin(), data.end());
+	putBigEndian(chunk, crc(0xffffffffu, &chunk[4], chunk.size() - 4) ^ 0xffffffffu);
+	return fwrite(&chunk[0], 1, chunk.size(), f) == chunk.size();
+}
+
+// 8 bit RGB, stored in uncompressed deflate blocks so no zlib is needed
+static bool writePng(const Framebuffer& image, const char* path)
+{
+	static bool crcReady = false;
+	if (!crcReady) {
+		initCrcTable();
+		crcReady = true;
+	}
+
+	int width = image.width();
+	int height = image.height();
+	vector<unsigned char> bytes;
+	topDownBytes(image, bytes);
+
+	// Every scanline starts with filter type 0
+	size_t stride = (size_t) width * 3;
+	vector<unsigned char> raw;
+	raw.reserve((stride + 1) * height);
+	for (int y = 0; y < height; ++y)
+	{
+		raw.push_back(0);
+		raw.insert(raw.end(), bytes.begin() + y * stride, bytes.begin() + (y + 1) * stride);
+	}
+
+	vector<unsigned char> idat;
+	idat.push_back(0x78);
+	idat.push_back(0x01);
+	unsigned int a = 1, b = 0;
+	size_t pos = 0;
+	do
+	{
+		size_t length = std::min((size_t) 65535, raw.size() - pos);
+		bool last = pos + length == raw.size();
+		idat.push_back(last ? 1 : 0);
+		idat.push_back((unsigned char) length);
+		idat.push_back((unsigned char) (length >> 8));
+		idat.push_back((unsigned char) ~length);
+		idat.push_back((unsigned char) (~length >> 8));
+		for (size_t i = pos; i < pos + length; ++i)
+		{
+			idat.push_back(raw[i]);
+			a = (a + raw[i]) % 65521;
+			b = (b + a) % 65521;
+		}
+		pos += length;
+	} while (pos < raw.size());
+	putBigEndian(idat, (b << 16) | a);
+
+	vector<unsigned char> header;
+	putBigEndian(header, width);
+	putBigEndian(header, height);
+	header.push_back(8);	// bit depth
+	header.push_back(2);	// truecolor
+	header.push_back(0);	// deflate
+	header.push_back(0);	// adaptive filtering
+	header.push_back(0);	// no interlace
+
+	FILE* f = fopen(path, "wb");
+	if (f == NULL) {
+		return false;
+	}
+	static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+	bool ok = fwrite(signature, 1, 8, f) == 8;
+	ok = ok && writeChunk(f, "IHDR", header);
+	ok = ok && writeChunk(f, "IDAT", idat);
+	ok = ok && writeChunk(f, "IEND", vector<unsigned char>());
+	return (fclose(f) == 0) && ok;
+}
+#pragma endregion
+
+// Any format Maya knows by the extension, 8 bits per channel
+static bool writeMaya(const Framebuffer& image, const char* path)
+{
+	vector<unsigned char> rgba((size_t) image.width() * image.height() * 4);
+	image.toBytes(&rgba[0]);
+	MImage img;
+	img.setPixels(&rgba[0], image.width(), image.height());
+	MStatus status = img.writeToFile(MString(path));
+	img.release();
+	return status == MS::kSuccess;
+}
+
+static bool hasExtension(const char* path, const char* extension)
+{
+	size_t length = strlen(path);
+	size_t extensionLength = strlen(extension);
+	if (length < extensionLength) {
+		return false;
+	}
+	const char* tail = path + length - extensionLength;
+	for (size_t i = 0; i < extensionLength; ++i)
+	{
+		if (tolower(tail[i]) != extension[i]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+namespace imageOutput
+{
+	Format formatOf(const char* path)
+	{
+		if (hasExtension(path, ".pfm")) {
+			return PFM;
+		}
+		if (hasExtension(path, ".ppm")) {
+			return PPM;
+		}
+		if (hasExtension(path, ".png")) {
+			return PNG;
+		}
+		return MAYA;
+	}
+
+	FramebufferWriter writer(Format format)
+	{
+		switch (format) {
+		case PFM:
+			return writePfm;
+		case PPM:
+			return writePpm;
+		case PNG:
+			return writePng;
+		default:
+			return writeMaya;
+		}
+	}
+
+	const char* formatName(Format format)
+	{
+		switch (format) {
+		case PFM:
+			return "pfm";
+		case PPM:
+			return "ppm";
+		case PNG:
+			return "png";
+		default:
+			return "maya";
+		}
+	}
+
+	bool write(const Framebuffer& image, const char* path)
+	{
+		return writer(formatOf(path))(image, path);
+	}
+}
+
+static int seekTo(FILE* f, long long offset)
+{
+#if defined(_MSC_VER)
+	return _fseeki64(f, offset, SEEK_SET);
+#else
+	return fseeko(f, (off_t) offset, SEEK_SET);
+#endif
+}
+
+ImageStream::ImageStream() : file(NULL), format(imageOutput::MAYA), width(0), height(0), headerSize(0), failed(false)
+{
+}
+
+ImageStream::~ImageStream()
+{
+	close();
+}
+
+bool ImageStream::open(const char* path, int imageWidth, int imageHeight)
+{
+	close();
+	format = imageOutput::formatOf(path);
+	if (format != imageOutput::PFM && format != imageOutput::PPM) {
+		return false;
+	}
+	file = fopen(path, "wb");
+	if (file == NULL) {
+		return false;
+	}
+	width = imageWidth;
+	height = imageHeight;
+	failed = false;
+	int written = (format == imageOutput::PFM) ? fprintf(file, "PF\n%d %d\n-1.0\n", width, height) : fprintf(file, "P6\n%d %d\n255\n", width, height);
+	headerSize = written;
+
+	// Size the file up front, the tiles fill it in any order
+	long long pixelSize = (format == imageOutput::PFM) ? 3 * sizeof(float) : 3;
+	long long size = headerSize + pixelSize * width * height;
+	if (written < 0 || (size > headerSize && (seekTo(file, size - 1) != 0 || fputc(0, file) == EOF))) {
+		close();
+		return false;
+	}
+	return true;
+}
+
+bool ImageStream::writeTile(const Framebuffer& tile)
+{
+	bool ok = (file != NULL);
+#pragma omp critical(imageStream)
+	{
+		for (int y = 0; ok && y < tile.height(); ++y)
+		{
+			int imageY = tile.y0() + y;
+			const float* row = tile.pixel(y * tile.width());
+			if (format == imageOutput::PFM)
+			{
+				long long offset = headerSize + ((long long) imageY * width + tile.x0()) * 3 * sizeof(float);
+				ok = seekTo(file, offset) == 0 && fwrite(row, 3 * sizeof(float), tile.width(), file) == (size_t) tile.width();
+			}
+			else
+			{
+				long long offset = headerSize + ((long long) (height - 1 - imageY) * width + tile.x0()) * 3;
+				ok = seekTo(file, offset) == 0;
+				// In chunks through a fixed buffer, tiles can be any width
+				unsigned char bytes[3 * 256];
+				for (int x = 0; ok && x < tile.width(); x += 256)
+				{
+					int count = std::min(256, tile.width() - x);
+					for (int i = 0; i < 3 * count; ++i) {
+						bytes[i] = quantize(row[3 * x + i]);
+					}
+					ok = fwrite(bytes, 3, count, file) == (size_t) count;
+				}
+			}
+		}
+		if (!ok) {
+			failed = true;
+		}
+	}
+	return ok;
+}
+
+bool ImageStream::close()
+{
+	if (file == NULL) {
+		return true;
+	}
+	bool ok = fclose(file) == 0 && !failed;
+	file = NULL;
+	return ok;
+}
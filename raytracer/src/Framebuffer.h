@@ -0,0 +1,153 @@
+#pragma once
+
+#include <stdio.h>
+#include <vector>
+#include <maya/MColor.h>
+
+using std::vector;
+
+// Linear RGB image in single precision that the renderers write their pixels to, with the render time
+// and sample count of every pixel for the statistics. Rows go from the bottom of the image up, like the
+// image plane. Nothing is clamped or quantized until an 8 bit format is written.
+// A framebuffer can also hold just a window of the image, the tile being rendered when the image is
+// streamed to the file. Pixels are addressed by their index in the whole image either way.
+class Framebuffer
+{
+	int				w;
+	int				h;
+	int				left;
+	int				bottom;
+	int				imageWidth;
+	vector<float>	rgb;
+	vector<double>	times;
+	vector<int>		sampleCounts;
+
+	inline int local(int index) const
+	{
+		return (index / imageWidth - bottom) * w + (index % imageWidth - left);
+	}
+
+public:
+	Framebuffer();
+
+	// The whole image
+	void	init(int width, int height);
+	// The pixels [x0, x1) x [y0, y1) of an image imageWidth pixels wide
+	void	initWindow(int x0, int y0, int x1, int y1, int imageWidth);
+
+	// Clamped to [0, 1] and quantized, four bytes per pixel the way MImage takes them
+	void	toBytes(unsigned char* rgba) const;
+
+	// Copies the pixels [x0, x1) x [y0, y1) of source, both have to hold them
+	void	copyPixels(const Framebuffer& source, int x0, int y0, int x1, int y1);
+
+	// Everything the window holds, raw, for checkpoints. read expects a window of the same size.
+	bool	write(FILE* file) const;
+	bool	read(FILE* file);
+
+	inline int width() const
+	{
+		return w;
+	}
+
+	inline int height() const
+	{
+		return h;
+	}
+
+	inline int x0() const
+	{
+		return left;
+	}
+
+	inline int y0() const
+	{
+		return bottom;
+	}
+
+	inline void set(int index, const MColor& color)
+	{
+		float* p = &rgb[local(index) * 3];
+		p[0] = color.r;
+		p[1] = color.g;
+		p[2] = color.b;
+	}
+
+	inline double& time(int index)
+	{
+		return times[local(index)];
+	}
+
+	inline int& samples(int index)
+	{
+		return sampleCounts[local(index)];
+	}
+
+	// By the position in the window, row by row from the bottom
+	inline const float* pixel(int localIndex) const
+	{
+		return &rgb[localIndex * 3];
+	}
+
+	inline double pixelTime(int localIndex) const
+	{
+		return times[localIndex];
+	}
+
+	inline int pixelSamples(int localIndex) const
+	{
+		return sampleCounts[localIndex];
+	}
+};
+
+// Sums over pixels of their render time and sample count, enough for the mean and deviation of both
+struct PixelStatisticsT
+{
+	long	pixels;
+	double	timeSum;
+	double	timeSquares;
+	double	sampleSum;
+	double	sampleSquares;
+
+	void	clear();
+	void	add(const Framebuffer& image);
+	void	add(const PixelStatisticsT& other);
+};
+
+// Writes the image to path, false when the file could not be written
+typedef bool (*FramebufferWriter)(const Framebuffer& image, const char* path);
+
+namespace imageOutput
+{
+	enum Format { PFM, PPM, PNG, MAYA };
+
+	// Picked by the extension of the path, anything else goes through MImage
+	Format				formatOf(const char* path);
+	FramebufferWriter	writer(Format format);
+	const char*			formatName(Format format);
+
+	bool				write(const Framebuffer& image, const char* path);
+}
+
+// Image file the tiles are written to as they are finished, so the whole image never has to be in
+// memory. Only PFM and PPM can be written this way, their rows are raw and at fixed offsets.
+class ImageStream
+{
+	FILE*				file;
+	imageOutput::Format	format;
+	int					width;
+	int					height;
+	long long			headerSize;
+	bool				failed;		// some tile could not be written
+
+public:
+	ImageStream();
+	~ImageStream();
+
+	// False when the format of path can't be streamed or the file can't be created
+	bool	open(const char* path, int imageWidth, int imageHeight);
+	// Safe to call from several render threads at once
+	bool	writeTile(const Framebuffer& tile);
+	// False when the file or any of the tiles could not be written
+	bool	close();
+};
@@ -0,0 +1,433 @@
+#include "Grid.h"
+
+#include <algorithm>
+#include <omp.h>
+
+// A face found to overlap a cell during binning
+struct CellFaceT
+{
+	int		cellIndex;
+	int		faceIndex;
+};
+
+Grid::Grid()
+{
+	resolution[0] = resolution[1] = resolution[2] = 1;
+	cellSize[0] = cellSize[1] = cellSize[2] = 1;
+	cellHalfSize[0] = cellHalfSize[1] = cellHalfSize[2] = 0.5;
+	clear();
+}
+
+Grid::~Grid()
+{
+}
+
+void Grid::clear()
+{
+	cellOffsets.assign(cellCount() + 1, 0);
+	cellFaces.clear();
+	cellSubGrids.clear();
+	subGrids.clear();
+	cellPackOffsets.clear();
+	cellPacks.clear();
+	cellPackFaces.clear();
+}
+
+// Faces of a cell are kept in the order of their meshes and of their faces in the mesh
+static inline bool gridFaceBefore(const GridFaceT& a, const GridFaceT& b)
+{
+	return a.meshIndex < b.meshIndex || (a.meshIndex == b.meshIndex && a.faceIndex < b.faceIndex);
+}
+
+void Grid::swap(Grid& other)
+{
+	std::swap(min, other.min);
+	std::swap(max, other.max);
+	for (int a = 0; a < 3; ++a)
+	{
+		std::swap(resolution[a], other.resolution[a]);
+		std::swap(cellSize[a], other.cellSize[a]);
+		std::swap(cellHalfSize[a], other.cellHalfSize[a]);
+	}
+	cellOffsets.swap(other.cellOffsets);
+	cellFaces.swap(other.cellFaces);
+	cellSubGrids.swap(other.cellSubGrids);
+	subGrids.swap(other.subGrids);
+	cellPackOffsets.swap(other.cellPackOffsets);
+	cellPacks.swap(other.cellPacks);
+	cellPackFaces.swap(other.cellPackFaces);
+}
+
+void Grid::setBounds(const MPoint& _min, const MPoint& _max, const int _resolution[3])
+{
+	min = _min;
+	max = _max;
+	for (int a = 0; a < 3; ++a)
+	{
+		resolution[a] = (_resolution[a] < 1) ? 1 : _resolution[a];
+		cellSize[a] = (max[a] - min[a]) / resolution[a];
+		cellHalfSize[a] = cellSize[a] / 2;
+	}
+	clear();
+}
+
+void Grid::save(CacheWriter& out) const
+{
+	out.put(min.x);
+	out.put(min.y);
+	out.put(min.z);
+	out.put(max.x);
+	out.put(max.y);
+	out.put(max.z);
+	for (int a = 0; a < 3; ++a) {
+		out.put(resolution[a]);
+	}
+	out.putArray(cellOffsets);
+	out.putArray(cellFaces);
+	out.putArray(cellSubGrids);
+	out.put((int) subGrids.size());
+	for (int i = 0; i < (int) subGrids.size(); ++i) {
+		subGrids[i].save(out);
+	}
+	out.putArray(cellPackOffsets);
+	out.putArray(cellPacks);
+	out.putArray(cellPackFaces);
+}
+
+bool Grid::load(CacheReader& in)
+{
+	double bounds[6];
+	int res[3];
+	for (int i = 0; i < 6; ++i) {
+		in.get(bounds[i]);
+	}
+	for (int a = 0; a < 3; ++a) {
+		in.get(res[a]);
+	}
+	if (!in.ok()) {
+		return false;
+	}
+	setBounds(MPoint(bounds[0], bounds[1], bounds[2]), MPoint(bounds[3], bounds[4], bounds[5]), res);
+	int subGridCount = 0;
+	// A sub grid takes at least its bounds and resolution
+	if (!in.getArray(cellOffsets) || !in.getArray(cellFaces) || !in.getArray(cellSubGrids) || !in.getCount(subGridCount, sizeof(bounds) + sizeof(res))) {
+		return false;
+	}
+	subGrids.resize(subGridCount);
+	for (int i = 0; i < subGridCount; ++i)
+	{
+		if (!subGrids[i].load(in)) {
+			return false;
+		}
+	}
+	in.getArray(cellPackOffsets);
+	in.getArray(cellPacks);
+	in.getArray(cellPackFaces);
+	return in.ok() && (int) cellOffsets.size() == cellCount() + 1;
+}
+
+void Grid::findCell(const MPoint& point, int& x, int& y, int& z) const
+{
+	int cell[3];
+	for (int a = 0; a < 3; ++a)
+	{
+		cell[a] = 0;
+		if (cellSize[a] > DOUBLE_NUMERICAL_THRESHHOLD) {
+			cell[a] = std::min(resolution[a] - 1, std::max(0, (int) floor((point[a] - min[a]) / cellSize[a])));
+		}
+	}
+	x = cell[0];
+	y = cell[1];
+	z = cell[2];
+}
+
+void Grid::autoResolution(const MPoint& _min, const MPoint& _max, int faceCount, double density, int _resolution[3])
+{
+	double extent[3];
+	double maxExtent = 0;
+	for (int a = 0; a < 3; ++a)
+	{
+		extent[a] = _max[a] - _min[a];
+		maxExtent = std::max(maxExtent, extent[a]);
+	}
+
+	// Cell side s such that the product of extent / s over the non flat axes is density * faceCount
+	double measure = 1;
+	int dimensions = 0;
+	for (int a = 0; a < 3; ++a)
+	{
+		_resolution[a] = 1;
+		if (extent[a] > maxExtent * 1e-3 && extent[a] > DOUBLE_NUMERICAL_THRESHHOLD) {
+			measure *= extent[a];
+			dimensions++;
+		}
+	}
+	if (dimensions == 0 || faceCount < 1 || density <= 0) {
+		return;
+	}
+
+	double targetCells = std::min((double) MAX_AUTO_CELLS, density * faceCount);
+	double cellSide = pow(measure / targetCells, 1.0 / dimensions);
+	for (int a = 0; a < 3; ++a)
+	{
+		if (extent[a] > maxExtent * 1e-3 && extent[a] > DOUBLE_NUMERICAL_THRESHHOLD) {
+			_resolution[a] = std::max(1, std::min((int) MAX_AUTO_RESOLUTION, (int) (extent[a] / cellSide + 0.5)));
+		}
+	}
+}
+
+size_t Grid::estimateMemoryUsage(const vector<MeshDataT>& meshes, const vector<GridFaceT>& faces) const
+{
+	size_t references = 0;
+	for (int fi = 0; fi < (int) faces.size(); ++fi)
+	{
+		const MPointArray& vertices = meshes[faces[fi].meshIndex].faces[faces[fi].faceIndex].vertices;
+		if (vertices.length() != 3) {
+			continue;
+		}
+		size_t spanned = 1;
+		for (int a = 0; a < 3; ++a)
+		{
+			if (cellSize[a] <= DOUBLE_NUMERICAL_THRESHHOLD) {
+				spanned *= resolution[a];
+				continue;
+			}
+			double fMin = std::min(vertices[0][a], std::min(vertices[1][a], vertices[2][a]));
+			double fMax = std::max(vertices[0][a], std::max(vertices[1][a], vertices[2][a]));
+			int lo = std::max(0, (int) floor((fMin - min[a]) / cellSize[a]));
+			int hi = std::min(resolution[a] - 1, (int) floor((fMax - min[a]) / cellSize[a]));
+			spanned *= (hi >= lo) ? (hi - lo + 1) : 1;
+		}
+		references += spanned;
+	}
+	return sizeof(Grid) + (cellCount() + 1) * sizeof(int) + references * sizeof(GridFaceT);
+}
+
+size_t Grid::memoryUsage() const
+{
+	size_t res = sizeof(Grid) + cellOffsets.capacity() * sizeof(int) + cellFaces.capacity() * sizeof(GridFaceT) + cellSubGrids.capacity() * sizeof(int)
+		+ cellPackOffsets.capacity() * sizeof(int) + cellPacks.capacity() * sizeof(TrianglePackT) + cellPackFaces.capacity() * sizeof(int);
+	for (int i = 0; i < (int) subGrids.size(); ++i)
+	{
+		res += subGrids[i].memoryUsage();
+	}
+	return res;
+}
+
+void Grid::refine(const vector<MeshDataT>& meshes, int threshold, double density)
+{
+	int cells = cellCount();
+	cellSubGrids.assign(cells, -1);
+	subGrids.clear();
+
+	for (int z = 0; z < resolution[2]; ++z)
+	{
+		for (int y = 0; y < resolution[1]; ++y)
+		{
+			for (int x = 0; x < resolution[0]; ++x)
+			{
+				int cellIndex = flatten(x, y, z);
+				int count = cellOffsets[cellIndex + 1] - cellOffsets[cellIndex];
+				if (count <= threshold) {
+					continue;
+				}
+
+				MPoint cellMin, cellMax;
+				cellBounds(x, y, z, cellMin, cellMax);
+				int subResolution[3];
+				autoResolution(cellMin, cellMax, count, density, subResolution);
+				if (subResolution[0] * subResolution[1] * subResolution[2] <= 1) {
+					continue;
+				}
+
+				vector<GridFaceT> faces(cellFaces.begin() + cellOffsets[cellIndex], cellFaces.begin() + cellOffsets[cellIndex + 1]);
+				cellSubGrids[cellIndex] = (int) subGrids.size();
+				subGrids.push_back(Grid());
+				subGrids.back().setBounds(cellMin, cellMax, subResolution);
+				subGrids.back().build(meshes, faces);
+			}
+		}
+	}
+
+	if (subGrids.empty()) {
+		cellSubGrids.clear();
+		return;
+	}
+
+	// Drop the faces of the refined cells from this grid
+	vector<GridFaceT> remaining;
+	vector<int> offsets(cells + 1, 0);
+	for (int c = 0; c < cells; ++c)
+	{
+		if (cellSubGrids[c] < 0) {
+			remaining.insert(remaining.end(), cellFaces.begin() + cellOffsets[c], cellFaces.begin() + cellOffsets[c + 1]);
+		}
+		offsets[c + 1] = (int) remaining.size();
+	}
+	cellFaces.swap(remaining);
+	cellOffsets.swap(offsets);
+}
+
+void Grid::update(const vector<MeshDataT>& meshes, const vector<bool>& changedMeshes, const vector<GridFaceT>& faces)
+{
+	Grid added;
+	added.setBounds(min, max, resolution);
+	added.build(meshes, faces);
+
+	// Both the kept and the added faces of a cell are sorted, so merging them gives the cell a full build would
+	int cells = cellCount();
+	vector<GridFaceT> merged;
+	merged.reserve(cellFaces.size() + added.cellFaces.size());
+	vector<int> offsets(cells + 1, 0);
+	for (int c = 0; c < cells; ++c)
+	{
+		vector<GridFaceT>::const_iterator addedBegin = added.cellFaces.begin() + added.cellOffsets[c];
+		vector<GridFaceT>::const_iterator addedEnd = added.cellFaces.begin() + added.cellOffsets[c + 1];
+		int subGrid = subGridOf(c);
+		if (subGrid >= 0) {
+			subGrids[subGrid].update(meshes, changedMeshes, vector<GridFaceT>(addedBegin, addedEnd));
+		}
+		else
+		{
+			int first = (int) merged.size();
+			for (int fi = cellOffsets[c]; fi < cellOffsets[c + 1]; ++fi)
+			{
+				if (!changedMeshes[cellFaces[fi].meshIndex]) {
+					merged.push_back(cellFaces[fi]);
+				}
+			}
+			int kept = (int) merged.size();
+			merged.insert(merged.end(), addedBegin, addedEnd);
+			std::inplace_merge(merged.begin() + first, merged.begin() + kept, merged.end(), gridFaceBefore);
+		}
+		offsets[c + 1] = (int) merged.size();
+	}
+	cellFaces.swap(merged);
+	cellOffsets.swap(offsets);
+
+	cellPackOffsets.clear();
+	cellPacks.clear();
+	cellPackFaces.clear();
+}
+
+void Grid::buildPacks(const vector<TriangleT>& triangles, const vector<int>& meshFaceOffsets)
+{
+	int cells = cellCount();
+	cellPackOffsets.assign(cells + 1, 0);
+	for (int c = 0; c < cells; ++c)
+	{
+		int count = cellOffsets[c + 1] - cellOffsets[c];
+		cellPackOffsets[c + 1] = cellPackOffsets[c] + (count + TRIANGLE_PACK_WIDTH - 1) / TRIANGLE_PACK_WIDTH;
+	}
+
+	cellPacks.resize(cellPackOffsets[cells]);
+	cellPackFaces.assign(cellPacks.size() * TRIANGLE_PACK_WIDTH, -1);
+	for (int c = 0; c < cells; ++c)
+	{
+		MPoint cellMin, cellMax;
+		cellBounds(c % resolution[0], (c / resolution[0]) % resolution[1], c / (resolution[0] * resolution[1]), cellMin, cellMax);
+		for (int p = cellPackOffsets[c]; p < cellPackOffsets[c + 1]; ++p)
+		{
+			cellPacks[p].clear(cellMin);
+		}
+		for (int fi = cellOffsets[c]; fi < cellOffsets[c + 1]; ++fi)
+		{
+			int slot = cellPackOffsets[c] * TRIANGLE_PACK_WIDTH + (fi - cellOffsets[c]);
+			const GridFaceT& ref = cellFaces[fi];
+			cellPacks[slot / TRIANGLE_PACK_WIDTH].set(slot % TRIANGLE_PACK_WIDTH, triangles[meshFaceOffsets[ref.meshIndex] + ref.faceIndex]);
+			cellPackFaces[slot] = fi;
+		}
+	}
+
+	for (int i = 0; i < (int) subGrids.size(); ++i)
+	{
+		subGrids[i].buildPacks(triangles, meshFaceOffsets);
+	}
+}
+
+void Grid::build(const vector<MeshDataT>& meshes, const vector<GridFaceT>& faces)
+{
+	double halfs[3];
+	for (int a = 0; a < 3; ++a)
+	{
+		halfs[a] = cellHalfSize[a] + DOUBLE_NUMERICAL_THRESHHOLD;
+	}
+
+	int faceCount = (int) faces.size();
+	vector<vector<CellFaceT>> threadCellFaces(omp_get_max_threads());
+
+#pragma omp parallel
+	{
+		vector<CellFaceT>& cellFacesOfThread = threadCellFaces[omp_get_thread_num()];
+
+#pragma omp for schedule(static)
+		for (int fi = 0; fi < faceCount; ++fi)
+		{
+			const MPointArray& vertices = meshes[faces[fi].meshIndex].faces[faces[fi].faceIndex].vertices;
+			if (vertices.length() != 3) {
+				continue;
+			}
+
+			int lo[3], hi[3];
+			for (int a = 0; a < 3; ++a)
+			{
+				if (cellSize[a] <= DOUBLE_NUMERICAL_THRESHHOLD) {
+					lo[a] = 0;
+					hi[a] = resolution[a] - 1;
+					continue;
+				}
+				double fMin = std::min(vertices[0][a], std::min(vertices[1][a], vertices[2][a]));
+				double fMax = std::max(vertices[0][a], std::max(vertices[1][a], vertices[2][a]));
+				lo[a] = std::max(0, (int) floor((fMin - min[a]) / cellSize[a] - DOUBLE_NUMERICAL_THRESHHOLD));
+				hi[a] = std::min(resolution[a] - 1, (int) floor((fMax - min[a]) / cellSize[a] + DOUBLE_NUMERICAL_THRESHHOLD));
+			}
+
+			for (int iz = lo[2]; iz <= hi[2]; ++iz)
+			{
+				for (int iy = lo[1]; iy <= hi[1]; ++iy)
+				{
+					for (int ix = lo[0]; ix <= hi[0]; ++ix)
+					{
+						MPoint center(	min.x + (ix + 0.5) * cellSize[0],
+										min.y + (iy + 0.5) * cellSize[1],
+										min.z + (iz + 0.5) * cellSize[2]);
+						if (triangleBoxOverlap(center, halfs, vertices))
+						{
+							CellFaceT cf;
+							cf.cellIndex = flatten(ix, iy, iz);
+							cf.faceIndex = fi;
+							cellFacesOfThread.push_back(cf);
+						}
+					}
+				}
+			}
+		}
+	}
+
+	// A static schedule hands the threads consecutive face ranges in thread order,
+	// so filling the cells in thread order keeps every cell sorted no matter how many threads ran
+	int cells = cellCount();
+	cellOffsets.assign(cells + 1, 0);
+	for (int t = 0; t < (int) threadCellFaces.size(); ++t)
+	{
+		for (int i = 0; i < (int) threadCellFaces[t].size(); ++i)
+		{
+			cellOffsets[threadCellFaces[t][i].cellIndex + 1]++;
+		}
+	}
+	for (int c = 0; c < cells; ++c)
+	{
+		cellOffsets[c + 1] += cellOffsets[c];
+	}
+
+	cellFaces.resize(cellOffsets[cells]);
+	vector<int> fill(cellOffsets.begin(), cellOffsets.end() - 1);
+	for (int t = 0; t < (int) threadCellFaces.size(); ++t)
+	{
+		for (int i = 0; i < (int) threadCellFaces[t].size(); ++i)
+		{
+			const CellFaceT& cf = threadCellFaces[t][i];
+			cellFaces[fill[cf.cellIndex]++] = faces[cf.faceIndex];
+		}
+	}
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <maya/MPoint.h>
+#include <vector>
+#include "Util.h"
+#include "Mesh.h"
+#include "TrianglePack.h"
+#include "CacheStream.h"
+
+using std::vector;
+using namespace util;
+
+// Reference to a face of a mesh stored in a grid cell
+struct GridFaceT
+{
+	int		meshIndex;
+	int		faceIndex;
+};
+
+// Uniform grid over an axis aligned box.
+// Cell bounds are computed from the cell index, and the faces of all the cells are kept
+// in one contiguous array: the faces of cell i are cellFaces[cellOffsets[i]] .. cellFaces[cellOffsets[i + 1] - 1].
+class Grid
+{
+public:
+	MPoint				min;
+	MPoint				max;
+	int					resolution[3];
+	double				cellSize[3];
+	double				cellHalfSize[3];
+
+	vector<int>			cellOffsets;
+	vector<GridFaceT>	cellFaces;
+
+	// Two level grid: cells holding too many faces get a grid of their own.
+	// cellSubGrids maps a cell to its index in subGrids, or -1. It is empty when no cell was refined.
+	vector<int>			cellSubGrids;
+	vector<Grid>		subGrids;
+
+	// Optional single precision copy of the faces of every cell for the SIMD kernels.
+	// The packs of cell i are cellPacks[cellPackOffsets[i]] .. cellPacks[cellPackOffsets[i + 1] - 1],
+	// lane l of pack p holds cellFaces[cellPackFaces[p * TRIANGLE_PACK_WIDTH + l]] (-1 for an unused lane).
+	vector<int>				cellPackOffsets;
+	vector<TrianglePackT>	cellPacks;
+	vector<int>				cellPackFaces;
+
+	static const int	MAX_AUTO_RESOLUTION = 512;
+	static const int	MAX_AUTO_CELLS = 1 << 24;
+
+	Grid();
+	~Grid();
+
+	void	setBounds(const MPoint& _min, const MPoint& _max, const int _resolution[3]);
+	void	clear();
+
+	// Picks a resolution per axis so that the grid has about density * faceCount cells
+	// of roughly cubic shape. Flat axes of the box get a single cell.
+	static void	autoResolution(const MPoint& _min, const MPoint& _max, int faceCount, double density, int _resolution[3]);
+
+	// Upper bound on the memory build() will use for the given faces, counted from their bounding boxes
+	size_t	estimateMemoryUsage(const vector<MeshDataT>& meshes, const vector<GridFaceT>& faces) const;
+
+	// Bins the given faces into the cells, testing every face only against the cells its bounding box spans.
+	// Runs in parallel, the result does not depend on the number of threads.
+	void	build(const vector<MeshDataT>& meshes, const vector<GridFaceT>& faces);
+
+	// Gives every cell with more than threshold faces a sub grid of the given density.
+	// The faces of a refined cell are only kept in its sub grid.
+	void	refine(const vector<MeshDataT>& meshes, int threshold, double density);
+
+	// Replaces the faces of the changed meshes with the given ones, binning only those. The cells,
+	// the sub grids included, stay the ones of the last build. The packs have to be built again.
+	void	update(const vector<MeshDataT>& meshes, const vector<bool>& changedMeshes, const vector<GridFaceT>& faces);
+
+	// Fills the packs of this grid and of its sub grids. triangles is indexed by scene wide
+	// face id, the first of every mesh given by meshFaceOffsets.
+	void	buildPacks(const vector<TriangleT>& triangles, const vector<int>& meshFaceOffsets);
+
+	// Cell containing the point, clamped to the grid
+	void	findCell(const MPoint& point, int& x, int& y, int& z) const;
+
+	size_t	memoryUsage() const;
+
+	// The built grid with its sub grids and packs, for the scene cache
+	void	save(CacheWriter& out) const;
+	bool	load(CacheReader& in);
+
+	void	swap(Grid& other);
+
+	inline int cellCount() const
+	{
+		return resolution[0] * resolution[1] * resolution[2];
+	}
+
+	inline int flatten(int x, int y, int z) const
+	{
+		return x + resolution[0] * (y + resolution[1] * z);
+	}
+
+	inline int subGridOf(int cellIndex) const
+	{
+		return cellSubGrids.empty() ? -1 : cellSubGrids[cellIndex];
+	}
+
+	inline bool isCellEmpty(int cellIndex) const
+	{
+		return cellOffsets[cellIndex] == cellOffsets[cellIndex + 1];
+	}
+
+	inline void cellBounds(int x, int y, int z, MPoint& cellMin, MPoint& cellMax) const
+	{
+		cellMin = MPoint(min.x + x * cellSize[0], min.y + y * cellSize[1], min.z + z * cellSize[2]);
+		cellMax = MPoint(cellMin.x + cellSize[0], cellMin.y + cellSize[1], cellMin.z + cellSize[2]);
+	}
+};
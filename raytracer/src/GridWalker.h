@@ -0,0 +1,100 @@
+#pragma once
+
+#include <maya/MPoint.h>
+#include <maya/MVector.h>
+#include <float.h>
+
+// 3D-DDA (Amanatides & Woo) walk over a uniform grid.
+// The crossing times of the next cell boundary on every axis (tMax) and the
+// time it takes to cross a whole cell (tDelta) are computed once per ray,
+// after that every step is a couple of compares and adds.
+// Times are measured along the ray direction from the ray source, so for a
+// normalized direction they are distances.
+struct GridWalker
+{
+	int		cell[3];
+	int		step[3];
+	int		resolution[3];
+	int		indexStep[3];
+	int		index;
+
+	double	tMax[3];
+	double	tDelta[3];
+
+	// (x,y,z) is the cell the ray source is in, or the first cell the ray enters.
+	inline void init(const MPoint& gridMin, const double cellSize[3], const int res[3], const MPoint& src, const MVector& dir, int x, int y, int z)
+	{
+		cell[0] = x;
+		cell[1] = y;
+		cell[2] = z;
+
+		int stride[3] = { 1, res[0], res[0] * res[1] };
+		index = x + stride[1] * y + stride[2] * z;
+
+		for (int a = 0; a < 3; ++a)
+		{
+			resolution[a] = res[a];
+			if (dir[a] > 0) {
+				step[a] = 1;
+				tMax[a] = (gridMin[a] + (cell[a] + 1) * cellSize[a] - src[a]) / dir[a];
+				tDelta[a] = cellSize[a] / dir[a];
+			}
+			else if (dir[a] < 0) {
+				step[a] = -1;
+				tMax[a] = (gridMin[a] + cell[a] * cellSize[a] - src[a]) / dir[a];
+				tDelta[a] = -cellSize[a] / dir[a];
+			}
+			else {
+				step[a] = 0;
+				tMax[a] = DBL_MAX;
+				tDelta[a] = DBL_MAX;
+			}
+			indexStep[a] = step[a] * stride[a];
+		}
+	}
+
+	// The axis whose cell boundary the ray crosses first
+	inline int nextAxis() const
+	{
+		if (tMax[0] < tMax[1]) {
+			return (tMax[0] < tMax[2]) ? 0 : 2;
+		}
+		return (tMax[1] < tMax[2]) ? 1 : 2;
+	}
+
+	// Time at which the ray entered the current cell, 0 for the cell the ray starts in
+	inline double entryTime() const
+	{
+		double t = 0;
+		for (int a = 0; a < 3; ++a)
+		{
+			if (step[a] != 0 && tMax[a] - tDelta[a] > t) {
+				t = tMax[a] - tDelta[a];
+			}
+		}
+		return t;
+	}
+
+	// Time at which the ray leaves the current cell
+	inline double exitTime() const
+	{
+		return tMax[nextAxis()];
+	}
+
+	// Moves to the next cell along the ray.
+	// Returns false when the ray leaves the grid.
+	inline bool next()
+	{
+		int a = nextAxis();
+		if (step[a] == 0) {
+			return false;
+		}
+		cell[a] += step[a];
+		if (cell[a] < 0 || cell[a] >= resolution[a]) {
+			return false;
+		}
+		tMax[a] += tDelta[a];
+		index += indexStep[a];
+		return true;
+	}
+};
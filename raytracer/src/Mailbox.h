@@ -0,0 +1,44 @@
+#pragma once
+
+#define		MAILBOX_SIZE			128		// must be a power of 2
+
+// Small hashed cache of the faces the current ray was already tested against, with the results.
+// A face spanning several voxels is then intersected once per ray, and the cached hit is still
+// checked against the bounds of every voxel it is found in.
+// One mailbox is kept per thread, so it holds only plain data (no constructors) to be usable
+// as an OpenMP threadprivate variable.
+struct Mailbox
+{
+	struct EntryT
+	{
+		unsigned int	rayId;
+		int				faceId;
+		bool			hit;
+		double			time;
+		double			intersection[3];
+	};
+
+	unsigned int	rayId;
+	EntryT			entries[MAILBOX_SIZE];
+
+	// Invalidates all the entries of the previous ray
+	inline void nextRay()
+	{
+		if (++rayId == 0) {
+			for (int i = 0; i < MAILBOX_SIZE; ++i) {
+				entries[i].rayId = 0;
+			}
+			rayId = 1;
+		}
+	}
+
+	inline EntryT& entry(int faceId)
+	{
+		return entries[faceId & (MAILBOX_SIZE - 1)];
+	}
+
+	inline bool contains(const EntryT& e, int faceId) const
+	{
+		return e.rayId == rayId && e.faceId == faceId;
+	}
+};
@@ -1,10 +1,10 @@
 #pragma once
 
-#include <maya\MString.h>
-#include <maya\MFnDependencyNode.h>
-#include <maya\MPlug.h>
-#include <maya\MPlugArray.h>
-#include <maya\MColor.h>
+#include <maya/MString.h>
+#include <maya/MFnDependencyNode.h>
+#include <maya/MPlug.h>
+#include <maya/MPlugArray.h>
+#include <maya/MColor.h>
 #include <vector>
 #include <maya/MAngle.h>
 #include <maya/MFnTransform.h>
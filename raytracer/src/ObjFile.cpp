@@ -0,0 +1,367 @@
+#include "ObjFile.h"
+
+#include <stdlib.h>
+#include <float.h>
+#include <fstream>
+#include <sstream>
+#include <map>
+#include <algorithm>
+#include <maya/MGlobal.h>
+#include "Util.h"
+
+using std::string;
+using std::istringstream;
+using std::map;
+
+// A corner of a face: its position, texture coordinate and normal, -1 for the ones it does not have
+struct ObjCornerT
+{
+	int		v;
+	int		t;
+	int		n;
+};
+
+static string trimmed(const string& text)
+{
+	size_t first = text.find_first_not_of(" \t\r");
+	if (first == string::npos) {
+		return string();
+	}
+	return text.substr(first, text.find_last_not_of(" \t\r") - first + 1);
+}
+
+// The rest of the line, for names and paths that may have spaces in them
+static string restOfLine(istringstream& words)
+{
+	string rest;
+	std::getline(words, rest);
+	return trimmed(rest);
+}
+
+static bool readColor(istringstream& words, MColor& color)
+{
+	float r, g, b;
+	if (!(words >> r)) {
+		return false;
+	}
+	// A single value is gray
+	if (!(words >> g >> b)) {
+		g = b = r;
+	}
+	color = MColor(r, g, b);
+	return true;
+}
+
+// OBJ indices start at 1, negative ones count back from the last element read
+static bool parseIndex(const string& text, int count, int& index)
+{
+	if (text.empty()) {
+		index = -1;
+		return true;
+	}
+	char* end = NULL;
+	long value = strtol(text.c_str(), &end, 10);
+	if (*end != '\0' || value == 0) {
+		return false;
+	}
+	index = (value > 0) ? (int) value - 1 : count + (int) value;
+	return index >= 0 && index < count;
+}
+
+// v, v/t, v//n or v/t/n
+static bool parseCorner(const string& word, int positions, int uvs, int normals, ObjCornerT& corner)
+{
+	string parts[3];
+	int part = 0;
+	for (size_t i = 0; i < word.size(); ++i)
+	{
+		if (word[i] == '/') {
+			if (++part > 2) {
+				return false;
+			}
+		}
+		else {
+			parts[part] += word[i];
+		}
+	}
+	return !parts[0].empty() && parseIndex(parts[0], positions, corner.v) && parseIndex(parts[1], uvs, corner.t)
+		&& parseIndex(parts[2], normals, corner.n);
+}
+
+// What MTL leaves out: gray, no highlight, opaque
+static void initMaterial(Material& m)
+{
+	m.clear();
+	m.diffuse = MColor(0.8f, 0.8f, 0.8f);
+	m.diffuseCoeff = 1;
+	m.cosPower = 0;
+	m.isReflective = false;
+}
+
+// The material of the objects that do not name one, the one of Maya meshes without a shader
+static void initDefaultMaterial(Material& m)
+{
+	m.toDefault();
+	m.diffuseCoeff = 1;
+	m.isReflective = false;
+}
+
+static void loadTexture(Material& m, const string& path)
+{
+	MImage* image = new MImage();
+	if (image->readFromFile(path.c_str()) != MS::kSuccess)
+	{
+		MGlobal::displayWarning(MString("Could not read the texture ") + path.c_str());
+		delete image;
+		return;
+	}
+	m.texture = image;
+	m.isTextured = true;
+}
+
+// Reads the materials of an MTL file into materials. Phong when there is a highlight, and
+// reflective when the illumination model has reflections, by the average of the specular color.
+static void loadMaterialLibrary(const string& path, map<string, Material>& materials)
+{
+	std::ifstream in(path.c_str());
+	if (!in) {
+		MGlobal::displayWarning(MString("Could not open the material library ") + path.c_str());
+		return;
+	}
+
+	map<string, int> illumination;
+	Material* current = NULL;
+	string currentName;
+	string line;
+	while (std::getline(in, line))
+	{
+		istringstream words(line.substr(0, line.find('#')));
+		string key;
+		if (!(words >> key)) {
+			continue;
+		}
+		if (key == "newmtl") {
+			currentName = restOfLine(words);
+			current = &materials[currentName];
+			initMaterial(*current);
+			illumination[currentName] = 2;
+			continue;
+		}
+		if (current == NULL) {
+			continue;
+		}
+
+		float value;
+		if (key == "Kd") {
+			readColor(words, current->diffuse);
+		}
+		else if (key == "Ka") {
+			readColor(words, current->ambient);
+		}
+		else if (key == "Ks") {
+			readColor(words, current->specular);
+		}
+		else if (key == "Ke") {
+			readColor(words, current->emissive);
+		}
+		else if (key == "Ns" && (words >> value)) {
+			current->cosPower = value;
+		}
+		else if (key == "d" && (words >> value)) {
+			current->transparency = 1 - value;
+		}
+		else if (key == "Tr" && (words >> value)) {
+			current->transparency = value;
+		}
+		else if (key == "Ni" && (words >> value)) {
+			current->refractiveIndex = value;
+		}
+		else if (key == "illum" && (words >> value)) {
+			illumination[currentName] = (int) value;
+		}
+		else if (key == "map_Kd") {
+			// Options come before the file name
+			string word, name;
+			while (words >> word) {
+				name = word;
+			}
+			if (!name.empty()) {
+				loadTexture(*current, objFile::resolvePath(path.c_str(), name.c_str()));
+			}
+		}
+	}
+
+	for (map<string, int>::const_iterator it = illumination.begin(); it != illumination.end(); ++it)
+	{
+		Material& m = materials[it->first];
+		MColor& ks = m.specular;
+		m.type = (ks.r + ks.g + ks.b > 0 && m.cosPower > 1) ? MT_PHONG : MT_LAMBERT;
+		m.isTransparent = m.transparency > 0;
+		m.kr0 = pow(1 - m.refractiveIndex, 2) / pow(1 + m.refractiveIndex, 2);
+		// Models 3 to 9 all have reflections
+		m.isReflective = it->second >= 3 && it->second <= 9;
+		m.reflectivity = m.isReflective ? (ks.r + ks.g + ks.b) / 3 : 0;
+	}
+}
+
+// Starts a new mesh with the material of the last one. The faces so far are added to meshes
+// as a mesh of their own, when there are any.
+static void finishMesh(MeshDataT& mesh, vector<MeshDataT>& meshes)
+{
+	if (!mesh.faces.empty())
+	{
+		meshes.push_back(MeshDataT());
+		MeshDataT& added = meshes.back();
+		added.min = mesh.min;
+		added.max = mesh.max;
+		added.material = mesh.material;
+		added.faces.swap(mesh.faces);
+	}
+	mesh.faces.clear();
+	mesh.min = MPoint(DBL_MAX, DBL_MAX, DBL_MAX);
+	mesh.max = MPoint(-DBL_MAX, -DBL_MAX, -DBL_MAX);
+}
+
+// Adds the polygon as a fan of triangles around its first corner, leaving out the ones without area
+static void addPolygon(MeshDataT& mesh, const vector<ObjCornerT>& corners, const vector<MPoint>& positions,
+	const vector<MVector>& normals, const vector<float>& us, const vector<float>& vs)
+{
+	for (size_t i = 1; i + 1 < corners.size(); ++i)
+	{
+		const ObjCornerT* tri[3] = { &corners[0], &corners[i], &corners[i + 1] };
+		MVector planeNormal = (positions[tri[1]->v] - positions[tri[0]->v]) ^ (positions[tri[2]->v] - positions[tri[0]->v]);
+		if (planeNormal.length() < DOUBLE_NUMERICAL_THRESHHOLD) {
+			continue;
+		}
+		planeNormal.normalize();
+
+		mesh.faces.push_back(Face());
+		Face& f = mesh.faces.back();
+		for (int c = 0; c < 3; ++c)
+		{
+			const MPoint& p = positions[tri[c]->v];
+			f.vertices.append(p);
+			f.normals.append(tri[c]->n >= 0 ? normals[tri[c]->n] : planeNormal);
+			if (mesh.material.isTextured) {
+				f.us.append(tri[c]->t >= 0 ? us[tri[c]->t] : 0.0f);
+				f.vs.append(tri[c]->t >= 0 ? vs[tri[c]->t] : 0.0f);
+			}
+			for (int a = 0; a < 3; ++a)
+			{
+				mesh.min[a] = std::min(mesh.min[a], p[a]);
+				mesh.max[a] = std::max(mesh.max[a], p[a]);
+			}
+		}
+	}
+}
+
+namespace objFile
+{
+	bool load(const char* path, vector<MeshDataT>& meshes, MString& error)
+	{
+		std::ifstream in(path);
+		if (!in) {
+			error = MString("Could not open the mesh file ") + path;
+			return false;
+		}
+
+		vector<MPoint> positions;
+		vector<MVector> normals;
+		vector<float> us, vs;
+		map<string, Material> materials;
+		size_t firstMesh = meshes.size();
+
+		MeshDataT mesh;
+		initDefaultMaterial(mesh.material);
+		finishMesh(mesh, meshes);
+
+		string line;
+		vector<ObjCornerT> corners;
+		for (int lineNumber = 1; std::getline(in, line); ++lineNumber)
+		{
+			istringstream words(line.substr(0, line.find('#')));
+			string key;
+			if (!(words >> key)) {
+				continue;
+			}
+
+			bool ok = true;
+			double x, y, z;
+			if (key == "v") {
+				ok = (bool) (words >> x >> y >> z);
+				positions.push_back(MPoint(x, y, z));
+			}
+			else if (key == "vn") {
+				ok = (bool) (words >> x >> y >> z);
+				normals.push_back(MVector(x, y, z).normal());
+			}
+			else if (key == "vt") {
+				ok = (bool) (words >> x);
+				if (!(words >> y)) {
+					y = 0;
+				}
+				us.push_back((float) x);
+				vs.push_back((float) y);
+			}
+			else if (key == "f") {
+				corners.clear();
+				string word;
+				ObjCornerT corner;
+				while (ok && (words >> word))
+				{
+					ok = parseCorner(word, (int) positions.size(), (int) us.size(), (int) normals.size(), corner);
+					corners.push_back(corner);
+				}
+				ok = ok && corners.size() >= 3;
+				if (ok) {
+					addPolygon(mesh, corners, positions, normals, us, vs);
+				}
+			}
+			else if (key == "o" || key == "g") {
+				finishMesh(mesh, meshes);
+			}
+			else if (key == "usemtl") {
+				finishMesh(mesh, meshes);
+				string name = restOfLine(words);
+				map<string, Material>::const_iterator it = materials.find(name);
+				if (it != materials.end()) {
+					mesh.material = it->second;
+				}
+				else {
+					MGlobal::displayWarning(MString("Unknown material ") + name.c_str() + " in " + path);
+					initDefaultMaterial(mesh.material);
+				}
+			}
+			else if (key == "mtllib") {
+				string name;
+				while (words >> name) {
+					loadMaterialLibrary(resolvePath(path, name.c_str()), materials);
+				}
+			}
+			// Smoothing groups, lines, points and the rest are left out
+
+			if (!ok)
+			{
+				meshes.resize(firstMesh);
+				error = MString("Could not read line ");
+				error += lineNumber;
+				error += MString(" of the mesh file ") + path;
+				return false;
+			}
+		}
+		finishMesh(mesh, meshes);
+		return true;
+	}
+
+	std::string resolvePath(const char* base, const char* path)
+	{
+		string p(path);
+		bool absolute = (!p.empty() && (p[0] == '/' || p[0] == '\\')) || (p.size() > 1 && p[1] == ':');
+		if (absolute) {
+			return p;
+		}
+		string b(base);
+		size_t slash = b.find_last_of("/\\");
+		return (slash == string::npos) ? p : b.substr(0, slash + 1) + p;
+	}
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <maya/MString.h>
+#include "Mesh.h"
+
+using std::vector;
+
+// Wavefront OBJ meshes and the MTL materials they use, for scenes read from files instead of Maya
+namespace objFile
+{
+	// Adds a mesh to meshes for every object, group and material of the file, with the faces
+	// triangulated, in world space and ready for the triangle table. Faces without normals get the
+	// normal of their plane, and objects without a material the default one. Material libraries and
+	// textures that can't be read are warned about and left out.
+	// False, with the reason in error, when the file can't be read or is malformed.
+	bool			load(const char* path, vector<MeshDataT>& meshes, MString& error);
+
+	// path as seen from the directory of the file base, unless it is absolute
+	std::string		resolvePath(const char* base, const char* path);
+}
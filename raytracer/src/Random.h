@@ -0,0 +1,44 @@
+#pragma once
+
+// PCG32 random number generator (O'Neill, www.pcg-random.org).
+// Small enough to live on the stack of the render loop, so every pixel gets its own
+// generator seeded from the pixel index and the render is the same whatever thread draws it.
+struct Pcg32
+{
+	unsigned long long	state;
+	unsigned long long	inc;
+
+	// Every stream is a different sequence. The stream is hashed into the start state too,
+	// so neighbouring streams (pixels) do not start out alike.
+	inline void seed(unsigned long long seedValue, unsigned long long stream)
+	{
+		state = 0;
+		inc = (stream << 1) | 1;
+		next();
+		state += mix(seedValue ^ mix(stream));
+		next();
+	}
+
+	inline unsigned int next()
+	{
+		unsigned long long old = state;
+		state = old * 6364136223846793005ULL + inc;
+		unsigned int xorShifted = (unsigned int) (((old >> 18) ^ old) >> 27);
+		unsigned int rot = (unsigned int) (old >> 59);
+		return (xorShifted >> rot) | (xorShifted << ((32 - rot) & 31));
+	}
+
+	// Uniform in [0, 1)
+	inline double nextDouble()
+	{
+		return next() * (1.0 / 4294967296.0);
+	}
+
+	// SplitMix64 finalizer
+	static inline unsigned long long mix(unsigned long long z)
+	{
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+		return z ^ (z >> 31);
+	}
+};
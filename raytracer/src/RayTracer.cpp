@@ -2,6 +2,13 @@
 
 #include "Profiler.h"
 #include "Material.h"
+#include "ObjFile.h"
+
+#include <omp.h>
+
+#include "Mailbox.h"
+#include "RenderCounters.h"
+#include "AllocationCounter.h"
 
 #ifdef _DEBUG
 #define DEBUG_REPORT 0
@@ -17,12 +24,30 @@
 const MString CAMERA_NAME = "cameraShape1";
 
 double	RayTracer::prepTime = 0;
+double	RayTracer::binningTime = 0;
+long	RayTracer::gridMemoryEstimate = 0;
 double	RayTracer::totalTime = 0;
 double	RayTracer::timePerPixel = 0;
 double	RayTracer::timePerPixelStandardDeviation = 0;
 long	RayTracer::intersectionTestCount = 0;
 long	RayTracer::intersectionFoundCount = 0;
 long	RayTracer::voxelsTraversed = 0;
+long	RayTracer::bvhNodesVisited = 0;
+long	RayTracer::mailboxSkippedTests = 0;
+long	RayTracer::packetRayCount = 0;
+long	RayTracer::packetDivergedRays = 0;
+long	RayTracer::renderThreads = 0;
+long	RayTracer::tilesStolen = 0;
+long	RayTracer::renderAllocations = 0;
+long	RayTracer::progressivePasses = 0;
+long	RayTracer::adaptiveRounds = 0;
+long	RayTracer::checkpointsWritten = 0;
+long	RayTracer::tilesResumed = 0;
+long	RayTracer::passesResumed = 0;
+bool	RayTracer::sceneFromCache = false;
+long	RayTracer::meshesReused = 0;
+long	RayTracer::meshesUpdated = 0;
+long	RayTracer::meshHashesReused = 0;
 long	RayTracer::totalRayCount = 0;
 long	RayTracer::totalPolyCount = 0;
 long	RayTracer::totalDepths = 0;
@@ -33,8 +58,17 @@ double	RayTracer::samplesPerPixelStdDeviation = 0;
 
 
 
-char*	RayTracer::outputFilePath = "C://temp//scene.iff";
-char*	RayTracer::statisticsFilePath = "C://temp//stat.txt";
+static Mailbox mailbox;
+#pragma omp threadprivate(mailbox)
+
+static RenderCountersT renderCounters;
+#pragma omp threadprivate(renderCounters)
+
+RayTracer::ResidentSceneT	RayTracer::residentScene;
+std::map<string, RayTracer::MeshHashMemoT>	RayTracer::meshHashMemos;
+
+MString	RayTracer::outputFilePath = DEFAULT_OUTPUT_PATH;
+MString	RayTracer::statisticsFilePath = DEFAULT_STATISTICS_PATH;
 
 #pragma endregion
 
@@ -49,20 +83,86 @@ MStatus RayTracer::doIt(const MArgList& argList)
 	Profiler::startTimer("doIt::prepTime");
 
 	parseArgs(argList);
-	storeActiveCameraData();
-	computeAndStoreImagePlaneData();
-	storeLightingData();
-	computeAndStoreMeshData();
+
+	MString cachePath;
+	vector<MDagPath> meshPaths;
+	vector<unsigned long long> meshHashes;
+	vector<bool> changedMeshes;
+	int changedMeshCount = -1;	// meshes changed since the kept scene, -1 when there is none
+	if (sceneParams.sceneFile.length() > 0) {
+		// The faces of a scene file are read whole anyway, so it is not cached
+		if (!loadSceneFile(sceneParams.sceneFile)) {
+			return MS::kFailure;
+		}
+		computeAndStoreImagePlaneData();
+		storeTriangles();
+	}
+	else {
+		storeActiveCameraData();
+		computeAndStoreImagePlaneData();
+		storeLightingData();
+
+		storeMeshes(meshPaths);
+		if (sceneParams.keepScene || sceneParams.sceneCacheDirectory.length() > 0) {
+			computeMeshHashes(meshPaths, meshHashes);
+		}
+		cachePath = sceneCachePath(meshHashes);
+		if (sceneParams.keepScene) {
+			changedMeshCount = takeResidentScene(meshPaths, meshHashes, changedMeshes);
+		}
+		else {
+			releaseResidentScene();
+		}
+
+		// A kept scene is brought up to date in place instead of being read from the cache
+		if (changedMeshCount > 0) {
+			storeMeshFaces(meshPaths, &changedMeshes);
+		}
+		else if (changedMeshCount < 0) {
+			sceneFromCache = cachePath.length() > 0 && loadSceneCache(cachePath);
+			if (!sceneFromCache) {
+				storeMeshFaces(meshPaths);
+			}
+		}
+		for (int i = 0; i < (int) meshesData.size(); i++) {
+			totalPolyCount += (long) meshesData[i].faces.size(); // Statistics
+		}
+	}
 	computeAndStoreSceneBoundingBox();
-	voxelizeScene();
+	if (sceneFromCache || changedMeshCount == 0) {
+		if (sceneParams.acceleration == SceneParamT::GRID) {
+			locateCameraInGrid();
+			packKernel = sceneParams.useTrianglePacks ? trianglePack::kernel(sceneParams.packKernelType) : NULL;
+		}
+	}
+	else {
+		// Over a kept scene the grid bins again only the changed meshes, the BVH is rebuilt whole
+		if (sceneParams.acceleration == SceneParamT::BVH) {
+			bvh.build(meshesData, triangles);
+		}
+		else {
+			voxelizeScene(changedMeshCount > 0 ? &changedMeshes : NULL);
+		}
+		if (cachePath.length() > 0) {
+			saveSceneCache(cachePath);
+		}
+	}
 	prepTime = Profiler::finishTimer("doIt::prepTime");
 
-	bresenhaim();
+	bool imageWritten = bresenhaim();
 
 	totalTime = Profiler::finishTimer("doIt::totalTime");
 
 	printStatisticsReport();
 
+	if (sceneParams.sceneFile.length() == 0 && sceneParams.keepScene) {
+		keepResidentScene(meshPaths, meshHashes);
+	}
+
+	if (!imageWritten) {
+		return MS::kFailure;
+	}
+
 	openImageInMaya();
 
 	MGlobal::displayInfo("Raytracer plugin run finished!");
@@ -86,6 +186,27 @@ MSyntax RayTracer::newSyntax()
 	syntax.addFlag(toleranceFlag, "-toleranceFlag", MSyntax::kDouble);
 	syntax.addFlag("-mi", maxSamplingRateFlag, MSyntax::kLong);
 	syntax.addFlag("-ma", minSamplingRateFlag, MSyntax::kLong);
+	syntax.addFlag(adaptiveTargetFlag, "-adaptiveTarget", MSyntax::kDouble);
+	syntax.addFlag(accelerationFlag, "-accel", MSyntax::kString);
+	syntax.addFlag(gridDensityFlag, "-gridDensity", MSyntax::kDouble);
+	syntax.addFlag(subGridThresholdFlag, "-hierarchicalGrid", MSyntax::kLong);
+	syntax.addFlag(simdFlag, "-simd", MSyntax::kString);
+	syntax.addFlag(packetFlag, "-packets", MSyntax::kBoolean);
+	syntax.addFlag(tileSizeFlag, "-tileSize", MSyntax::kLong);
+	syntax.addFlag(threadsFlag, "-threads", MSyntax::kLong);
+	syntax.addFlag(seedFlag, "-seed", MSyntax::kLong);
+	syntax.addFlag(progressiveFlag, "-progressive", MSyntax::kDouble);
+	syntax.addFlag(progressiveErrorFlag, "-progressiveError", MSyntax::kDouble);
+	syntax.addFlag(flushIntervalFlag, "-flushInterval", MSyntax::kDouble);
+	syntax.addFlag(outputFlag, "-output", MSyntax::kString);
+	syntax.addFlag(streamFlag, "-stream", MSyntax::kBoolean);
+	syntax.addFlag(checkpointFlag, "-checkpoint", MSyntax::kString);
+	syntax.addFlag(checkpointIntervalFlag, "-checkpointInterval", MSyntax::kDouble);
+	syntax.addFlag(resumeFlag, "-resume", MSyntax::kBoolean);
+	syntax.addFlag(sceneCacheFlag, "-sceneCache", MSyntax::kString);
+	syntax.addFlag(sceneFileFlag, "-sceneFile", MSyntax::kString);
+	syntax.addFlag(keepSceneFlag, "-keepScene", MSyntax::kBoolean);
+	syntax.addFlag(statisticsFlag, "-statistics", MSyntax::kString);
 
 	return syntax;
 }
@@ -116,7 +237,10 @@ bool RayTracer::parseArgs( const MArgList& args)
 		s = argData.getFlagArgument(voxelsFlag, 0, arg);	
 		if (s == MStatus::kSuccess) {
 			sceneParams.voxelsPerDimension = (arg < 1) ? 1 : arg;
-			sceneParams.voxelsPerDimensionSqr = sceneParams.voxelsPerDimension * sceneParams.voxelsPerDimension;
+			if (arg < 1) {
+				// -n 0 picks the resolution from the scene
+				sceneParams.gridDensity = DEFAULT_GRID_DENSITY;
+			}
 		}
 	}
 
@@ -148,6 +272,14 @@ bool RayTracer::parseArgs( const MArgList& args)
 				imagePlane.ssType = RayTracer::ImagePlaneDataT::RANDOM;
 			else if(arg == "adaptive")
 				imagePlane.ssType = RayTracer::ImagePlaneDataT::ADAPTIVE;
+			else if(arg == "sobol")
+				imagePlane.ssType = RayTracer::ImagePlaneDataT::SOBOL;
+			else if(arg == "halton")
+				imagePlane.ssType = RayTracer::ImagePlaneDataT::HALTON;
+			else if(arg == "bluenoise")
+				imagePlane.ssType = RayTracer::ImagePlaneDataT::BLUE_NOISE;
+			else if(arg == "adaptivetiles")
+				imagePlane.ssType = RayTracer::ImagePlaneDataT::ADAPTIVE_TILES;
 		}
 	}
 
@@ -186,6 +318,187 @@ bool RayTracer::parseArgs( const MArgList& args)
 		}
 	}
 
+	if ( argData.isFlagSet(adaptiveTargetFlag) ) {
+		double arg;
+		s = argData.getFlagArgument(adaptiveTargetFlag, 0, arg);	
+		if (s == MStatus::kSuccess) {
+			imagePlane.ssAdaptiveTarget = std::min(1.0, std::max(0.0, arg));
+		}
+	}
+
+	if ( argData.isFlagSet(gridDensityFlag) ) {
+		double arg;
+		s = argData.getFlagArgument(gridDensityFlag, 0, arg);	
+		if (s == MStatus::kSuccess) {
+			sceneParams.gridDensity = (arg < 0) ? 0 : arg;
+		}
+	}
+
+	if ( argData.isFlagSet(subGridThresholdFlag) ) {
+		uint arg;
+		s = argData.getFlagArgument(subGridThresholdFlag, 0, arg);	
+		if (s == MStatus::kSuccess) {
+			sceneParams.subGridThreshold = arg;
+		}
+	}
+
+	if ( argData.isFlagSet(accelerationFlag) ) {
+		MString arg;
+		s = argData.getFlagArgument(accelerationFlag, 0, arg);	
+		if (s == MStatus::kSuccess) {
+			if(arg == "bvh")
+				sceneParams.acceleration = RayTracer::SceneParamT::BVH;
+			else if(arg == "grid")
+				sceneParams.acceleration = RayTracer::SceneParamT::GRID;
+		}
+	}
+
+	if ( argData.isFlagSet(packetFlag) ) {
+		bool arg;
+		s = argData.getFlagArgument(packetFlag, 0, arg);	
+		if (s == MStatus::kSuccess) {
+			sceneParams.usePackets = arg;
+		}
+	}
+
+	if ( argData.isFlagSet(tileSizeFlag) ) {
+		uint arg;
+		s = argData.getFlagArgument(tileSizeFlag, 0, arg);	
+		if (s == MStatus::kSuccess) {
+			sceneParams.tileSize = (arg < 1) ? 1 : arg;
+		}
+	}
+
+	if ( argData.isFlagSet(threadsFlag) ) {
+		uint arg;
+		s = argData.getFlagArgument(threadsFlag, 0, arg);	
+		if (s == MStatus::kSuccess) {
+			sceneParams.threadCount = arg;
+		}
+	}
+
+	if ( argData.isFlagSet(seedFlag) ) {
+		uint arg;
+		s = argData.getFlagArgument(seedFlag, 0, arg);	
+		if (s == MStatus::kSuccess) {
+			sceneParams.seed = arg;
+		}
+	}
+
+	if ( argData.isFlagSet(progressiveFlag) ) {
+		double arg;
+		s = argData.getFlagArgument(progressiveFlag, 0, arg);	
+		if (s == MStatus::kSuccess) {
+			sceneParams.progressiveBudget = (arg < 0) ? 0 : arg;
+		}
+	}
+
+	if ( argData.isFlagSet(progressiveErrorFlag) ) {
+		double arg;
+		s = argData.getFlagArgument(progressiveErrorFlag, 0, arg);	
+		if (s == MStatus::kSuccess) {
+			sceneParams.progressiveError = (arg < 0) ? 0 : arg;
+		}
+	}
+
+	if ( argData.isFlagSet(flushIntervalFlag) ) {
+		double arg;
+		s = argData.getFlagArgument(flushIntervalFlag, 0, arg);	
+		if (s == MStatus::kSuccess) {
+			sceneParams.flushInterval = arg;
+		}
+	}
+
+	if ( argData.isFlagSet(outputFlag) ) {
+		MString arg;
+		s = argData.getFlagArgument(outputFlag, 0, arg);	
+		if (s == MStatus::kSuccess && arg.length() > 0) {
+			outputFilePath = arg;
+		}
+	}
+
+	if ( argData.isFlagSet(statisticsFlag) ) {
+		MString arg;
+		s = argData.getFlagArgument(statisticsFlag, 0, arg);	
+		if (s == MStatus::kSuccess && arg.length() > 0) {
+			statisticsFilePath = arg;
+		}
+	}
+
+	if ( argData.isFlagSet(streamFlag) ) {
+		bool arg;
+		s = argData.getFlagArgument(streamFlag, 0, arg);	
+		if (s == MStatus::kSuccess) {
+			sceneParams.streamOutput = arg;
+		}
+	}
+
+	if ( argData.isFlagSet(checkpointFlag) ) {
+		MString arg;
+		s = argData.getFlagArgument(checkpointFlag, 0, arg);	
+		if (s == MStatus::kSuccess) {
+			sceneParams.checkpointPath = arg;
+		}
+	}
+
+	if ( argData.isFlagSet(checkpointIntervalFlag) ) {
+		double arg;
+		s = argData.getFlagArgument(checkpointIntervalFlag, 0, arg);	
+		if (s == MStatus::kSuccess) {
+			sceneParams.checkpointInterval = arg;
+		}
+	}
+
+	if ( argData.isFlagSet(resumeFlag) ) {
+		bool arg;
+		s = argData.getFlagArgument(resumeFlag, 0, arg);	
+		if (s == MStatus::kSuccess) {
+			sceneParams.resume = arg;
+		}
+	}
+
+	if ( argData.isFlagSet(sceneCacheFlag) ) {
+		MString arg;
+		s = argData.getFlagArgument(sceneCacheFlag, 0, arg);	
+		if (s == MStatus::kSuccess) {
+			sceneParams.sceneCacheDirectory = arg;
+		}
+	}
+
+	if ( argData.isFlagSet(sceneFileFlag) ) {
+		MString arg;
+		s = argData.getFlagArgument(sceneFileFlag, 0, arg);	
+		if (s == MStatus::kSuccess) {
+			sceneParams.sceneFile = arg;
+		}
+	}
+
+	if ( argData.isFlagSet(keepSceneFlag) ) {
+		bool arg;
+		s = argData.getFlagArgument(keepSceneFlag, 0, arg);	
+		if (s == MStatus::kSuccess) {
+			sceneParams.keepScene = arg;
+		}
+	}
+
+	if ( argData.isFlagSet(simdFlag) ) {
+		MString arg;
+		s = argData.getFlagArgument(simdFlag, 0, arg);	
+		if (s == MStatus::kSuccess) {
+			// Never ask for more than the CPU has
+			trianglePack::KernelType best = trianglePack::detectKernel();
+			sceneParams.useTrianglePacks = (arg != "off");
+			if(arg == "scalar")
+				sceneParams.packKernelType = trianglePack::SCALAR;
+			else if(arg == "sse")
+				sceneParams.packKernelType = std::min(best, trianglePack::SSE);
+			else if(arg == "avx")
+				sceneParams.packKernelType = std::min(best, trianglePack::AVX);
+			else
+				sceneParams.packKernelType = best;
+		}
+	}
+
 	return true;
 }
 
@@ -200,18 +513,58 @@ RayTracer::RayTracer()
 	imagePlane.ssAdaptiveMinSamples = 1;
 	imagePlane.ssAdaptiveMaxSamples = 128;
 	imagePlane.ssAdaptiveErrorProbability = 0.1; 
+	imagePlane.ssAdaptiveTarget = 0.01;
 
 	sceneParams.voxelsPerDimension = 1;
-	sceneParams.voxelsPerDimensionSqr = 1;
+	sceneParams.gridDensity = 0;
+	sceneParams.subGridThreshold = 0;
 	sceneParams.rayDepth = 1;
+	sceneParams.acceleration = RayTracer::SceneParamT::GRID;
+	sceneParams.useTrianglePacks = true;
+	sceneParams.packKernelType = trianglePack::detectKernel();
+	sceneParams.usePackets = false;
+	sceneParams.tileSize = DEFAULT_TILE_SIZE;
+	sceneParams.threadCount = 0;
+	sceneParams.seed = 0;
+	sceneParams.progressiveBudget = 0;
+	sceneParams.progressiveError = 0;
+	sceneParams.flushInterval = DEFAULT_FLUSH_INTERVAL;
+	outputFilePath = DEFAULT_OUTPUT_PATH;
+	statisticsFilePath = DEFAULT_STATISTICS_PATH;
+	sceneParams.streamOutput = false;
+	sceneParams.checkpointPath = "";
+	sceneParams.checkpointInterval = DEFAULT_CHECKPOINT_INTERVAL;
+	sceneParams.resume = false;
+	sceneParams.sceneCacheDirectory = "";
+	sceneParams.sceneFile = "";
+	sceneParams.keepScene = false;
+	packKernel = NULL;
 
 	prepTime = 0;
+	binningTime = 0;
+	gridMemoryEstimate = 0;
 	totalTime = 0;
 	timePerPixel = 0;
 	timePerPixelStandardDeviation = 0;
 	intersectionTestCount = 0;
 	intersectionFoundCount = 0;
 	voxelsTraversed = 0;
+	bvhNodesVisited = 0;
+	mailboxSkippedTests = 0;
+	packetRayCount = 0;
+	packetDivergedRays = 0;
+	renderThreads = 0;
+	tilesStolen = 0;
+	renderAllocations = 0;
+	progressivePasses = 0;
+	adaptiveRounds = 0;
+	checkpointsWritten = 0;
+	tilesResumed = 0;
+	passesResumed = 0;
+	sceneFromCache = false;
+	meshesReused = 0;
+	meshesUpdated = 0;
+	meshHashesReused = 0;
 	totalRayCount = 0;
 	totalPolyCount = 0;
 	totalDepths = 0;
@@ -224,23 +577,10 @@ RayTracer::RayTracer()
 
 	meshesData.clear();
 	lightingData.clear();
-
-	for (int i = 0; i < voxelsData.size(); i++) {
-		if (voxelsData[i].v != NULL) {
-			delete voxelsData[i].v;
-		}
-	}
-	voxelsData.clear();
 };
 
 RayTracer::~RayTracer()
 {
-	for (int i = 0; i < voxelsData.size(); i++) {
-		if (voxelsData[i].v != NULL) {
-			delete voxelsData[i].v;
-		}
-	}
-	voxelsData.clear();
 }
 
 void* RayTracer::creator()
@@ -248,13 +588,6 @@ void* RayTracer::creator()
 	return new RayTracer;
 }
 
-inline void RayTracer::triangulateMesh(const MFnMesh& mesh)
-{
-	MString cmd("polyTriangulate -ch 0 ");
-	cmd += mesh.name();
-	MGlobal::executeCommand( cmd );
-}
-
 void RayTracer::openImageInMaya()
 {
 	MString cmd(" file -import -type \"image\" -rpr \"scene\" \"");
@@ -268,6 +601,12 @@ void RayTracer::printStatisticsReport()
 	ostringstream os;
 
 	os << "prepTime " << prepTime << endl;
+	os << "binningTime " << binningTime << endl;
+	os << "gridResolution " << grid.resolution[0] << " " << grid.resolution[1] << " " << grid.resolution[2] << endl;
+	os << "cellsPerPolygon " << (grid.cellCount() / (double)totalPolyCount) << endl;
+	os << "gridMemoryEstimate " << gridMemoryEstimate << endl;
+	os << "gridMemory " << grid.memoryUsage() << endl;
+	os << "subGrids " << grid.subGrids.size() << endl;
 	os << "renderTime " << (totalTime - prepTime) << endl;
 	os << "totalTime " << totalTime << endl;
 	os << "timePerPixel " << timePerPixel << endl;
@@ -275,7 +614,30 @@ void RayTracer::printStatisticsReport()
 	os << "polygons " << totalPolyCount << endl;
 	os << "polygonsPerRay " << ((double)intersectionTestCount / (double)totalRayCount) << endl;
 	os << "voxelsPerRay " << (voxelsTraversed / (double)totalRayCount) << endl;
+	os << "nodesPerRay " << (bvhNodesVisited / (double)totalRayCount) << endl;
 	os << "intersectionTests " << intersectionTestCount << endl;
+	os << "renderThreads " << renderThreads << endl;
+	os << "tilesStolen " << tilesStolen << endl;
+	if (allocationCounter::enabled()) {
+		os << "renderAllocations " << renderAllocations << endl;
+	}
+	else {
+		os << "renderAllocations n/a" << endl;
+	}
+	os << "progressivePasses " << progressivePasses << endl;
+	os << "adaptiveRounds " << adaptiveRounds << endl;
+	os << "checkpointsWritten " << checkpointsWritten << endl;
+	os << "tilesResumed " << tilesResumed << endl;
+	os << "passesResumed " << passesResumed << endl;
+	os << "sceneFromCache " << sceneFromCache << endl;
+	os << "meshesReused " << meshesReused << endl;
+	os << "meshesUpdated " << meshesUpdated << endl;
+	os << "meshHashesReused " << meshHashesReused << endl;
+	os << "outputFormat " << imageOutput::formatName(imageOutput::formatOf(outputFilePath.asChar())) << endl;
+	os << "packetRays " << packetRayCount << endl;
+	os << "packetDivergedRays " << packetDivergedRays << endl;
+	os << "simdKernel " << ((packKernel != NULL) ? trianglePack::kernelName(sceneParams.packKernelType) : "off") << endl;
+	os << "mailboxSkippedTests " << mailboxSkippedTests << endl;
 	os << "Intersections " << ((double)intersectionFoundCount/intersectionTestCount) * 100 << "%" << endl;
 
 	os << "averageSamplingRate " << samplesPerPixel << endl;
@@ -283,7 +645,13 @@ void RayTracer::printStatisticsReport()
 	os << "averageLength "  << totalDepths / (double)totalSamples << endl;
 
 	std::ofstream outfile;
-	outfile.open(statisticsFilePath);
+	outfile.open(statisticsFilePath.asChar());
+	if (outfile.is_open()) {
+		MGlobal::displayInfo("Statistics written to " + statisticsFilePath);
+	}
+	else {
+		MGlobal::displayWarning("Could not write the statistics to " + statisticsFilePath);
+	}
 	outfile << os.str().c_str();
 
 #ifdef DEBUG_REPORT
@@ -463,271 +831,1380 @@ void RayTracer::storePointLight(MDagPath lightDagPath)
 
 #pragma endregion
 
-void RayTracer::storeMeshMaterial(MeshDataT& m, const MDagPath& path)
+#pragma region SCENE FILE
+static bool readTriple(std::istream& in, double v[3])
 {
-	MFnMesh fn(path);
-	MObjectArray shaders;
-	MIntArray indices;
-	fn.getConnectedShaders(0, shaders, indices);
-	for(uint i = 0; i < shaders.length(); i++)
-	{
+	return (bool) (in >> v[0] >> v[1] >> v[2]);
+}
 
-		MPlugArray connections;
-		MFnDependencyNode shaderGroup(shaders[i]);
-		MPlug shaderPlug = shaderGroup.findPlug("surfaceShader");
-		shaderPlug.connectedTo(connections, true, false);
-		for(uint u = 0; u < connections.length(); u++)
-		{
-			if(connections[u].node().hasFn(MFn::kLambert))
-			{
-				MFnDependencyNode* dp = new MFnDependencyNode(connections[u].node());
-				MStringArray sets;
-				m.material.load(dp, sets);
-				
-			}
-			else{
-				//default material
-				m.material.toDefault();
-			}
-		} 
+// Reads the color of a light and its intensity, when there is one
+static bool readLightColor(std::istream& in, MColor& color, float& intensity)
+{
+	double rgb[3];
+	if (!readTriple(in, rgb)) {
+		return false;
 	}
+	color = MColor((float) rgb[0], (float) rgb[1], (float) rgb[2]);
+	float value;
+	intensity = (in >> value) ? value : 1.0f;
+	return true;
 }
 
-void RayTracer::computeAndStoreMeshData()
+// Reads the camera, the lights and the meshes of a scene described in a text file, one statement a line:
+//	mesh <path>									an OBJ file and the MTL files it uses, relative to the scene file
+//	camera <eye> <target> <up> [focal] [aperture]	perspective camera, focal length in mm and horizontal
+//												film aperture in inches, 35 and 1.417 like Maya's
+//	orthocamera <eye> <target> <up> <width>
+//	ambient <color> [intensity]
+//	directional <direction> <color> [intensity]	direction the light travels in
+//	point <position> <color> [intensity]
+// Points, vectors and colors are three numbers, intensities are 1 when left out and # starts a comment.
+bool RayTracer::loadSceneFile(const MString& path)
 {
-	MStatus status;
-	MItDag dagIterator(MItDag::kDepthFirst, MFn::kMesh , &status);
-	
-	for(; !dagIterator.isDone(); dagIterator.next())
-	{
-
-		MDagPath dagPath;
-		status = dagIterator.getPath(dagPath);
-
-
-		triangulateMesh(MFnMesh(dagPath));
-
-		pair<MPoint,MPoint> boundingBox = computeWfAxisAlignedBoundingBox(dagPath);
-		
-		MeshDataT aMesh;
-		aMesh.min = boundingBox.first;
-		aMesh.max = boundingBox.second;
-		storeMeshMaterial(aMesh,dagPath);
-
-		MFnMesh meshFn(dagPath);
-		int faceCount = meshFn.numPolygons();
+	std::ifstream in(path.asChar());
+	if (!in) {
+		MGlobal::displayError("Could not open the scene file " + path);
+		return false;
+	}
 
-		totalPolyCount += faceCount; // Statistics
+	bool hasCamera = false;
+	string line;
+	for (int lineNumber = 1; std::getline(in, line); ++lineNumber)
+	{
+		std::istringstream words(line.substr(0, line.find('#')));
+		string statement;
+		if (!(words >> statement)) {
+			continue;
+		}
 
-		vector<Face>& faces = aMesh.faces;
-		faces.resize(faceCount);
-		MItMeshPolygon faceIt(dagPath);
-		bool isMeshTextured = aMesh.material.isTextured;
-		for(int faceId = 0; !faceIt.isDone(); faceIt.next(), ++faceId)
+		bool ok = true;
+		double a[3], b[3], c[3];
+		if (statement == "mesh")
+		{
+			string meshPath;
+			std::getline(words >> std::ws, meshPath);
+			meshPath = meshPath.substr(0, meshPath.find_last_not_of(" \t\r") + 1);
+			ok = !meshPath.empty();
+			MString error;
+			if (ok && !objFile::load(objFile::resolvePath(path.asChar(), meshPath.c_str()).c_str(), meshesData, error)) {
+				MGlobal::displayError(error);
+				return false;
+			}
+		}
+		else if (statement == "camera" || statement == "orthocamera")
 		{
-			Face& f = faces[faceId];
-			faceIt.getPoints(f.vertices, MSpace::kWorld);
-			faceIt.getNormals(f.normals, MSpace::kWorld);
-			if(isMeshTextured)
+			ok = readTriple(words, a) && readTriple(words, b) && readTriple(words, c);
+			activeCameraData.eye = MPoint(a[0], a[1], a[2]);
+			activeCameraData.viewDir = (MPoint(b[0], b[1], b[2]) - activeCameraData.eye).normal();
+			activeCameraData.upDir = MVector(c[0], c[1], c[2]).normal();
+			if (statement == "camera")
+			{
+				double focalLength = 35, aperture = 1.417, value;
+				if (words >> value) {
+					focalLength = value;
+					if (words >> value) {
+						aperture = value;
+					}
+				}
+				activeCameraData.isPerspective	= true;
+				activeCameraData.filmWidthCm	= 2.54 * aperture;
+				activeCameraData.focalLengthCm	= focalLength / 10;
+			}
+			else
 			{
-				faceIt.getUVs(f.us, f.vs);
+				double width = 0;
+				ok = ok && (words >> width) && width > 0;
+				activeCameraData.isPerspective	= false;
+				activeCameraData.filmWidthCm	= width;
+				activeCameraData.focalLengthCm	= 0.f;
 			}
+			hasCamera = true;
+		}
+		else if (statement == "ambient" || statement == "directional" || statement == "point")
+		{
+			LightDataT ld;
+			if (statement == "ambient") {
+				ld.type = LightDataT::AMBIENT;
+			}
+			else if (statement == "directional") {
+				ld.type = LightDataT::DIRECTIONAL;
+				ok = readTriple(words, a);
+				ld.direction = MVector(a[0], a[1], a[2]).normal();
+			}
+			else {
+				ld.type = LightDataT::POINT;
+				ok = readTriple(words, a);
+				ld.position = MPoint(a[0], a[1], a[2]);
+			}
+			ok = ok && readLightColor(words, ld.color, ld.intencity);
+			lightingData.push_back(ld);
+		}
+		else
+		{
+			ok = false;
 		}
-		meshesData.push_back(aMesh); 
 
-#ifdef PRINT_FOR_DEBUG
-		PRINT_IN_MAYA(MString("Storing mesh, bb is:") + pointToString(aMesh.min) + "," + pointToString(aMesh.max));
-#endif
+		if (!ok) {
+			MString error = "Could not read line ";
+			error += lineNumber;
+			error += " of the scene file " + path;
+			MGlobal::displayError(error);
+			return false;
+		}
 	}
 
-	MSelectionList selected;
-	MGlobal::getActiveSelectionList(selected);
-	selected.clear();
-	MGlobal::setActiveSelectionList(selected);
+	if (!hasCamera) {
+		MGlobal::displayError("The scene file " + path + " has no camera");
+		return false;
+	}
+	for (int i = 0; i < (int) meshesData.size(); i++) {
+		totalPolyCount += (long) meshesData[i].faces.size(); // Statistics
+	}
+	return true;
 }
+#pragma endregion
 
-void RayTracer::computeAndStoreSceneBoundingBox()
+#pragma region SCENE CACHE
+static void hashIntArray(ContentHashT& hash, const MIntArray& values)
 {
-	minScene = MPoint( DBL_MAX ,DBL_MAX,DBL_MAX);
-	maxScene = MPoint(-DBL_MAX, -DBL_MAX, -DBL_MAX);
-	for (int i = 0; i < meshesData.size(); i++)
-	{
-		minimize(&(minScene.x), meshesData[i].min.x);
-		minimize(&(minScene.y), meshesData[i].min.y);
-		minimize(&(minScene.z), meshesData[i].min.z);
-
-		maximize(&(maxScene.x), meshesData[i].max.x);
-		maximize(&(maxScene.y), meshesData[i].max.y);
-		maximize(&(maxScene.z), meshesData[i].max.z);
+	for (uint i = 0; i < values.length(); ++i) {
+		hash.add(values[i]);
 	}
-
-	sceneBBPlanes.clear();
-	sceneBBPlanes.resize(6);
-
-	sceneBBPlanes[X_NEG] = Plane(minScene, MVector(-1,0,0));
-	sceneBBPlanes[X_POS] = Plane(maxScene, MVector(1,0,0));
-	sceneBBPlanes[Y_NEG] = Plane(minScene, MVector(0, -1 ,0));
-	sceneBBPlanes[Y_POS] = Plane(maxScene, MVector(0,1,0));
-	sceneBBPlanes[Z_NEG] = Plane(minScene, MVector(0,0, -1));
-	sceneBBPlanes[Z_POS] = Plane(maxScene, MVector(0,0,1));
-
-#ifdef PRINT_FOR_DEBUG
-	PRINT_IN_MAYA(MString("Scene, bb is:") + pointToString(minScene) + "," + pointToString(maxScene));
-#endif
 }
 
-void RayTracer::voxelizeScene()
+// Hash of the settings the acceleration structure is built with
+unsigned long long RayTracer::accelerationSettingsHash() const
 {
-	computeAndStoreVoxelParams();
-	computeAndStoreRawVoxelsData();
-	computeVoxelMeshIntersections();
+	ContentHashT hash;
+	hash.add((int) SCENE_CACHE_VERSION);
+	hash.add((int) sceneParams.acceleration);
+	hash.add(sceneParams.voxelsPerDimension);
+	hash.add(sceneParams.gridDensity);
+	hash.add(sceneParams.subGridThreshold);
+	hash.add((int) sceneParams.useTrianglePacks);
+	return hash.value;
 }
 
-void RayTracer::computeAndStoreVoxelParams()
+// Hash of everything the faces of every mesh are read from: its path, transform, points, topology,
+// normals and, when its material is textured, UVs. Materials are always read from the scene and are left out.
+// Only the path and transform are read on every run, see meshGeometryHash.
+void RayTracer::computeMeshHashes(const vector<MDagPath>& meshPaths, vector<unsigned long long>& meshHashes)
 {
-	double sceneSpanX = maxScene.x - minScene.x;
-	double sceneSpanY = maxScene.y - minScene.y;
-	double sceneSpanZ = maxScene.z - minScene.z;
+	meshHashes.resize(meshPaths.size());
+	for (int i = 0; i < (int) meshPaths.size(); i++)
+	{
+		ContentHashT hash;
+		MString name = meshPaths[i].fullPathName();
+		hash.add(name.asChar(), name.length());
+		MMatrix matrix = meshPaths[i].inclusiveMatrix();
+		for (int r = 0; r < 4; ++r)
+		{
+			for (int c = 0; c < 4; ++c) {
+				hash.add(matrix(r, c));
+			}
+		}
+		hash.add(meshGeometryHash(meshPaths[i], meshesData[i].material.isTextured));
+		meshHashes[i] = hash.value;
+	}
+}
 
-	sceneParams.dimensionDeltas[0] = sceneSpanX / sceneParams.voxelsPerDimension;
-	sceneParams.dimensionDeltas[1] = sceneSpanY / sceneParams.voxelsPerDimension;
-	sceneParams.dimensionDeltas[2] = sceneSpanZ / sceneParams.voxelsPerDimension;
+// Hash of the points, topology, normals and UVs of the mesh. It is read through the API the first time and
+// kept, with a dirty callback on the mesh node that marks it stale, so later runs read it again only for
+// the meshes that were edited, deformed or replaced since.
+unsigned long long RayTracer::meshGeometryHash(const MDagPath& meshPath, bool textured)
+{
+	MObject node = meshPath.node();
+	MeshHashMemoT& memo = meshHashMemos[meshPath.fullPathName().asChar()];
+	if (!(memo.node == node))
+	{
+		// New, or another node under the same path
+		if (memo.watched) {
+			MMessage::removeCallback(memo.dirtyCallback);
+		}
+		MStatus status;
+		memo.node = MObjectHandle(node);
+		memo.dirtyCallback = MNodeMessage::addNodeDirtyCallback(node, meshDirtied, &memo, &status);
+		memo.watched = status == MS::kSuccess;
+		memo.dirty = true;
+	}
+	if (memo.watched && !memo.dirty && memo.textured == textured)
+	{
+		meshHashesReused++;
+		return memo.geometryHash;
+	}
+	// Cleared before reading, so an edit while it is read leaves it stale
+	memo.dirty = false;
+
+	ContentHashT hash;
+	MFnMesh meshFn(meshPath);
+	MPointArray points;
+	meshFn.getPoints(points, MSpace::kObject);
+	for (uint p = 0; p < points.length(); ++p)
+	{
+		hash.add(points[p].x);
+		hash.add(points[p].y);
+		hash.add(points[p].z);
+	}
+	MIntArray counts, ids;
+	meshFn.getVertices(counts, ids);
+	hashIntArray(hash, counts);
+	hashIntArray(hash, ids);
+
+	MFloatVectorArray normals;
+	meshFn.getNormals(normals, MSpace::kObject);
+	for (uint n = 0; n < normals.length(); ++n)
+	{
+		hash.add(normals[n].x);
+		hash.add(normals[n].y);
+		hash.add(normals[n].z);
+	}
+	meshFn.getNormalIds(counts, ids);
+	hashIntArray(hash, counts);
+	hashIntArray(hash, ids);
+
+	hash.add(textured);
+	if (textured)
+	{
+		MFloatArray us, vs;
+		meshFn.getUVs(us, vs);
+		for (uint t = 0; t < us.length(); ++t)
+		{
+			hash.add(us[t]);
+			hash.add(vs[t]);
+		}
+		meshFn.getAssignedUVs(counts, ids);
+		hashIntArray(hash, counts);
+		hashIntArray(hash, ids);
+	}
+	memo.textured = textured;
+	memo.geometryHash = hash.value;
+	return hash.value;
+}
 
-	sceneParams.dimensionDeltaHalfs[0] = sceneParams.dimensionDeltas[0] / 2;
-	sceneParams.dimensionDeltaHalfs[1] = sceneParams.dimensionDeltas[1] / 2;
-	sceneParams.dimensionDeltaHalfs[2] = sceneParams.dimensionDeltas[2] / 2;
+void RayTracer::meshDirtied(MObject&, void* clientData)
+{
+	((MeshHashMemoT*) clientData)->dirty = true;
 }
 
-void RayTracer::computeAndStoreRawVoxelsData()
+// Removes the dirty callbacks and forgets the hashes, before the plugin is unloaded
+void RayTracer::releaseMeshHashes()
 {
-	for (int i = 0; i < voxelsData.size(); i++) {
-		if (voxelsData[i].v != NULL) {
-			delete voxelsData[i].v;
+	for (std::map<string, MeshHashMemoT>::iterator it = meshHashMemos.begin(); it != meshHashMemos.end(); ++it)
+	{
+		if (it->second.watched) {
+			MMessage::removeCallback(it->second.dirtyCallback);
 		}
 	}
-	voxelsData.clear();
+	meshHashMemos.clear();
+}
+
+// Path of the cache file of the scene, named by a hash of the acceleration settings and of the meshes.
+// Lights and the camera are always read from the scene and are left out.
+// Empty when there is no cache directory.
+MString RayTracer::sceneCachePath(const vector<unsigned long long>& meshHashes)
+{
+	if (sceneParams.sceneCacheDirectory.length() == 0) {
+		return MString();
+	}
+
+	ContentHashT hash;
+	hash.add(accelerationSettingsHash());
+	for (int i = 0; i < (int) meshHashes.size(); i++) {
+		hash.add(meshHashes[i]);
+	}
 
-	int sideCount = sceneParams.voxelsPerDimension;
-	int maxIdx = sideCount * sideCount * sideCount - 1;
-	voxelsData.resize(maxIdx + 1);
+	char name[32];
+	sprintf(name, "%016llx.rtscene", hash.value);
+	MString path = sceneParams.sceneCacheDirectory;
+	const char* directory = path.asChar();
+	char last = directory[path.length() - 1];
+	if (last != '/' && last != '\\') {
+		path += "/";
+	}
+	path += name;
+	return path;
+}
 
+void RayTracer::saveSceneCache(const MString& path)
+{
+	vector<char> bytes;
+	CacheWriter out(bytes);
+	out.put((int) SCENE_CACHE_MAGIC);
+	out.put((int) SCENE_CACHE_VERSION);
+	out.put((int) meshesData.size());
+	for (int i = 0; i < (int) meshesData.size(); i++)
+	{
+		const vector<Face>& faces = meshesData[i].faces;
+		out.put((int) faces.size());
+		for (int fi = 0; fi < (int) faces.size(); fi++)
+		{
+			const Face& f = faces[fi];
+			out.put((int) f.vertices.length());
+			for (uint v = 0; v < f.vertices.length(); ++v)
+			{
+				out.put(f.vertices[v].x);
+				out.put(f.vertices[v].y);
+				out.put(f.vertices[v].z);
+			}
+			out.put((int) f.normals.length());
+			for (uint n = 0; n < f.normals.length(); ++n)
+			{
+				out.put(f.normals[n].x);
+				out.put(f.normals[n].y);
+				out.put(f.normals[n].z);
+			}
+			out.put((int) f.us.length());
+			for (uint t = 0; t < f.us.length(); ++t)
+			{
+				out.put(f.us[t]);
+				out.put(f.vs[t]);
+			}
+		}
+	}
+	out.putArray(meshFaceOffsets);
+	out.putArray(triangles);
+	if (sceneParams.acceleration == SceneParamT::BVH) {
+		bvh.save(out);
+	}
+	else {
+		grid.save(out);
+	}
 
-	double dx = sceneParams.dimensionDeltas[0];
-	double dy = sceneParams.dimensionDeltas[1];
-	double dz = sceneParams.dimensionDeltas[2];
+	if (!writeFileReplacing(path.asChar(), bytes)) {
+		MGlobal::displayWarning("Could not write the scene cache " + path);
+	}
+}
 
-	double x = minScene.x;
-	double y = minScene.y;
-	double z = minScene.z;
+// Reads the faces, the triangle table and the acceleration structure from the cache file.
+// storeMeshes has to have found the meshes already.
+bool RayTracer::loadSceneCache(const MString& path)
+{
+	vector<char> bytes;
+	if (!readFile(path.asChar(), bytes)) {
+		return false;
+	}
+	CacheReader in(&bytes[0], bytes.size());
+	int magic = 0, version = 0, meshCount = 0;
+	in.get(magic);
+	in.get(version);
+	in.get(meshCount);
+	if (!in.ok() || magic != SCENE_CACHE_MAGIC || version != SCENE_CACHE_VERSION || meshCount != (int) meshesData.size()) {
+		return false;
+	}
 
-	cameraInSceneBB = isPointInVolume(activeCameraData.eye, minScene, maxScene);
+	// Every count is checked against the bytes left before anything is sized by it, a face takes at
+	// least its three counts
+	for (int i = 0; i < meshCount && in.ok(); i++)
+	{
+		int faceCount = 0;
+		if (!in.getCount(faceCount, 3 * sizeof(int))) {
+			break;
+		}
+		vector<Face>& faces = meshesData[i].faces;
+		faces.resize(faceCount);
+		for (int fi = 0; fi < faceCount && in.ok(); fi++)
+		{
+			Face& f = faces[fi];
+			int count = 0;
+			double xyz[3];
+			if (!in.getCount(count, sizeof(xyz))) {
+				break;
+			}
+			f.vertices.setLength(count);
+			for (int v = 0; v < count && in.getRaw(xyz, sizeof(xyz)); ++v) {
+				f.vertices[v] = MPoint(xyz[0], xyz[1], xyz[2]);
+			}
+			if (!in.getCount(count, sizeof(xyz))) {
+				break;
+			}
+			f.normals.setLength(count);
+			for (int n = 0; n < count && in.getRaw(xyz, sizeof(xyz)); ++n) {
+				f.normals[n] = MVector(xyz[0], xyz[1], xyz[2]);
+			}
+			if (!in.getCount(count, 2 * sizeof(float))) {
+				break;
+			}
+			f.us.setLength(count);
+			f.vs.setLength(count);
+			for (int t = 0; t < count && in.get(f.us[t]); ++t) {
+				in.get(f.vs[t]);
+			}
+		}
+	}
+	in.getArray(meshFaceOffsets);
+	in.getArray(triangles);
+	bool loaded = in.ok() && (sceneParams.acceleration == SceneParamT::BVH ? bvh.load(in, triangles) : grid.load(in)) && in.atEnd();
+	if (!loaded)
+	{
+		for (int i = 0; i < (int) meshesData.size(); i++) {
+			meshesData[i].faces.clear();
+		}
+	}
+	return loaded;
+}
+#pragma endregion
+
+#pragma region RESIDENT SCENE
+// Takes what the last run kept when it was built with the same settings over the same meshes. The faces
+// of the meshes that changed since are left out and marked in changedMeshes, and the acceleration structure
+// still holds them. Returns the number of changed meshes, or -1 when nothing could be taken.
+int RayTracer::takeResidentScene(const vector<MDagPath>& meshPaths, const vector<unsigned long long>& meshHashes, vector<bool>& changedMeshes)
+{
+	ResidentSceneT& kept = residentScene;
+	int meshCount = (int) meshPaths.size();
+	bool sameMeshes = kept.valid && kept.settingsHash == accelerationSettingsHash() && (int) kept.meshNames.size() == meshCount;
+	for (int i = 0; sameMeshes && i < meshCount; i++) {
+		sameMeshes = kept.meshNames[i] == meshPaths[i].fullPathName();
+	}
+
+	int changed = 0;
+	changedMeshes.assign(meshCount, false);
+	for (int i = 0; sameMeshes && i < meshCount; i++)
+	{
+		changedMeshes[i] = kept.meshHashes[i] != meshHashes[i];
+		changed += changedMeshes[i] ? 1 : 0;
+	}
+	// With every mesh changed building from scratch is as fast
+	if (!sameMeshes || (changed == meshCount && meshCount > 0))
+	{
+		releaseResidentScene();
+		return -1;
+	}
+
+	for (int i = 0; i < meshCount; i++)
+	{
+		if (!changedMeshes[i]) {
+			meshesData[i].faces.swap(kept.meshFaces[i]);
+		}
+	}
+	meshFaceOffsets.swap(kept.meshFaceOffsets);
+	triangles.swap(kept.triangles);
+	grid.swap(kept.grid);
+	bvh.swap(kept.bvh);
+	bvh.setTriangleTable(triangles);
+	releaseResidentScene();
+
+	meshesReused = meshCount - changed;
+	meshesUpdated = changed;
+	return changed;
+}
+
+// Keeps the faces, the triangle table and the acceleration structure for the next run
+void RayTracer::keepResidentScene(const vector<MDagPath>& meshPaths, const vector<unsigned long long>& meshHashes)
+{
+	releaseResidentScene();
+	ResidentSceneT& kept = residentScene;
+	kept.settingsHash = accelerationSettingsHash();
+	kept.meshHashes = meshHashes;
+	kept.meshFaces.resize(meshesData.size());
+	for (int i = 0; i < (int) meshesData.size(); i++)
+	{
+		kept.meshNames.push_back(meshPaths[i].fullPathName());
+		kept.meshFaces[i].swap(meshesData[i].faces);
+	}
+	kept.meshFaceOffsets.swap(meshFaceOffsets);
+	kept.triangles.swap(triangles);
+	kept.grid.swap(grid);
+	kept.bvh.swap(bvh);
+	kept.bvh.setTriangleTable(kept.triangles);
+	kept.valid = true;
+}
+
+// Frees what the last run kept
+void RayTracer::releaseResidentScene()
+{
+	ResidentSceneT empty;
+	ResidentSceneT& kept = residentScene;
+	kept.valid = false;
+	kept.meshNames.swap(empty.meshNames);
+	kept.meshHashes.swap(empty.meshHashes);
+	kept.meshFaces.swap(empty.meshFaces);
+	kept.meshFaceOffsets.swap(empty.meshFaceOffsets);
+	kept.triangles.swap(empty.triangles);
+	kept.grid.swap(empty.grid);
+	kept.bvh.swap(empty.bvh);
+}
+#pragma endregion
 
-	// TODO: Can reverse loops order to improve performance
-	x = minScene.x;;
-	for (int ix = 0; ix < sideCount; x += dx, ix++)
+void RayTracer::storeMeshMaterial(MeshDataT& m, const MDagPath& path)
+{
+	MFnMesh fn(path);
+	MObjectArray shaders;
+	MIntArray indices;
+	fn.getConnectedShaders(0, shaders, indices);
+	for(uint i = 0; i < shaders.length(); i++)
 	{
-		y = minScene.y;
-		for (int iy = 0; iy < sideCount; y += dy, iy++)
+
+		MPlugArray connections;
+		MFnDependencyNode shaderGroup(shaders[i]);
+		MPlug shaderPlug = shaderGroup.findPlug("surfaceShader");
+		shaderPlug.connectedTo(connections, true, false);
+		for(uint u = 0; u < connections.length(); u++)
 		{
-			z = minScene.z;
-			for (int iz = 0; iz < sideCount; z += dz, iz++)
+			if(connections[u].node().hasFn(MFn::kLambert))
 			{
-				Voxel* v = new Voxel(MPoint(x,y,z), MPoint(x + dx, y + dy, z + dz) );
-				VoxelDataT vd;
-				vd.v = v;
-				int index = sceneParams.flatten3dCubeIndex(ix, iy, iz);
+				MFnDependencyNode* dp = new MFnDependencyNode(connections[u].node());
+				MStringArray sets;
+				m.material.load(dp, sets);
+				
+			}
+			else{
+				//default material
+				m.material.toDefault();
+			}
+		} 
+	}
+}
+
+// Triangulates the meshes and stores their bounding boxes and materials, but not their faces
+void RayTracer::storeMeshes(vector<MDagPath>& meshPaths)
+{
+	MStatus status;
+	MItDag dagIterator(MItDag::kDepthFirst, MFn::kMesh , &status);
+	
+	for(; !dagIterator.isDone(); dagIterator.next())
+	{
+
+		MDagPath dagPath;
+		status = dagIterator.getPath(dagPath);
+
+		pair<MPoint,MPoint> boundingBox = computeWfAxisAlignedBoundingBox(dagPath);
+		
+		MeshDataT aMesh;
+		aMesh.min = boundingBox.first;
+		aMesh.max = boundingBox.second;
+		storeMeshMaterial(aMesh,dagPath);
+
+		meshesData.push_back(aMesh); 
+		meshPaths.push_back(dagPath);
+
+#ifdef PRINT_FOR_DEBUG
+		PRINT_IN_MAYA(MString("Storing mesh, bb is:") + pointToString(aMesh.min) + "," + pointToString(aMesh.max));
+#endif
+	}
+}
+
+// Reads the faces of the meshes storeMeshes found, or only of the ones marked in onlyMeshes,
+// and builds the triangle table. A face is stored for every triangle Maya splits a polygon into,
+// the meshes themselves are left as they are.
+void RayTracer::storeMeshFaces(const vector<MDagPath>& meshPaths, const vector<bool>* onlyMeshes)
+{
+	for (int i = 0; i < (int) meshPaths.size(); i++)
+	{
+		if (onlyMeshes != NULL && !(*onlyMeshes)[i]) {
+			continue;
+		}
+
+		// The API is only called from this thread, the faces are filled from the arrays it gave in parallel
+		MFnMesh meshFn(meshPaths[i]);
+		MPointArray points;
+		MFloatVectorArray normals;
+		MIntArray polygonCounts, polygonVertices, normalCounts, normalIds, triangleCounts, triangleVertices;
+		meshFn.getPoints(points, MSpace::kWorld);
+		meshFn.getNormals(normals, MSpace::kWorld);
+		meshFn.getVertices(polygonCounts, polygonVertices);
+		meshFn.getNormalIds(normalCounts, normalIds);
+		meshFn.getTriangles(triangleCounts, triangleVertices);
+
+		bool isMeshTextured = meshesData[i].material.isTextured;
+		MFloatArray us, vs;
+		MIntArray uvCounts, uvIds;
+		if (isMeshTextured) {
+			meshFn.getUVs(us, vs);
+			meshFn.getAssignedUVs(uvCounts, uvIds);
+		}
+
+		// First corner, triangle and UV of every polygon. Polygons without UVs have none in uvIds.
+		int polygonCount = (int) polygonCounts.length();
+		vector<int> firstCorner(polygonCount + 1, 0);
+		vector<int> firstTriangle(polygonCount + 1, 0);
+		vector<int> firstUv(polygonCount + 1, 0);
+		for (int p = 0; p < polygonCount; p++)
+		{
+			firstCorner[p + 1] = firstCorner[p] + polygonCounts[p];
+			firstTriangle[p + 1] = firstTriangle[p] + triangleCounts[p];
+			firstUv[p + 1] = firstUv[p] + (isMeshTextured ? uvCounts[p] : 0);
+		}
 
-				if(cameraInSceneBB && isPointInVolume(activeCameraData.eye, v->Min(), v->Max()))
+		vector<Face>& faces = meshesData[i].faces;
+		faces.clear();
+		faces.resize(firstTriangle[polygonCount]);
+#pragma omp parallel for schedule(dynamic, 256)
+		for (int p = 0; p < polygonCount; p++)
+		{
+			bool hasUvs = firstUv[p + 1] > firstUv[p];
+			for (int t = firstTriangle[p]; t < firstTriangle[p + 1]; t++)
+			{
+				Face& f = faces[t];
+				for (int c = 0; c < 3; c++)
 				{
-					initCameraVoxelX = ix;
-					initCameraVoxelY = iy;
-					initCameraVoxelZ = iz;
+					// The normal and the UV are the ones of the corner of the polygon at the vertex
+					int vertex = triangleVertices[3 * t + c];
+					int corner = 0;
+					while (corner < polygonCounts[p] - 1 && polygonVertices[firstCorner[p] + corner] != vertex) {
+						corner++;
+					}
+					const MFloatVector& n = normals[normalIds[firstCorner[p] + corner]];
+					f.vertices.append(points[vertex]);
+					f.normals.append(MVector(n.x, n.y, n.z));
+					if (hasUvs)
+					{
+						f.us.append(us[uvIds[firstUv[p] + corner]]);
+						f.vs.append(vs[uvIds[firstUv[p] + corner]]);
+					}
 				}
-
-				voxelsData[index] = vd;
 			}
 		}
 	}
+	storeTriangles();
+}
+
+// Numbers the faces of all the meshes and builds the triangle table of the scene
+void RayTracer::storeTriangles()
+{
+	meshFaceOffsets.assign(meshesData.size() + 1, 0);
+	for (int i = 0; i < (int) meshesData.size(); i++)
+	{
+		meshFaceOffsets[i + 1] = meshFaceOffsets[i] + (int) meshesData[i].faces.size();
+	}
+
+	triangles.resize(meshFaceOffsets.back());
+	for (int i = 0; i < (int) meshesData.size(); i++)
+	{
+		for (int fi = 0; fi < (int) meshesData[i].faces.size(); fi++)
+		{
+			triangles[meshFaceOffsets[i] + fi].init(meshesData[i].faces[fi].vertices);
+		}
+	}
+}
+
+void RayTracer::computeAndStoreSceneBoundingBox()
+{
+	minScene = MPoint( DBL_MAX ,DBL_MAX,DBL_MAX);
+	maxScene = MPoint(-DBL_MAX, -DBL_MAX, -DBL_MAX);
+	for (int i = 0; i < meshesData.size(); i++)
+	{
+		minimize(&(minScene.x), meshesData[i].min.x);
+		minimize(&(minScene.y), meshesData[i].min.y);
+		minimize(&(minScene.z), meshesData[i].min.z);
+
+		maximize(&(maxScene.x), meshesData[i].max.x);
+		maximize(&(maxScene.y), meshesData[i].max.y);
+		maximize(&(maxScene.z), meshesData[i].max.z);
+	}
+
+	sceneBBPlanes.clear();
+	sceneBBPlanes.resize(6);
+
+	sceneBBPlanes[X_NEG] = Plane(minScene, MVector(-1,0,0));
+	sceneBBPlanes[X_POS] = Plane(maxScene, MVector(1,0,0));
+	sceneBBPlanes[Y_NEG] = Plane(minScene, MVector(0, -1 ,0));
+	sceneBBPlanes[Y_POS] = Plane(maxScene, MVector(0,1,0));
+	sceneBBPlanes[Z_NEG] = Plane(minScene, MVector(0,0, -1));
+	sceneBBPlanes[Z_POS] = Plane(maxScene, MVector(0,0,1));
+
+#ifdef PRINT_FOR_DEBUG
+	PRINT_IN_MAYA(MString("Scene, bb is:") + pointToString(minScene) + "," + pointToString(maxScene));
+#endif
+}
+
+// When changedMeshes is given the grid holds the faces of the last run, and if its cells
+// are still the ones of the scene only the faces of the changed meshes are binned again
+void RayTracer::voxelizeScene(const vector<bool>* changedMeshes)
+{
+	if (computeAndStoreVoxelParams(changedMeshes != NULL)) {
+		updateVoxelMeshIntersections(*changedMeshes);
+	}
+	else {
+		computeVoxelMeshIntersections();
+	}
+}
+
+// True when keepCells is set and the grid already has the bounds and resolution of the scene,
+// in which case it keeps its faces
+bool RayTracer::computeAndStoreVoxelParams(bool keepCells)
+{
+	int resolution[3] = { sceneParams.voxelsPerDimension, sceneParams.voxelsPerDimension, sceneParams.voxelsPerDimension };
+	if (sceneParams.gridDensity > 0) {
+		Grid::autoResolution(minScene, maxScene, totalPolyCount, sceneParams.gridDensity, resolution);
+	}
+	bool sameCells = keepCells;
+	for (int a = 0; a < 3; ++a) {
+		sameCells = sameCells && grid.min[a] == minScene[a] && grid.max[a] == maxScene[a] && grid.resolution[a] == resolution[a];
+	}
+	if (!sameCells) {
+		grid.setBounds(minScene, maxScene, resolution);
+	}
+	locateCameraInGrid();
+	return sameCells;
+}
+
+void RayTracer::locateCameraInGrid()
+{
+	cameraInSceneBB = isPointInVolume(activeCameraData.eye, minScene, maxScene);
+	if (cameraInSceneBB) {
+		grid.findCell(activeCameraData.eye, initCameraVoxelX, initCameraVoxelY, initCameraVoxelZ);
+	}
 }
 
 void RayTracer::computeVoxelMeshIntersections()
 {
-	double dimensionDeltaHalfs[3];
-	for (int i = 0; i < 3; ++i)
+	Profiler::startTimer("doIt::binningTime");
+
+	vector<GridFaceT> faces;
+	for (int mid = 0; mid < (int) meshesData.size(); ++mid)
+	{
+		for (int fid = 0; fid < (int) meshesData[mid].faces.size(); ++fid)
+		{
+			GridFaceT f;
+			f.meshIndex = mid;
+			f.faceIndex = fid;
+			faces.push_back(f);
+		}
+	}
+
+	gridMemoryEstimate = (long) grid.estimateMemoryUsage(meshesData, faces);
+	if (sceneParams.gridDensity > 0) {
+		ostringstream os;
+		os << "Grid resolution " << grid.resolution[0] << "x" << grid.resolution[1] << "x" << grid.resolution[2]
+			<< ", " << (grid.cellCount() / (double) std::max(1, (int) faces.size())) << " cells per face"
+			<< ", estimated memory " << (gridMemoryEstimate / (1024.0 * 1024.0)) << "MB";
+		MGlobal::displayInfo(os.str().c_str());
+	}
+
+	grid.build(meshesData, faces);
+	if (sceneParams.subGridThreshold > 0) {
+		grid.refine(meshesData, sceneParams.subGridThreshold, (sceneParams.gridDensity > 0) ? sceneParams.gridDensity : DEFAULT_GRID_DENSITY);
+	}
+
+	packKernel = NULL;
+	if (sceneParams.useTrianglePacks) {
+		grid.buildPacks(triangles, meshFaceOffsets);
+		packKernel = trianglePack::kernel(sceneParams.packKernelType);
+	}
+
+	binningTime = Profiler::finishTimer("doIt::binningTime");
+}
+
+void RayTracer::updateVoxelMeshIntersections(const vector<bool>& changedMeshes)
+{
+	Profiler::startTimer("doIt::binningTime");
+
+	vector<GridFaceT> faces;
+	for (int mid = 0; mid < (int) meshesData.size(); ++mid)
+	{
+		if (!changedMeshes[mid]) {
+			continue;
+		}
+		for (int fid = 0; fid < (int) meshesData[mid].faces.size(); ++fid)
+		{
+			GridFaceT f;
+			f.meshIndex = mid;
+			f.faceIndex = fid;
+			faces.push_back(f);
+		}
+	}
+	grid.update(meshesData, changedMeshes, faces);
+
+	packKernel = NULL;
+	if (sceneParams.useTrianglePacks) {
+		grid.buildPacks(triangles, meshFaceOffsets);
+		packKernel = trianglePack::kernel(sceneParams.packKernelType);
+	}
+
+	binningTime = Profiler::finishTimer("doIt::binningTime");
+}
+
+// False when the image could not be written
+bool RayTracer::bresenhaim()
+{
+	int width = imagePlane.imgWidth;
+	int height = imagePlane.imgHeight;
+	bool progressive = sceneParams.progressiveBudget > 0 || sceneParams.progressiveError > 0;
+	bool adaptiveTiles = imagePlane.ssType == ImagePlaneDataT::ADAPTIVE_TILES;
+	PixelStatisticsT statistics;
+	statistics.clear();
+
+#pragma region PARALLEL COMPUTATION
+	if (sceneParams.streamOutput) {
+		ImageStream stream;
+		if (!progressive && !adaptiveTiles && stream.open(outputFilePath.asChar(), width, height)) {
+			if (sceneParams.checkpointPath.length() > 0) {
+				MGlobal::displayWarning("Streamed renders are not checkpointed, nothing is saved to " + sceneParams.checkpointPath);
+			}
+			renderTiles(NULL, &stream, statistics);
+			bool written = stream.close();
+			if (!written) {
+				MGlobal::displayError("Could not write the image to " + outputFilePath);
+			}
+			computePixelStatistics(statistics);
+			return written;
+		}
+		MGlobal::displayWarning("Streaming needs a .pfm or .ppm output and one pass rendering, rendering the whole image");
+	}
+
+	Framebuffer image;
+	image.init(width, height);
+	if (progressive) {
+		renderProgressive(image);
+	}
+	else if (adaptiveTiles) {
+		renderAdaptiveTiles(image);
+	}
+	else {
+		renderTiles(&image, NULL, statistics);
+	}
+	statistics.add(image);
+#pragma endregion
+
+	computePixelStatistics(statistics);
+
+	if (!writeImage(image)) {
+		// The checkpoint still has the render
+		return false;
+	}
+	if (sceneParams.checkpointPath.length() > 0) {
+		// The render is done, there is nothing left to resume
+		checkpoint::remove(sceneParams.checkpointPath.asChar());
+	}
+	return true;
+}
+
+CheckpointKeyT RayTracer::checkpointKey(int tileCount) const
+{
+	CheckpointKeyT key;
+	key.width = imagePlane.imgWidth;
+	key.height = imagePlane.imgHeight;
+	key.tileSize = sceneParams.tileSize;
+	key.tileCount = tileCount;
+	key.ssType = imagePlane.ssType;
+	key.supersamplingCoeff = imagePlane.supersamplingCoeff;
+	key.rayDepth = sceneParams.rayDepth;
+	key.adaptiveMinSamples = imagePlane.ssAdaptiveMinSamples;
+	key.adaptiveMaxSamples = imagePlane.ssAdaptiveMaxSamples;
+	key.adaptiveTolerance = imagePlane.ssAdaptiveTolerance;
+	key.adaptiveErrorProbability = imagePlane.ssAdaptiveErrorProbability;
+	key.adaptiveTarget = imagePlane.ssAdaptiveTarget;
+	key.seed = sceneParams.seed;
+	key.progressive = (sceneParams.progressiveBudget > 0 || sceneParams.progressiveError > 0) ? 1 : 0;
+	key.progressiveError = sceneParams.progressiveError;
+	return key;
+}
+
+// In the format the extension of outputFilePath asks for
+bool RayTracer::writeImage(const Framebuffer& image)
+{
+	if (!imageOutput::write(image, outputFilePath.asChar())) {
+		MGlobal::displayError("Could not write the image to " + outputFilePath);
+		return false;
+	}
+	return true;
+}
+
+// Adds the counters of the calling render thread to the totals
+void RayTracer::collectRenderCounters()
+{
+#pragma omp critical(renderCounters)
+	{
+		intersectionTestCount += renderCounters.intersectionTestCount;
+		intersectionFoundCount += renderCounters.intersectionFoundCount;
+		voxelsTraversed += renderCounters.voxelsTraversed;
+		bvhNodesVisited += renderCounters.bvhNodesVisited;
+		mailboxSkippedTests += renderCounters.mailboxSkippedTests;
+		packetRayCount += renderCounters.packetRayCount;
+		packetDivergedRays += renderCounters.packetDivergedRays;
+		totalRayCount += renderCounters.totalRayCount;
+		totalDepths += renderCounters.totalDepths;
+		renderAllocations += renderCounters.renderAllocations;
+	}
+}
+
+// Renders every pixel once with the sampling the scene asks for, into image, or tile by tile into
+// stream when image is NULL. Streamed tiles are added to statistics as they are done.
+// When rendering into image, the finished tiles are saved to the checkpoint every checkpointInterval
+// seconds, and on resume the tiles the checkpoint has are not rendered again. The checkpoint is saved
+// from a snapshot of the finished tiles taken under the lock, and written by the thread that took it
+// after leaving the lock, so the other threads go on with their tiles while it is written.
+void RayTracer::renderTiles(Framebuffer* image, ImageStream* stream, PixelStatisticsT& statistics)
+{
+	// On the grid the packets share the SIMD pack kernel, without it every ray is traced alone anyway
+	bool packets = sceneParams.usePackets && imagePlane.ssType != ImagePlaneDataT::ADAPTIVE && (sceneParams.acceleration == SceneParamT::BVH || packKernel != NULL);
+	TileScheduler scheduler;
+	scheduler.init(imagePlane.imgWidth, imagePlane.imgHeight, sceneParams.tileSize, sceneParams.threadCount);
+
+	const char* checkpointPath = sceneParams.checkpointPath.asChar();
+	bool checkpointing = image != NULL && sceneParams.checkpointPath.length() > 0;
+	CheckpointKeyT key = checkpointKey(scheduler.tileCount());
+	vector<char> doneTiles(scheduler.tileCount(), 0);
+	vector<char> noState;
+	if (checkpointing && sceneParams.resume)
 	{
-		dimensionDeltaHalfs[i] = sceneParams.dimensionDeltaHalfs[i] + DOUBLE_NUMERICAL_THRESHHOLD;
+		if (checkpoint::load(checkpointPath, key, doneTiles, *image, noState) && noState.empty()) {
+			tilesResumed = (long) std::count(doneTiles.begin(), doneTiles.end(), 1);
+		}
+		else {
+			MGlobal::displayWarning("No checkpoint of this render at " + sceneParams.checkpointPath + ", starting over");
+			doneTiles.assign(scheduler.tileCount(), 0);
+			image->init(imagePlane.imgWidth, imagePlane.imgHeight);
+		}
 	}
+	Framebuffer finishedTiles;
+	if (checkpointing) {
+		finishedTiles = *image;
+	}
+	Framebuffer savedTiles;
+	vector<char> savedDone;
+	bool saving = false;
+	double lastCheckpoint = omp_get_wtime();
 
-	uint voxelNum = (uint)voxelsData.size();
-	uint meshNum = (uint)meshesData.size();
-	uint v, mid;
-	for (v = 0; v < voxelNum; v++)
+#pragma omp parallel num_threads(scheduler.threadCount())
 	{
-		for (mid = 0; mid < meshNum; ++mid)
+		renderCounters.clear();
+
+		// Sample positions of the pixels of a packet, the only buffer the pixels need
+		vector<MPoint> samples(PACKET_SIZE * std::max(1, imagePlane.samplesPerPixel()));
+		// The tile being rendered, when there is no image to render into
+		Framebuffer tileImage;
+		PixelStatisticsT tileStatistics;
+		tileStatistics.clear();
+
+		allocationCounter::begin();
+		TileT tile;
+		int index;
+		while (scheduler.nextTile(omp_get_thread_num(), tile, index))
 		{
-			if ( voxelsData[v].v->intersectsWith(meshesData[mid].min, meshesData[mid].max) )
+			if (doneTiles[index]) {
+				continue;
+			}
+			if (stream != NULL) {
+				tileImage.initWindow(tile.x0, tile.y0, tile.x1, tile.y1, imagePlane.imgWidth);
+			}
+			Framebuffer& target = (stream != NULL) ? tileImage : *image;
+			int step = packets ? 2 : 1;
+			for (int h = tile.y0; h < tile.y1; h += step)
 			{
-				vector<int> faceIds;
-				if( voxelsData[v].v->intersectsWith(meshesData[mid], dimensionDeltaHalfs, faceIds))
+				for (int w = tile.x0; w < tile.x1; w += step)
 				{
-					voxelsData[v].meshIdToFaceIds[mid] = faceIds;
+					if (packets) {
+						renderPixelBlock(w, h, tile.x1, tile.y1, &samples[0], target);
+					}
+					else {
+						renderPixel(w, h, &samples[0], target);
+					}
+				}
+			}
+			if (stream != NULL) {
+				tileStatistics.add(tileImage);
+				stream->writeTile(tileImage);
+			}
+			if (checkpointing)
+			{
+				// No other thread writes the pixels of the tile, and finishedTiles is only used under the lock
+				bool save = false;
+#pragma omp critical(checkpoint)
+				{
+					finishedTiles.copyPixels(*image, tile.x0, tile.y0, tile.x1, tile.y1);
+					doneTiles[index] = 1;
+					double now = omp_get_wtime();
+					if (!saving && now - lastCheckpoint >= sceneParams.checkpointInterval) {
+						savedTiles = finishedTiles;
+						savedDone = doneTiles;
+						saving = save = true;
+						lastCheckpoint = now;
+					}
+				}
+				// Nobody touches the snapshot until saving is cleared
+				if (save)
+				{
+					bool saved = checkpoint::save(checkpointPath, key, savedDone, savedTiles, noState);
+#pragma omp critical(checkpoint)
+					{
+						checkpointsWritten += saved ? 1 : 0;
+						saving = false;
+					}
 				}
 			}
 		}
+		renderCounters.renderAllocations = allocationCounter::end();
+		collectRenderCounters();
+#pragma omp critical(pixelStatistics)
+		statistics.add(tileStatistics);
 	}
-
+	renderThreads = scheduler.threadCount();
+	tilesStolen = scheduler.stolenTiles();
 }
 
-void RayTracer::bresenhaim()
+// Renders the image in passes of one sample per pixel accumulated in floats, so the first pass already
+// gives a complete image. Passes go on until the time budget is spent, every pixel reached the error
+// target or MAX_PROGRESSIVE_PASSES were done. The image so far is written every flushInterval seconds, and
+// the pixel sums with it to the checkpoint every checkpointInterval seconds. Time spent before a resume
+// counts towards the budget.
+void RayTracer::renderProgressive(Framebuffer& image)
 {
 	int width = imagePlane.imgWidth;
 	int height = imagePlane.imgHeight;
-	int totalPixels = width*height;
-	unsigned char* pixels = new unsigned char[totalPixels*4];
-	double* pixelTimes = new double[totalPixels];
-	int* pixelSamples =  new int[totalPixels];
-	memset(pixels,0,totalPixels*4);
-	memset(pixelTimes,0,totalPixels*sizeof(double));
-	
+	int totalPixels = width * height;
+	double budget = sceneParams.progressiveBudget;
+	double maxError = sceneParams.progressiveError;
+
+	PixelAccumT zero = {};
+	vector<PixelAccumT> accums(totalPixels, zero);
+	vector<char> converged(totalPixels, 0);
+
+	double start = omp_get_wtime();
+	double lastFlush = start;
+	double lastCheckpoint = start;
+	int pass = 0;
+	bool done = false;
+
+	const char* checkpointPath = sceneParams.checkpointPath.asChar();
+	bool checkpointing = sceneParams.checkpointPath.length() > 0;
+	CheckpointKeyT key = checkpointKey(0);
+	vector<char> noTiles;
+	if (checkpointing && sceneParams.resume)
+	{
+		vector<char> state;
+		double elapsed = 0;
+		bool loaded = checkpoint::load(checkpointPath, key, noTiles, image, state);
+		if (loaded)
+		{
+			CacheReader in(state.empty() ? NULL : &state[0], state.size());
+			loaded = in.get(pass) && in.get(elapsed) && in.getArray(accums) && in.getArray(converged) && in.atEnd()
+				&& (int) accums.size() == totalPixels && (int) converged.size() == totalPixels;
+		}
+		if (loaded) {
+			start -= elapsed;
+			passesResumed = pass;
+		}
+		else {
+			MGlobal::displayWarning("No checkpoint of this render at " + sceneParams.checkpointPath + ", starting over");
+			pass = 0;
+			accums.assign(totalPixels, zero);
+			converged.assign(totalPixels, 0);
+			image.init(width, height);
+		}
+	}
+	while (!done)
+	{
+		TileScheduler scheduler;
+		scheduler.init(width, height, sceneParams.tileSize, sceneParams.threadCount);
 
-#pragma region PARALLEL COMPUTATION
-#pragma omp parallel for schedule(dynamic,100) num_threads(8)
-	for(int it = 0; it < totalPixels; ++it)
+#pragma omp parallel num_threads(scheduler.threadCount())
+		{
+			renderCounters.clear();
+			allocationCounter::begin();
+			TileT tile;
+			// The first pass covers the whole image, later ones stop taking tiles once the budget is spent
+			while ((pass == 0 || budget <= 0 || omp_get_wtime() - start < budget) && scheduler.nextTile(omp_get_thread_num(), tile))
+			{
+				for (int h = tile.y0; h < tile.y1; ++h)
+				{
+					for (int w = tile.x0; w < tile.x1; ++w)
+					{
+						int it = h * width + w;
+						if (!converged[it]) {
+							addPixelSample(w, h, pass, accums[it], image);
+						}
+					}
+				}
+			}
+			renderCounters.renderAllocations = allocationCounter::end();
+			collectRenderCounters();
+		}
+		renderThreads = scheduler.threadCount();
+		tilesStolen += scheduler.stolenTiles();
+		++pass;
+
+		int active = 0;
+#pragma omp parallel for num_threads(renderThreads) reduction(+:active)
+		for (int it = 0; it < totalPixels; ++it)
+		{
+			int count = image.samples(it);
+			image.set(it, accums[it].mean(count));
+			if (!converged[it] && maxError > 0 && count >= MIN_PROGRESSIVE_PASSES) {
+				converged[it] = sqrt(accums[it].luminanceVariance(count) / count) <= maxError;
+			}
+			if (!converged[it]) {
+				active++;
+			}
+		}
+
+		double now = omp_get_wtime();
+		done = active == 0 || pass >= MAX_PROGRESSIVE_PASSES || (budget > 0 && now - start >= budget);
+		if (!done && now - lastFlush >= sceneParams.flushInterval) {
+			writeImage(image);
+			lastFlush = now;
+		}
+		if (!done && checkpointing && now - lastCheckpoint >= sceneParams.checkpointInterval)
+		{
+			vector<char> state;
+			CacheWriter out(state);
+			out.put(pass);
+			out.put(now - start);
+			out.putArray(accums);
+			out.putArray(converged);
+			if (checkpoint::save(checkpointPath, key, noTiles, image, state)) {
+				checkpointsWritten++;
+			}
+			lastCheckpoint = now;
+		}
+	}
+	progressivePasses = pass;
+}
+
+// Adaptive sampling that decides per tile instead of per pixel. Every tile first gets ssAdaptiveMinSamples
+// passes. After that the image is done once at most ssAdaptiveTarget of its pixels fail varianceIsSmallEnough
+// and can still take samples. Until then every round has a budget of one sample per pixel of the image, which
+// goes to the tiles in order of their error, each getting a number of passes that grows with it. Deciding for
+// the whole tile keeps a pixel whose first few samples happened to agree from stopping while its neighbours
+// are still noisy, and flat regions are left after the first round. The pixel sums and the passes of the
+// next round go to the checkpoint every checkpointInterval seconds.
+void RayTracer::renderAdaptiveTiles(Framebuffer& image)
+{
+	int width = imagePlane.imgWidth;
+	int height = imagePlane.imgHeight;
+	int totalPixels = width * height;
+	int minSamples = std::max(2, imagePlane.ssAdaptiveMinSamples);
+	int maxSamples = std::max(minSamples, imagePlane.ssAdaptiveMaxSamples);
+
+	PixelAccumT zero = {};
+	vector<PixelAccumT> accums(totalPixels, zero);
+
+	TileScheduler allTiles;
+	allTiles.init(width, height, sceneParams.tileSize, sceneParams.threadCount);
+	int tileCount = allTiles.tileCount();
+	vector<int> tilePasses(tileCount, minSamples);
+	vector<double> tileErrors(tileCount);
+	vector<int> tileOpen(tileCount);
+	vector<int> tileFailing(tileCount);
+	vector<int> ranked;
+
+	vector<TileT> roundTiles;
+	vector<int> roundPasses;
+	int round = 0;
+
+	const char* checkpointPath = sceneParams.checkpointPath.asChar();
+	bool checkpointing = sceneParams.checkpointPath.length() > 0;
+	// The tiles are in tilePasses, tileSize in the key decides them
+	CheckpointKeyT key = checkpointKey(0);
+	vector<char> noTiles;
+	double lastCheckpoint = omp_get_wtime();
+	if (checkpointing && sceneParams.resume)
 	{
-		MTimer timer;
-		timer.beginTimer();
-		int w = it % width;
-		int h = it / width;
-		MColor pixelColor;
-		vector<MPoint> pointsOnPlane;
-		
-		imagePlane.getPointsOnIP(w, h, pointsOnPlane);
+		vector<char> state;
+		bool loaded = checkpoint::load(checkpointPath, key, noTiles, image, state);
+		if (loaded)
+		{
+			CacheReader in(state.empty() ? NULL : &state[0], state.size());
+			loaded = in.get(round) && in.getArray(tilePasses) && in.getArray(accums) && in.atEnd()
+				&& (int) tilePasses.size() == tileCount && (int) accums.size() == totalPixels;
+		}
+		if (loaded) {
+			passesResumed = round;
+		}
+		else {
+			MGlobal::displayWarning("No checkpoint of this render at " + sceneParams.checkpointPath + ", starting over");
+			round = 0;
+			tilePasses.assign(tileCount, minSamples);
+			accums.assign(totalPixels, zero);
+			image.init(width, height);
+		}
+	}
+	for (;;)
+	{
+		roundTiles.clear();
+		roundPasses.clear();
+		for (int t = 0; t < tileCount; ++t)
+		{
+			if (tilePasses[t] > 0) {
+				roundTiles.push_back(allTiles.tileAt(t));
+				roundPasses.push_back(tilePasses[t]);
+			}
+		}
+		if (roundTiles.empty()) {
+			break;
+		}
+
+		TileScheduler scheduler;
+		scheduler.init(roundTiles, sceneParams.threadCount);
 
-		switch (imagePlane.ssType) {
-		case ImagePlaneDataT::UNIFORM:
-		case ImagePlaneDataT::JITTERED:
-		case ImagePlaneDataT::RANDOM:
+#pragma omp parallel num_threads(scheduler.threadCount())
+		{
+			renderCounters.clear();
+			allocationCounter::begin();
+			TileT tile;
+			int index;
+			while (scheduler.nextTile(omp_get_thread_num(), tile, index))
 			{
-				int count = pointsOnPlane.size();
-				MPoint raySource = activeCameraData.eye;
-				MVector rayDirection = activeCameraData.viewDir;
-				pixelSamples[it] = count;
-				for(int ssit = 0; ssit < count; ++ssit )
+				for (int p = 0; p < roundPasses[index]; ++p)
 				{
-					if (activeCameraData.isPerspective) {
-						rayDirection = (pointsOnPlane[ssit] - activeCameraData.eye).normal();
+					for (int h = tile.y0; h < tile.y1; ++h)
+					{
+						for (int w = tile.x0; w < tile.x1; ++w)
+						{
+							int it = h * width + w;
+							if (image.samples(it) < maxSamples) {
+								addPixelSample(w, h, image.samples(it), accums[it], image);
+							}
+						}
 					}
-					else {
-						raySource = pointsOnPlane[ssit];
+				}
+			}
+			renderCounters.renderAllocations = allocationCounter::end();
+			collectRenderCounters();
+		}
+		renderThreads = scheduler.threadCount();
+		tilesStolen += scheduler.stolenTiles();
+		++round;
+
+		// Mean over the pixels of the tile of how far their variance is above what the test accepts,
+		// and how many of them can still take samples and how many of those fail the test
+#pragma omp parallel for num_threads(renderThreads)
+		for (int t = 0; t < tileCount; ++t)
+		{
+			const TileT& tile = allTiles.tileAt(t);
+			double error = 0;
+			int open = 0;
+			int failing = 0;
+			for (int h = tile.y0; h < tile.y1; ++h)
+			{
+				for (int w = tile.x0; w < tile.x1; ++w)
+				{
+					int it = h * width + w;
+					int count = image.samples(it);
+					double ratio = varianceErrorRatio(accums[it].variance(count), count, imagePlane.ssAdaptiveTolerance, imagePlane.ssAdaptiveErrorProbability);
+					error += ratio;
+					if (count < maxSamples) {
+						open++;
+						if (ratio > 1) {
+							failing++;
+						}
 					}
-					int depth = 0;
-					pixelColor = sumColors(pixelColor, shootRay(raySource, rayDirection, sceneParams.rayDepth, &depth) / ((float)(count)));
-#pragma omp atomic 
-					totalDepths += depth;
 				}
 			}
-			break;
-		case ImagePlaneDataT::ADAPTIVE:
+			tileErrors[t] = error / ((tile.x1 - tile.x0) * (tile.y1 - tile.y0));
+			tileOpen[t] = open;
+			tileFailing[t] = failing;
+		}
+
+		long failingPixels = 0;
+		ranked.clear();
+		for (int t = 0; t < tileCount; ++t)
+		{
+			tilePasses[t] = 0;
+			failingPixels += tileFailing[t];
+			if (tileFailing[t] > 0) {
+				ranked.push_back(t);
+			}
+		}
+		if (failingPixels <= imagePlane.ssAdaptiveTarget * totalPixels) {
+			break;
+		}
+
+		std::sort(ranked.begin(), ranked.end(), [&tileErrors](int a, int b) { return tileErrors[a] > tileErrors[b]; });
+		long budget = totalPixels;
+		for (size_t r = 0; r < ranked.size() && budget > 0; ++r)
+		{
+			int t = ranked[r];
+			int passes = (int) std::min((double) MAX_TILE_PASSES_PER_ROUND, std::max(1.0, ceil(tileErrors[t])));
+			tilePasses[t] = passes;
+			budget -= (long) passes * tileOpen[t];
+		}
+
+		double now = omp_get_wtime();
+		if (checkpointing && now - lastCheckpoint >= sceneParams.checkpointInterval)
+		{
+			vector<char> state;
+			CacheWriter out(state);
+			out.put(round);
+			out.putArray(tilePasses);
+			out.putArray(accums);
+			if (checkpoint::save(checkpointPath, key, noTiles, image, state)) {
+				checkpointsWritten++;
+			}
+			lastCheckpoint = now;
+		}
+	}
+	adaptiveRounds = round;
+
+	for (int it = 0; it < totalPixels; ++it) {
+		image.set(it, accums[it].mean(image.samples(it)));
+	}
+}
+
+// Traces sample number index of the pixel and adds it to the running sums of the pixel
+void RayTracer::addPixelSample(int w, int h, int index, PixelAccumT& accum, Framebuffer& image)
+{
+	int it = h * imagePlane.imgWidth + w;
+	MTimer timer;
+	timer.beginTimer();
+	Pcg32 rng;
+	rng.seed(sceneParams.seed, it);
+
+	MPoint pointOnPlane = imagePlane.getProgressivePointOnIP(w, h, index, rng);
+	MPoint raySource = activeCameraData.eye;
+	MVector rayDirection = activeCameraData.viewDir;
+	if (activeCameraData.isPerspective) {
+		rayDirection = (pointOnPlane - activeCameraData.eye).normal();
+	}
+	else {
+		raySource = pointOnPlane;
+	}
+	int depth = 0;
+	MColor color = shootRay(raySource, rayDirection, sceneParams.rayDepth, &depth);
+	STAT_ADD(totalDepths, depth);
+
+	for (int c = 0; c < 3; ++c) {
+		accum.sum[c] += color[c];
+		accum.sumSquares[c] += color[c] * color[c];
+	}
+	float y = luminance(color.r, color.g, color.b);
+	accum.sumLuminanceSquares += y * y;
+	image.samples(it)++;
+
+	timer.endTimer();
+	image.time(it) += timer.elapsedTime();
+}
+
+void RayTracer::renderPixel(int w, int h, MPoint* pointsOnPlane, Framebuffer& image)
+{
+	int it = h * imagePlane.imgWidth + w;
+	MTimer timer;
+	timer.beginTimer();
+	MColor pixelColor;
+	Pcg32 rng;
+	rng.seed(sceneParams.seed, it);
+	
+	imagePlane.getPointsOnIP(w, h, rng, pointsOnPlane);
+
+	switch (imagePlane.ssType) {
+	case ImagePlaneDataT::UNIFORM:
+	case ImagePlaneDataT::JITTERED:
+	case ImagePlaneDataT::RANDOM:
+	case ImagePlaneDataT::SOBOL:
+	case ImagePlaneDataT::HALTON:
+	case ImagePlaneDataT::BLUE_NOISE:
+		{
+			int count = imagePlane.samplesPerPixel();
+			MPoint raySource = activeCameraData.eye;
+			MVector rayDirection = activeCameraData.viewDir;
+			image.samples(it) = count;
+			for(int ssit = 0; ssit < count; ++ssit )
+			{
+				if (activeCameraData.isPerspective) {
+					rayDirection = (pointsOnPlane[ssit] - activeCameraData.eye).normal();
+				}
+				else {
+					raySource = pointsOnPlane[ssit];
+				}
+				int depth = 0;
+				pixelColor = sumColors(pixelColor, shootRay(raySource, rayDirection, sceneParams.rayDepth, &depth) / ((float)(count)));
+				STAT_ADD(totalDepths, depth);
+			}
+		}
+		break;
+	case ImagePlaneDataT::ADAPTIVE:
+		{
 			bool needToStop = false;
 			int count = 0;
 			MPoint raySource = activeCameraData.eye;
@@ -737,10 +2214,10 @@ void RayTracer::bresenhaim()
 			MColor colorExpectation;
 			MColor colorPrevExpectation;
 			MColor colorVariance;
-			pixelSamples[it] = 0;
+			image.samples(it) = 0;
 			while (!needToStop) {
-				pixelSamples[it] ++;
-				MPoint nextPoint = imagePlane.nextRandomPointOnIP(w, h);
+				image.samples(it)++;
+				MPoint nextPoint = imagePlane.nextRandomPointOnIP(w, h, rng);
 				if (activeCameraData.isPerspective) {
 					rayDirection = (nextPoint - activeCameraData.eye).normal();
 				}
@@ -749,10 +2226,9 @@ void RayTracer::bresenhaim()
 				}
 				int depth = 0;
 				newColor = shootRay(raySource, rayDirection, sceneParams.rayDepth, &depth); 
-#pragma omp atomic 
-				totalDepths += depth;
+				STAT_ADD(totalDepths, depth);
 				count++; 
-				
+			
 				if (1 == count) // first ray - here we initialize all the variance things
 				{
 					pixelColor = newColor;
@@ -778,85 +2254,139 @@ void RayTracer::bresenhaim()
 					}
 				}
 			}
-			break;
 		}
-
-		pixels[h*width*4 + w*4] = (unsigned char) (pixelColor.r * 255.0);
-		pixels[h*width*4 + w*4 + 1] = (unsigned char) (pixelColor.g * 255.0);
-		pixels[h*width*4 + w*4 + 2] = (unsigned char) (pixelColor.b * 255.0);
-
-		timer.endTimer();
-		pixelTimes[it] = timer.elapsedTime();
+		break;
+	case ImagePlaneDataT::ADAPTIVE_TILES:
+	case ImagePlaneDataT::UNDEFINED:
+		// renderAdaptiveTiles samples these pixels itself and parseArgs never sets UNDEFINED, the pixel stays black
+		image.samples(it) = 0;
+		break;
 	}
-#pragma endregion
 
-	computePixelStatistics(pixelTimes,pixelSamples, totalPixels);
+	image.set(it, pixelColor);
 
-	MImage img;
-	img.setPixels(pixels,width,height);
-	img.writeToFile(outputFilePath);
-	img.release();
-	delete [] pixels;
-	delete [] pixelTimes;
+	timer.endTimer();
+	image.time(it) = timer.elapsedTime();
 }
 
-void RayTracer::computePixelStatistics(double* pixelTimes,int* pixelSamples, int size)
+// Traces the rays of the 2x2 pixel block at (w0, h0) as packets: sample i of the four pixels goes in one packet.
+// Pixels from wEnd or hEnd on are left out.
+void RayTracer::renderPixelBlock(int w0, int h0, int wEnd, int hEnd, MPoint* samples, Framebuffer& image)
 {
-	double sumTimePerPixel = 0;
-	double averageTimePerPixel = 0;
-	double varianceTimePerPixel = 0;
-
-	double sumSamples = 0;
-	double avgSamples = 0;
-	double varSamples = 0;
+	MTimer timer;
+	timer.beginTimer();
+
+	// Every pixel gets the same number of samples
+	int samplesPerPixel = imagePlane.samplesPerPixel();
+	int its[PACKET_SIZE];
+	MPoint* pointsOnPlane[PACKET_SIZE];
+	MColor pixelColors[PACKET_SIZE];
+	int count = 0;
+	for (int h = h0; h < h0 + 2 && h < hEnd; ++h)
+	{
+		for (int w = w0; w < w0 + 2 && w < wEnd; ++w)
+		{
+			its[count] = h * imagePlane.imgWidth + w;
+			Pcg32 rng;
+			rng.seed(sceneParams.seed, its[count]);
+			pointsOnPlane[count] = samples + count * samplesPerPixel;
+			imagePlane.getPointsOnIP(w, h, rng, pointsOnPlane[count]);
+			count++;
+		}
+	}
 
-	for (int i = 0; i < size; i++) 
+	for(int ssit = 0; ssit < samplesPerPixel; ++ssit)
 	{
-		sumTimePerPixel += pixelTimes[i];
-		sumSamples += pixelSamples[i];
+		MPoint raySources[PACKET_SIZE];
+		MVector rayDirections[PACKET_SIZE];
+		for (int i = 0; i < count; ++i)
+		{
+			raySources[i] = activeCameraData.eye;
+			rayDirections[i] = activeCameraData.viewDir;
+			if (activeCameraData.isPerspective) {
+				rayDirections[i] = (pointsOnPlane[i][ssit] - activeCameraData.eye).normal();
+			}
+			else {
+				raySources[i] = pointsOnPlane[i][ssit];
+			}
+		}
+
+		RayHitT hits[PACKET_SIZE];
+		bool found[PACKET_SIZE];
+		tracePacket(raySources, rayDirections, count, hits, found);
+
+		for (int i = 0; i < count; ++i)
+		{
+			int depth = 0;
+			MColor color = found[i] ? shadeHit(raySources[i], rayDirections[i], hits[i], sceneParams.rayDepth, &depth) : BACKGROUND_COLOR;
+			pixelColors[i] = sumColors(pixelColors[i], color / ((float)(samplesPerPixel)));
+			STAT_ADD(totalDepths, depth);
+		}
 	}
 
-	averageTimePerPixel = sumTimePerPixel / (double)size;
-	avgSamples = sumSamples / (double) size;
-	for (int i = 0; i < size; i++) 
+	timer.endTimer();
+	for (int i = 0; i < count; ++i)
 	{
-		varianceTimePerPixel += (pixelTimes[i] - averageTimePerPixel) * (pixelTimes[i] - averageTimePerPixel);
-		varSamples += (pixelSamples[i] - avgSamples) * (pixelSamples[i] - avgSamples);
+		image.set(its[i], pixelColors[i]);
+		image.samples(its[i]) = samplesPerPixel;
+		image.time(its[i]) = timer.elapsedTime() / count;
 	}
-	varianceTimePerPixel = varianceTimePerPixel/(double)size;
-	varSamples = varSamples / (double)size;
+}
+
+void RayTracer::computePixelStatistics(const PixelStatisticsT& statistics)
+{
+	double size = (double) std::max(1L, statistics.pixels);
+
+	double averageTimePerPixel = statistics.timeSum / size;
+	double avgSamples = statistics.sampleSum / size;
+	double varianceTimePerPixel = std::max(0.0, statistics.timeSquares / size - averageTimePerPixel * averageTimePerPixel);
+	double varSamples = std::max(0.0, statistics.sampleSquares / size - avgSamples * avgSamples);
 
 	timePerPixel = averageTimePerPixel;
 	timePerPixelStandardDeviation = sqrt(varianceTimePerPixel);
 
 	samplesPerPixel = avgSamples;
 	samplesPerPixelStdDeviation = sqrt(varSamples);
-	totalSamples = sumSamples;
+	totalSamples = statistics.sampleSum;
+}
+
+bool RayTracer::closestIntersectionInMesh(int meshIndex, const MPoint& raySource, const MVector& rayDirection, int& innerFaceId, MPoint& intersection)
+{
+	if (sceneParams.acceleration == SceneParamT::BVH) {
+		int hitMesh;
+		return closestIntersectionInBvh(raySource, rayDirection, meshIndex, hitMesh, innerFaceId, intersection);
+	}
+
+	const TriangleT* meshTriangles = &triangles[meshFaceOffsets[meshIndex]];
+	int size = meshesData[meshIndex].faces.size();
+	bool intersected = false;
+	double minTime = DBL_MAX, time = DBL_MAX;
+
+	for(int fi = 0; fi < size; ++ fi) {
+		if(meshTriangles[fi].intersect(raySource, rayDirection, minTime, time)) {
+			intersected = true;
+			minTime = time;
+			innerFaceId = fi;
+		}
+	}
+	if (intersected) {
+		intersection = raySource + rayDirection * minTime;
+	}
+	return intersected;
 }
 
-bool getOutRay(const MeshDataT& mesh, const MVector& view, const MPoint& inPoint, const MVector& inRay, MPoint& outPoint, MVector& outRay)
+bool RayTracer::getOutRay(int meshIndex, const MVector& view, const MPoint& inPoint, const MVector& inRay, MPoint& outPoint, MVector& outRay)
 {
+	const MeshDataT& mesh = meshesData[meshIndex];
 	MVector dir = inRay;
 	MPoint src = inPoint + dir * DOUBLE_NUMERICAL_THRESHHOLD * 100;
-	int size = mesh.faces.size();
 
 	for( int count = 100; count > 0; --count) {
 	
-		bool intersected = false;
-		MPoint tIntersection, mintIntersection;
+		MPoint mintIntersection;
 		int outFaceId;
-		double minTime = DBL_MAX, time = DBL_MAX;
-
-		for(int fi = 0; fi < size; ++ fi) {
-			if(rayIntersectsTriangle(src + dir * DOUBLE_NUMERICAL_THRESHHOLD * 100, dir, mesh.faces[fi].vertices, time, tIntersection) && time < minTime) {
-				intersected = true;
-				minTime = time;
-				mintIntersection = tIntersection;
-				outFaceId = fi;
-			}
-		}
 
-		if( ! intersected) // out face is not found
+		if( ! closestIntersectionInMesh(meshIndex, src + dir * DOUBLE_NUMERICAL_THRESHHOLD * 100, dir, outFaceId, mintIntersection)) // out face is not found
 			return false;
 
 		const Face& outFace = mesh.faces[outFaceId];
@@ -884,10 +2414,8 @@ bool getOutRay(const MeshDataT& mesh, const MVector& view, const MPoint& inPoint
 void RayTracer::calculateSpecularAndDiffuseCoeffs(const MPoint& intersection, const MVector& lightDir, const double distDepth, const MVector& normal, const MVector& view, int x, int y, int z, double& kd, double& ks) 
 { 
 	kd = ks = 0.0;
-	int meshId, faceId;
-	MPoint secondIntersection;
 
-	if(! closestIntersection(intersection, -lightDir , x, y, z, meshId , faceId, secondIntersection, distDepth )){
+	if(! occluded(intersection, -lightDir, x, y, z, distDepth)){
 		kd = std::max(- (lightDir * normal), 0.0);
 		ks = std::max( -(reflectedRay(lightDir, normal) * view) , 0.0);
 	}
@@ -895,14 +2423,126 @@ void RayTracer::calculateSpecularAndDiffuseCoeffs(const MPoint& intersection, co
 
 MColor RayTracer::shootRay(const MPoint& raySrc, const MVector& rayDir, int depth, int* depthReached)
 {
-	int x, y, z;
-	int meshIdx, faceIdx;
-	MPoint intersection;
-	if (!findStartingVoxelIndeces(raySrc, rayDir, x, y, z) ||
-		!closestIntersection(raySrc, rayDir, x, y, z, meshIdx, faceIdx, intersection )) {
-			return BACKGROUND_COLOR;
+	RayHitT hit;
+	if (!traceRay(raySrc, rayDir, hit)) {
+		return BACKGROUND_COLOR;
+	}
+	return shadeHit(raySrc, rayDir, hit, depth, depthReached);
+}
+
+bool RayTracer::traceRay(const MPoint& raySrc, const MVector& rayDir, RayHitT& hit)
+{
+	if (sceneParams.acceleration == SceneParamT::BVH) {
+		hit.x = hit.y = hit.z = 0;
+		return closestIntersectionInBvh(raySrc, rayDir, -1, hit.meshIndex, hit.faceIndex, hit.intersection);
+	}
+	return findStartingVoxelIndeces(raySrc, rayDir, hit.x, hit.y, hit.z) &&
+		closestIntersection(raySrc, rayDir, hit.x, hit.y, hit.z, hit.meshIndex, hit.faceIndex, hit.intersection);
+}
+
+// Traces up to PACKET_SIZE rays together, found[i] tells whether ray i hit anything.
+// The hits are the ones traceRay would give for every ray on its own.
+void RayTracer::tracePacket(const MPoint raySrc[], const MVector rayDir[], int count, RayHitT hits[], bool found[])
+{
+	STAT_ADD(totalRayCount, count);
+	STAT_ADD(packetRayCount, count);
+
+	if (sceneParams.acceleration == SceneParamT::BVH) {
+		int meshIndex[PACKET_SIZE], faceIndex[PACKET_SIZE];
+		MPoint intersection[PACKET_SIZE];
+		long nodesVisited = 0;
+		long testCount = 0;
+		bvh.closestIntersectionPacket(raySrc, rayDir, count, found, meshIndex, faceIndex, intersection, nodesVisited, testCount);
+		STAT_ADD(bvhNodesVisited, nodesVisited);
+		STAT_ADD(intersectionTestCount, testCount);
+
+		for (int i = 0; i < count; ++i)
+		{
+			if (found[i]) {
+				hits[i].x = hits[i].y = hits[i].z = 0;
+				hits[i].meshIndex = meshIndex[i];
+				hits[i].faceIndex = faceIndex[i];
+				hits[i].intersection = intersection[i];
+				STAT_ADD(intersectionFoundCount, 1);
+			}
+		}
+		return;
+	}
+
+	GridWalker walkers[PACKET_SIZE];
+	bool active[PACKET_SIZE];
+	int activeCount = 0;
+	for (int i = 0; i < count; ++i)
+	{
+		found[i] = false;
+		active[i] = findStartingVoxelIndeces(raySrc[i], rayDir[i], hits[i].x, hits[i].y, hits[i].z);
+		if (active[i]) {
+			walkers[i].init(grid.min, grid.cellSize, grid.resolution, raySrc[i], rayDir[i], hits[i].x, hits[i].y, hits[i].z);
+			activeCount++;
+		}
+	}
+
+	// Lockstep while all the rays left are in the same voxel, the packet has one mailbox ray id
+	mailbox.nextRay();
+	while (activeCount > 0)
+	{
+		int cellIndex = -1;
+		bool together = true;
+		int first = 0;
+		for (int i = count - 1; i >= 0; --i)
+		{
+			if (active[i]) {
+				together = together && (cellIndex < 0 || walkers[i].index == cellIndex);
+				cellIndex = walkers[i].index;
+				first = i;
+			}
+		}
+		if (!together || grid.subGridOf(cellIndex) >= 0) {
+			break;
+		}
+
+		if (!grid.isCellEmpty(cellIndex)) {
+			closestIntersectionInVoxelPacket(grid, walkers[first].cell[0], walkers[first].cell[1], walkers[first].cell[2], cellIndex, raySrc, rayDir, active, count, hits, found);
+		}
+
+		for (int i = 0; i < count; ++i)
+		{
+			if (!active[i]) {
+				continue;
+			}
+			if (found[i]) {
+				hits[i].x = walkers[i].cell[0];
+				hits[i].y = walkers[i].cell[1];
+				hits[i].z = walkers[i].cell[2];
+				active[i] = false;
+				activeCount--;
+			}
+			else if (!walkers[i].next()) {
+				active[i] = false;
+				activeCount--;
+			}
+			else {
+				STAT_ADD(voxelsTraversed, 1);
+			}
+		}
 	}
 
+	// The rays went different ways, each one goes on alone from where it is
+	for (int i = 0; i < count; ++i)
+	{
+		if (active[i]) {
+			STAT_ADD(packetDivergedRays, 1);
+			found[i] = closestIntersectionAlong(walkers[i], raySrc[i], rayDir[i], hits[i].x, hits[i].y, hits[i].z, hits[i].meshIndex, hits[i].faceIndex, hits[i].intersection);
+		}
+	}
+}
+
+MColor RayTracer::shadeHit(const MPoint& raySrc, const MVector& rayDir, const RayHitT& hit, int depth, int* depthReached)
+{
+	int x = hit.x, y = hit.y, z = hit.z;
+	int meshIdx = hit.meshIndex, faceIdx = hit.faceIndex;
+	const MPoint& intersection = hit.intersection;
+
 	MeshDataT& mesh = meshesData[meshIdx];
 	Face& face = meshesData[meshIdx].faces[faceIdx];
 	Material& mat = mesh.material;
@@ -978,7 +2618,7 @@ MColor RayTracer::shootRay(const MPoint& raySrc, const MVector& rayDir, int dept
 	if(mat.isTransparent){
 		MVector outRay;
 		MPoint outPoint;
-		if(getOutRay(mesh, rayDir, intersection, inRay, outPoint, outRay)){
+		if(getOutRay(meshIdx, rayDir, intersection, inRay, outPoint, outRay)){
 				MColor second = shootRay(outPoint, outRay, depth - 1, &transparentDepth);
 				pixelColor = sumColors( pixelColor , second * effectiveTransparency);
 		}
@@ -1009,11 +2649,9 @@ bool RayTracer::findStartingVoxelIndeces(const MPoint& raySrc, const MVector& ra
 	//	return true;
 	//}
 	x = y = z = 0;
-	if(isPointInVolume(raySrc, minScene, maxScene)  &&
-		findIndecesByDimension( raySrc, X_POS, x, y, z) &&
-		findIndecesByDimension( raySrc, Y_POS, x, y, z) && 
-		findIndecesByDimension( raySrc, Z_POS, x, y, z))
+	if(isPointInVolume(raySrc, minScene, maxScene))
 	{
+		grid.findCell(raySrc, x, y, z);
 		return true;
 	}
 
@@ -1041,182 +2679,500 @@ bool RayTracer::findStartingVoxelIndeces(const MPoint& raySrc, const MVector& ra
 	if(direction == UNKNOWN_DIR)
 		return false;
 
-	initIndeces(direction, x,y,z);
-	AxisDirection uDirection, vDirection;
-	orthonormalDirections(direction, uDirection, vDirection);
+	grid.findCell(closestIntersection, x, y, z);
+	return true;
+}
+
+// The function finds the mesh with it intersects given ray, the inner id of the face in the mesh and the intersection point.
+// The voxels are walked with a 3D-DDA starting at x,y,z, which is changed to match the voxel where the closest intersection happens.
+// Returns true if finds
+// Return false if it arrives to the scene bounds and doesn't meet any mesh an some point.
+bool RayTracer::closestIntersection(const MPoint& raySource,const MVector& rayDirection, int& x, int& y, int& z , int& meshIndex, int& innerFaceId, MPoint& intersection , double depth)
+{
+	STAT_ADD(totalRayCount, 1);
+
+	GridWalker walker;
+	walker.init(grid.min, grid.cellSize, grid.resolution, raySource, rayDirection, x, y, z);
+	return closestIntersectionAlong(walker, raySource, rayDirection, x, y, z, meshIndex, innerFaceId, intersection, depth);
+}
+
+// Goes on walking the grid from the current cell of the walker
+bool RayTracer::closestIntersectionAlong(GridWalker& walker, const MPoint& raySource, const MVector& rayDirection, int& x, int& y, int& z, int& meshIndex, int& innerFaceId, MPoint& intersection, double depth)
+{
+	int currMeshIndex, currInnerFaceId;
+	MPoint currIntersection;
+
+	mailbox.nextRay();
 
-	if (!findIndecesByDimension( closestIntersection, uDirection, x, y, z) ||
-		!findIndecesByDimension(closestIntersection, vDirection, x, y, z) )
+	for(;;)
 	{
-		return false;
+		int subGrid = grid.subGridOf(walker.index);
+		bool found = (subGrid >= 0) ?
+			closestIntersectionInSubGrid(grid.subGrids[subGrid], raySource, rayDirection, walker.entryTime(), depth, currMeshIndex, currInnerFaceId, currIntersection) :
+			!grid.isCellEmpty(walker.index) &&
+				closestIntersectionInVoxel(grid, raySource, rayDirection, walker.cell[0], walker.cell[1], walker.cell[2], walker.index, currMeshIndex, currInnerFaceId, currIntersection);
+		if(found)
+		{
+			double distToIntersection = (currIntersection - raySource).length();
+			if( distToIntersection > depth ) {
+				return false;
+			}
+			if (distToIntersection >= DOUBLE_NUMERICAL_THRESHHOLD) {
+				x = walker.cell[0];
+				y = walker.cell[1];
+				z = walker.cell[2];
+				meshIndex = currMeshIndex;
+				innerFaceId = currInnerFaceId;
+				intersection = currIntersection;
+				return true;
+			}
+		}
+		// Nothing can be hit closer than depth beyond this voxel
+		if (walker.exitTime() > depth || !walker.next()) {
+			break;
+		}
+		STAT_ADD(voxelsTraversed, 1);
 	}
-	return true;
+
+	return false;
 }
 
-bool RayTracer::findIndecesByDimension( const MPoint& point, AxisDirection direction, int& x, int& y, int& z )
+// Walks the sub grid of a refined voxel, which the ray entered at time entryTime.
+// Returns the first hit that is not at the ray source.
+bool RayTracer::closestIntersectionInSubGrid(const Grid& subGrid, const MPoint& raySource, const MVector& rayDirection, double entryTime, double depth, int& meshIndex, int& innerFaceId, MPoint& intersection)
 {
-	int dimension = sceneParams.voxelsPerDimension;
-	int cur3DIndex = sceneParams.flatten3dCubeIndex(x,y,z);
-	for(;x >= 0 && x < dimension && y >= 0 && y < dimension && z >= 0 && z < dimension; sceneParams.incrementIndeces(direction, x, y, z, cur3DIndex))
+	int x, y, z;
+	subGrid.findCell(raySource + rayDirection * entryTime, x, y, z);
+
+	GridWalker walker;
+	walker.init(subGrid.min, subGrid.cellSize, subGrid.resolution, raySource, rayDirection, x, y, z);
+
+	for(;;)
 	{
-		if(pointInVoxelByDirection(point, voxelsData[cur3DIndex], direction))
+		if(!subGrid.isCellEmpty(walker.index) &&
+			closestIntersectionInVoxel(subGrid, raySource, rayDirection, walker.cell[0], walker.cell[1], walker.cell[2], walker.index, meshIndex, innerFaceId, intersection) &&
+			(intersection - raySource).length() >= DOUBLE_NUMERICAL_THRESHHOLD)
 		{
 			return true;
 		}
+		if (walker.exitTime() > depth || !walker.next()) {
+			break;
+		}
+		STAT_ADD(voxelsTraversed, 1);
 	}
 	return false;
 }
 
-void RayTracer::initIndeces( AxisDirection direction, int& x, int& y, int& z )
+bool RayTracer::closestIntersectionInVoxel(const Grid& cellGrid, const MPoint& raySource, const MVector& rayDirection, int x, int y, int z, int cellIndex, int &meshIndex, int &innerFaceId, MPoint &intersection )
 {
-	x = 0;
-	y = 0;
-	z = 0;
-	if (direction == X_POS)
-	{
-		x = sceneParams.voxelsPerDimension - 1;
+	if (packKernel != NULL) {
+		return closestIntersectionInVoxelPacks(cellGrid, raySource, rayDirection, x, y, z, cellIndex, meshIndex, innerFaceId, intersection);
 	}
-	else if (direction == Y_POS)
+
+	bool res = false;
+	double minTime = DBL_MAX;
+	double time = DBL_MAX;
+	MPoint curIntersection;
+	MPoint cellMin, cellMax;
+	cellGrid.cellBounds(x, y, z, cellMin, cellMax);
+
+	const GridFaceT* cellFaces = &cellGrid.cellFaces[0];
+	for(int fi = cellGrid.cellOffsets[cellIndex]; fi < cellGrid.cellOffsets[cellIndex + 1]; ++fi)
 	{
-		y = sceneParams.voxelsPerDimension - 1;
+		const GridFaceT& ref = cellFaces[fi];
+		int faceId = meshFaceOffsets[ref.meshIndex] + ref.faceIndex;
+		Mailbox::EntryT& tested = mailbox.entry(faceId);
+		bool hit;
+
+		if (mailbox.contains(tested, faceId)) {
+			// Already tested in a previous voxel of this ray
+			hit = tested.hit;
+			time = tested.time;
+			curIntersection = MPoint(tested.intersection[0], tested.intersection[1], tested.intersection[2]);
+			STAT_ADD(mailboxSkippedTests, 1);
+		}
+		else {
+			STAT_ADD(intersectionTestCount, 1);
+
+			hit = triangles[faceId].intersect(raySource, rayDirection, DBL_MAX, time);
+			if (hit) {
+				curIntersection = raySource + rayDirection * time;
+			}
+
+			tested.rayId = mailbox.rayId;
+			tested.faceId = faceId;
+			tested.hit = hit;
+			tested.time = time;
+			tested.intersection[0] = curIntersection.x;
+			tested.intersection[1] = curIntersection.y;
+			tested.intersection[2] = curIntersection.z;
+		}
+
+		if(!hit
+			|| !isPointInVolume(curIntersection, cellMin, cellMax)
+			|| ((curIntersection - raySource)*rayDirection) < 0)
+		{
+			continue;
+		}
+		if(time < minTime) {
+			meshIndex = ref.meshIndex;
+			innerFaceId = ref.faceIndex;
+			intersection = curIntersection;
+			minTime = time;
+			res = true;
+			STAT_ADD(intersectionFoundCount, 1);
+		}
+	}
+
+	return res;
+}
 
+// Shadow ray query: true if anything is hit closer than depth.
+// Unlike closestIntersection it returns on the first hit found and never builds intersection points.
+bool RayTracer::occluded(const MPoint& raySource, const MVector& rayDirection, int x, int y, int z, double depth)
+{
+	STAT_ADD(totalRayCount, 1);
+
+	if (sceneParams.acceleration == SceneParamT::BVH) {
+		long nodesVisited = 0;
+		long testCount = 0;
+		bool res = bvh.occluded(raySource, rayDirection, depth, nodesVisited, testCount);
+		STAT_ADD(bvhNodesVisited, nodesVisited);
+		STAT_ADD(intersectionTestCount, testCount);
+		return res;
 	}
-	else if (direction == Z_POS)
+
+	mailbox.nextRay();
+
+	GridWalker walker;
+	walker.init(grid.min, grid.cellSize, grid.resolution, raySource, rayDirection, x, y, z);
+
+	for(;;)
 	{
-		z = sceneParams.voxelsPerDimension - 1;
+		int subGrid = grid.subGridOf(walker.index);
+		if ((subGrid >= 0) ?
+			occludedInSubGrid(grid.subGrids[subGrid], raySource, rayDirection, walker.entryTime(), depth) :
+			!grid.isCellEmpty(walker.index) && occludedInVoxel(grid, walker.index, raySource, rayDirection, depth))
+		{
+			return true;
+		}
+		if (walker.exitTime() > depth || !walker.next()) {
+			break;
+		}
+		STAT_ADD(voxelsTraversed, 1);
 	}
+	return false;
 }
 
-void RayTracer::orthonormalDirections( AxisDirection direction, AxisDirection& uDirection, AxisDirection& vDirection )
+bool RayTracer::occludedInSubGrid(const Grid& subGrid, const MPoint& raySource, const MVector& rayDirection, double entryTime, double depth)
 {
-	switch (direction)
+	int x, y, z;
+	subGrid.findCell(raySource + rayDirection * entryTime, x, y, z);
+
+	GridWalker walker;
+	walker.init(subGrid.min, subGrid.cellSize, subGrid.resolution, raySource, rayDirection, x, y, z);
+
+	for(;;)
 	{
-	case X_NEG:
-	case X_POS:
-		uDirection = Y_POS;
-		vDirection = Z_POS;
-		break;
-	case Y_NEG:
-	case Y_POS:
-		uDirection = X_POS;
-		vDirection = Z_POS;
-		break;
-	case Z_NEG:
-	case Z_POS:
-		uDirection = X_POS;
-		vDirection = Y_POS;
-		break;
+		if (!subGrid.isCellEmpty(walker.index) && occludedInVoxel(subGrid, walker.index, raySource, rayDirection, depth)) {
+			return true;
+		}
+		if (walker.exitTime() > depth || !walker.next()) {
+			break;
+		}
+		STAT_ADD(voxelsTraversed, 1);
 	}
+	return false;
 }
 
-inline bool RayTracer::pointInVoxelByDirection( const MPoint& closestIntersection, VoxelDataT& voxel, AxisDirection direction )
+// Any hit closer than depth occludes, so there is no need to clip the hits to the voxel.
+// Every face found in the mailbox was therefore a miss.
+bool RayTracer::occludedInVoxel(const Grid& cellGrid, int cellIndex, const MPoint& raySource, const MVector& rayDirection, double depth)
 {
-	switch (direction)
-	{
-	case X_POS:
-		return valueInInterval(closestIntersection.x, voxel.v->Min().x, voxel.v->Max().x);
-	case Y_POS:
-		return valueInInterval(closestIntersection.y, voxel.v->Min().y, voxel.v->Max().y);
-	case Z_POS:
-		return valueInInterval(closestIntersection.z, voxel.v->Min().z, voxel.v->Max().z);
-	default:
-		return false;
+	if (packKernel != NULL) {
+		return occludedInVoxelPacks(cellGrid, cellIndex, raySource, rayDirection, depth);
 	}
 
+	const GridFaceT* cellFaces = &cellGrid.cellFaces[0];
+	for(int fi = cellGrid.cellOffsets[cellIndex]; fi < cellGrid.cellOffsets[cellIndex + 1]; ++fi)
+	{
+		const GridFaceT& ref = cellFaces[fi];
+		int faceId = meshFaceOffsets[ref.meshIndex] + ref.faceIndex;
+		Mailbox::EntryT& tested = mailbox.entry(faceId);
+		if (mailbox.contains(tested, faceId)) {
+			STAT_ADD(mailboxSkippedTests, 1);
+			continue;
+		}
+
+		STAT_ADD(intersectionTestCount, 1);
+
+		double time;
+		if (triangles[faceId].intersect(raySource, rayDirection, depth, time)) {
+			return true;
+		}
+		tested.rayId = mailbox.rayId;
+		tested.faceId = faceId;
+		tested.hit = false;
+	}
+	return false;
 }
 
-// The function finds the mesh with it intersects given ray, the inner id of the face in the mesh and the intersection point.
-// Also it changes the x,y,z indices to match the voxel where the closest intersection happens.
-// Returns true if finds
-// Return false if it arrives to the scene bounds and doesn't meet any mesh an some point.
-bool RayTracer::closestIntersection(const MPoint& raySource,const MVector& rayDirection, int& x, int& y, int& z , int& meshIndex, int& innerFaceId, MPoint& intersection , double depth)
+// The source is relative to the origin of each pack, setSource fills it in per pack
+static inline PackRayT toPackRay(const MVector& rayDirection, double maxTime)
 {
-#pragma omp atomic
-	totalRayCount++;
-
-	AxisDirection  farAxisDir;
-	int currMeshIndex, currInnerFaceId;
-	MPoint currIntersection;
-	int cur3Dindex = sceneParams.flatten3dCubeIndex( x, y, z);
+	PackRayT ray;
+	for (int a = 0; a < 3; ++a)
+	{
+		ray.src[a] = 0;
+		ray.dir[a] = (float) rayDirection[a];
+	}
+	ray.maxTime = (maxTime >= FLT_MAX) ? FLT_MAX : (float) maxTime * (1 + 1e-4f) + 1e-3f;
+	return ray;
+}
 
-	for(	;
-			x >= 0 && x < sceneParams.voxelsPerDimension && y >= 0 && y < sceneParams.voxelsPerDimension && z >= 0 && z < sceneParams.voxelsPerDimension; 
-			sceneParams.incrementIndeces(farAxisDir, x, y, z, cur3Dindex)) 
+// Lanes of the pack holding faces the current ray was not tested against yet. The faces it was
+// tested against are left out of the kernel, and their results are given to found.
+template <typename Found>
+static inline int untestedPackLanes(const Grid& cellGrid, int packIndex, const vector<int>& meshFaceOffsets, Found& found)
+{
+	int untested = 0;
+	for (int lane = 0; lane < TRIANGLE_PACK_WIDTH; ++lane)
 	{
-		VoxelDataT& voxelData = voxelsData[cur3Dindex];
-		if(!voxelData.v->findExitDirection(raySource, rayDirection, farAxisDir)) {
-			break;
-		}
-		if(voxelData.meshIdToFaceIds.size() == 0) {
+		int fi = cellGrid.cellPackFaces[packIndex * TRIANGLE_PACK_WIDTH + lane];
+		if (fi < 0) {
 			continue;
 		}
-		if(!closestIntersectionInVoxel(raySource, rayDirection, voxelData, currMeshIndex, currInnerFaceId, currIntersection)) {
+		const GridFaceT& ref = cellGrid.cellFaces[fi];
+		int faceId = meshFaceOffsets[ref.meshIndex] + ref.faceIndex;
+		const Mailbox::EntryT& tested = mailbox.entry(faceId);
+		if (!mailbox.contains(tested, faceId)) {
+			untested |= 1 << lane;
 			continue;
 		}
-		double distToIntersection = (currIntersection - raySource).length();
-		if( distToIntersection > depth ) {
-			return false;
+		STAT_ADD(mailboxSkippedTests, 1);
+		if (tested.hit) {
+			found(ref, tested.time, MPoint(tested.intersection[0], tested.intersection[1], tested.intersection[2]));
+		}
+	}
+	return untested;
+}
+
+// Keeps the closest of the hits given to it that is inside the cell
+struct ClosestHitInCellT
+{
+	const MPoint&	raySource;
+	const MVector&	rayDirection;
+	MPoint			cellMin;
+	MPoint			cellMax;
+	double			minTime;
+	bool			res;
+	int&			meshIndex;
+	int&			innerFaceId;
+	MPoint&			intersection;
+
+	ClosestHitInCellT(const MPoint& src, const MVector& dir, int& mesh, int& face, MPoint& point)
+		: raySource(src), rayDirection(dir), minTime(DBL_MAX), res(false), meshIndex(mesh), innerFaceId(face), intersection(point)
+	{
+	}
+
+	inline void operator()(const GridFaceT& ref, double time, const MPoint& curIntersection)
+	{
+		if (time >= minTime || !isPointInVolume(curIntersection, cellMin, cellMax) || ((curIntersection - raySource)*rayDirection) < 0) {
+			return;
 		}
-		if (distToIntersection < DOUBLE_NUMERICAL_THRESHHOLD) {
+		meshIndex = ref.meshIndex;
+		innerFaceId = ref.faceIndex;
+		intersection = curIntersection;
+		minTime = time;
+		res = true;
+		STAT_ADD(intersectionFoundCount, 1);
+	}
+};
+
+// Occlusion never gets here with a hit in the mailbox, since the first hit ends the ray
+struct NoHitT
+{
+	inline void operator()(const GridFaceT&, double, const MPoint&)
+	{
+	}
+};
+
+// Same result as the face by face test: the pack kernel only rules out faces in float,
+// every candidate it leaves is tested again in double precision. Faces found in the mailbox
+// are not tested again, and the results of the ones tested here go into it.
+bool RayTracer::closestIntersectionInVoxelPacks(const Grid& cellGrid, const MPoint& raySource, const MVector& rayDirection, int x, int y, int z, int cellIndex, int &meshIndex, int &innerFaceId, MPoint &intersection )
+{
+	ClosestHitInCellT closest(raySource, rayDirection, meshIndex, innerFaceId, intersection);
+	cellGrid.cellBounds(x, y, z, closest.cellMin, closest.cellMax);
+	PackRayT packRay = toPackRay(rayDirection, DBL_MAX);
+
+	for (int pi = cellGrid.cellPackOffsets[cellIndex]; pi < cellGrid.cellPackOffsets[cellIndex + 1]; ++pi)
+	{
+		int untested = untestedPackLanes(cellGrid, pi, meshFaceOffsets, closest);
+		if (untested == 0) {
 			continue;
 		}
-		meshIndex = currMeshIndex;
-		innerFaceId = currInnerFaceId;
-		intersection = currIntersection;
-		return true;
+		packRay.setSource(raySource, cellGrid.cellPacks[pi]);
+		int mask = packKernel(cellGrid.cellPacks[pi], packRay);
+		for (int lane = 0; untested != 0; ++lane, untested >>= 1, mask >>= 1)
+		{
+			if (!(untested & 1)) {
+				continue;
+			}
+			STAT_ADD(intersectionTestCount, 1);
+
+			// A lane the kernel rules out is a sure miss
+			const GridFaceT& ref = cellGrid.cellFaces[cellGrid.cellPackFaces[pi * TRIANGLE_PACK_WIDTH + lane]];
+			int faceId = meshFaceOffsets[ref.meshIndex] + ref.faceIndex;
+			double time = 0;
+			bool hit = (mask & 1) && triangles[faceId].intersect(raySource, rayDirection, DBL_MAX, time);
+			MPoint curIntersection;
+			if (hit) {
+				curIntersection = raySource + rayDirection * time;
+				closest(ref, time, curIntersection);
+			}
+
+			Mailbox::EntryT& tested = mailbox.entry(faceId);
+			tested.rayId = mailbox.rayId;
+			tested.faceId = faceId;
+			tested.hit = hit;
+			tested.time = time;
+			tested.intersection[0] = curIntersection.x;
+			tested.intersection[1] = curIntersection.y;
+			tested.intersection[2] = curIntersection.z;
+		}
 	}
 
-	return false;
+	return closest.res;
 }
 
-bool RayTracer::closestIntersectionInVoxel(const MPoint& raySource, const MVector& rayDirection, VoxelDataT &voxelData, int &meshIndex, int &innerFaceId, MPoint &intersection )
+// Packet version of closestIntersectionInVoxelPacks for the active rays, which are all in this cell.
+// Every pack is read once and run through the kernel for each ray, the rays are not put in the lanes.
+// The packet shares one mailbox entry per face: a face goes in it once every active ray missed it,
+// and the later cells leave it out for all of them.
+void RayTracer::closestIntersectionInVoxelPacket(const Grid& cellGrid, int x, int y, int z, int cellIndex, const MPoint raySource[], const MVector rayDirection[], const bool active[], int count, RayHitT hits[], bool found[])
 {
+	MPoint cellMin, cellMax;
+	cellGrid.cellBounds(x, y, z, cellMin, cellMax);
 
-	bool res = false;
-	double minTime = DBL_MAX;
-	double time;
-	int currentFaceIndex;
-	MPoint curIntersection;
+	PackRayT packRays[PACKET_SIZE];
+	double minTime[PACKET_SIZE];
+	for (int i = 0; i < count; ++i)
+	{
+		minTime[i] = DBL_MAX;
+		if (active[i]) {
+			packRays[i] = toPackRay(rayDirection[i], DBL_MAX);
+		}
+	}
 
-	for(map<int, vector<int>>::iterator it = voxelData.meshIdToFaceIds.begin(); it != voxelData.meshIdToFaceIds.end(); ++it )
+	NoHitT noHit;
+	for (int pi = cellGrid.cellPackOffsets[cellIndex]; pi < cellGrid.cellPackOffsets[cellIndex + 1]; ++pi)
 	{
-		MeshDataT& mesh = meshesData[it->first];
-		vector<int>& faceIds = it->second;
-		for(currentFaceIndex = (int) faceIds.size() - 1; currentFaceIndex >= 0; --currentFaceIndex)
-		{
-#pragma omp atomic
-			intersectionTestCount++;
-			
-			Face& face = mesh.faces[faceIds[currentFaceIndex]];
-			/*
-			mesh.getPolygonVertices(faceIds[currentFaceIndex], vertexIds);
-			if(vertexIds.length() != 3) {
+		int untested = untestedPackLanes(cellGrid, pi, meshFaceOffsets, noHit);
+		if (untested == 0) {
 			continue;
+		}
+		const TrianglePackT& pack = cellGrid.cellPacks[pi];
+		int hitLanes = 0;
+		for (int i = 0; i < count; ++i)
+		{
+			if (!active[i]) {
+				continue;
 			}
-			for (int vi = 0; vi < 3; ++vi) {
-			mesh.getPoint(vertexIds[vi], triangleVertices[vi], MSpace::kWorld);
-			}*/
-
-			if(!rayIntersectsTriangle(raySource, rayDirection, face.vertices, time, curIntersection)
-				|| !isPointInVolume(curIntersection, voxelData.v->Min(), voxelData.v->Max())
-				|| ((curIntersection - raySource)*rayDirection) < 0)
+			packRays[i].setSource(raySource[i], pack);
+			int mask = packKernel(pack, packRays[i]);
+			for (int lane = 0, lanes = untested; lanes != 0; ++lane, lanes >>= 1, mask >>= 1)
 			{
+				if (!(lanes & 1)) {
+					continue;
+				}
+				STAT_ADD(intersectionTestCount, 1);
+
+				// Same test as ClosestHitInCellT, so the hits are the ones of the ray on its own
+				const GridFaceT& ref = cellGrid.cellFaces[cellGrid.cellPackFaces[pi * TRIANGLE_PACK_WIDTH + lane]];
+				double time = 0;
+				if (!(mask & 1) || !triangles[meshFaceOffsets[ref.meshIndex] + ref.faceIndex].intersect(raySource[i], rayDirection[i], DBL_MAX, time)) {
+					continue;
+				}
+				hitLanes |= 1 << lane;
+				MPoint curIntersection = raySource[i] + rayDirection[i] * time;
+				if (time >= minTime[i] || !isPointInVolume(curIntersection, cellMin, cellMax) || ((curIntersection - raySource[i])*rayDirection[i]) < 0) {
+					continue;
+				}
+				hits[i].meshIndex = ref.meshIndex;
+				hits[i].faceIndex = ref.faceIndex;
+				hits[i].intersection = curIntersection;
+				minTime[i] = time;
+				found[i] = true;
+				STAT_ADD(intersectionFoundCount, 1);
+			}
+		}
+
+		// A face hit by any of the rays is tested again in the next cells
+		for (int lane = 0, missed = untested & ~hitLanes; missed != 0; ++lane, missed >>= 1)
+		{
+			if (!(missed & 1)) {
 				continue;
 			}
-			if(time < minTime) {
-				meshIndex = it->first;
-				innerFaceId = faceIds[currentFaceIndex];
-				intersection = curIntersection;
-				minTime = time;
-				res = true;
-#pragma omp atomic
-			intersectionFoundCount++;
-				
+			const GridFaceT& ref = cellGrid.cellFaces[cellGrid.cellPackFaces[pi * TRIANGLE_PACK_WIDTH + lane]];
+			int faceId = meshFaceOffsets[ref.meshIndex] + ref.faceIndex;
+			Mailbox::EntryT& tested = mailbox.entry(faceId);
+			tested.rayId = mailbox.rayId;
+			tested.faceId = faceId;
+			tested.hit = false;
+		}
+	}
+}
+
+// Like occludedInVoxel, the faces found in the mailbox were misses and are left out
+bool RayTracer::occludedInVoxelPacks(const Grid& cellGrid, int cellIndex, const MPoint& raySource, const MVector& rayDirection, double depth)
+{
+	double time;
+	NoHitT noHit;
+	PackRayT packRay = toPackRay(rayDirection, depth);
+
+	for (int pi = cellGrid.cellPackOffsets[cellIndex]; pi < cellGrid.cellPackOffsets[cellIndex + 1]; ++pi)
+	{
+		int untested = untestedPackLanes(cellGrid, pi, meshFaceOffsets, noHit);
+		if (untested == 0) {
+			continue;
+		}
+		packRay.setSource(raySource, cellGrid.cellPacks[pi]);
+		int mask = packKernel(cellGrid.cellPacks[pi], packRay);
+		for (int lane = 0; untested != 0; ++lane, untested >>= 1, mask >>= 1)
+		{
+			if (!(untested & 1)) {
+				continue;
+			}
+			STAT_ADD(intersectionTestCount, 1);
+
+			const GridFaceT& ref = cellGrid.cellFaces[cellGrid.cellPackFaces[pi * TRIANGLE_PACK_WIDTH + lane]];
+			int faceId = meshFaceOffsets[ref.meshIndex] + ref.faceIndex;
+			if ((mask & 1) && triangles[faceId].intersect(raySource, rayDirection, depth, time)) {
+				return true;
 			}
+			Mailbox::EntryT& tested = mailbox.entry(faceId);
+			tested.rayId = mailbox.rayId;
+			tested.faceId = faceId;
+			tested.hit = false;
 		}
 	}
+	return false;
+}
+
+bool RayTracer::closestIntersectionInBvh(const MPoint& raySource, const MVector& rayDirection, int onlyMesh, int& meshIndex, int& innerFaceId, MPoint& intersection, double depth)
+{
+	STAT_ADD(totalRayCount, 1);
+
+	long nodesVisited = 0;
+	long testCount = 0;
+	bool res = bvh.closestIntersection(raySource, rayDirection, depth, onlyMesh, meshIndex, innerFaceId, intersection, nodesVisited, testCount);
 
+	STAT_ADD(bvhNodesVisited, nodesVisited);
+	STAT_ADD(intersectionTestCount, testCount);
+	if (res) {
+		STAT_ADD(intersectionFoundCount, 1);
+	}
 	return res;
 }
 
-
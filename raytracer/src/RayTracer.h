@@ -22,18 +22,29 @@
 #include <maya/MFnReflectShader.h>
 #include <maya/MFnBlinnShader.h>
 #include <maya/MFnPhongShader.h>
+#include <maya/MNodeMessage.h>
+#include <maya/MObjectHandle.h>
 #include <vector>
 #include <string>
 #include <map>
+#include <algorithm>
 #include <sstream>
 #include <fstream>
 #include "Plane.h"
 #include "Definitions.h"
 #include "Util.h"
-#include "Voxel.h"
+#include "Grid.h"
+#include "GridWalker.h"
+#include "Bvh.h"
+#include "Triangle.h"
+#include "TrianglePack.h"
+#include "TileScheduler.h"
+#include "Framebuffer.h"
+#include "Checkpoint.h"
+#include "CacheStream.h"
+#include "Random.h"
+#include "Sampling.h"
 #include "Mesh.h"
-#include <stdlib.h>     /* srand, rand */
-#include <time.h>       /* time */
 
 
 using std::vector;
@@ -55,11 +66,42 @@ using namespace util;
 #define		toleranceFlag			"-t"
 #define		maxSamplingRateFlag		"-masr"
 #define		minSamplingRateFlag		"-misr"
-
-
-
-#define		RAND_PRECISION			1000
-#define		RAND					((double)( rand() % RAND_PRECISION)) / ((double) (RAND_PRECISION - 1))
+#define		adaptiveTargetFlag		"-at"
+#define		accelerationFlag		"-ac"
+#define		gridDensityFlag			"-gd"
+#define		subGridThresholdFlag	"-hg"
+#define		simdFlag				"-sm"
+#define		packetFlag				"-pk"
+#define		tileSizeFlag			"-ts"
+#define		threadsFlag				"-th"
+#define		seedFlag				"-sd"
+#define		progressiveFlag			"-pr"
+#define		progressiveErrorFlag	"-pe"
+#define		flushIntervalFlag		"-fi"
+#define		outputFlag				"-o"
+#define		streamFlag				"-st"
+#define		checkpointFlag			"-cp"
+#define		checkpointIntervalFlag	"-ci"
+#define		resumeFlag				"-rs"
+#define		sceneCacheFlag			"-sc"
+#define		sceneFileFlag			"-sf"
+#define		keepSceneFlag			"-ks"
+#define		statisticsFlag			"-sp"
+
+
+
+
+#define		DEFAULT_GRID_DENSITY	4.0
+#define		PACKET_SIZE				4		// primary rays traced together, one per pixel of a 2x2 block
+#define		DEFAULT_FLUSH_INTERVAL	5.0
+#define		DEFAULT_CHECKPOINT_INTERVAL	60.0
+#define		SCENE_CACHE_MAGIC		0x53435452	// "RTCS"
+#define		SCENE_CACHE_VERSION		2
+#define		DEFAULT_OUTPUT_PATH		"C://temp//scene.iff"	// .pfm, .ppm and .png are written directly, anything else through MImage
+#define		DEFAULT_STATISTICS_PATH	"C://temp//stat.txt"
+#define		MIN_PROGRESSIVE_PASSES	4		// samples a pixel needs before its error is trusted
+#define		MAX_PROGRESSIVE_PASSES	4096
+#define		MAX_TILE_PASSES_PER_ROUND	8	// passes the noisiest tiles get in one round of adaptive tile sampling
 
 #define		BACKGROUND_COLOR		MColor(0, 0, 0, 1)
 
@@ -77,16 +119,34 @@ class RayTracer : public MPxCommand
 	int initCameraVoxelZ;
 	//int supersamplingCoeff;
 
-	static char* outputFilePath;
-	static char* statisticsFilePath;
+	static MString outputFilePath;
+	static MString statisticsFilePath;
 
 	static double	prepTime;
+	static double	binningTime;
+	static long		gridMemoryEstimate;
 	static double	totalTime;
 	static double	timePerPixel;
 	static double	timePerPixelStandardDeviation;
 	static long		intersectionTestCount;
 	static long		intersectionFoundCount; 
 	static long		voxelsTraversed;
+	static long		bvhNodesVisited;
+	static long		mailboxSkippedTests;
+	static long		packetRayCount;
+	static long		packetDivergedRays;
+	static long		renderThreads;
+	static long		tilesStolen;
+	static long		renderAllocations;
+	static long		progressivePasses;
+	static long		adaptiveRounds;
+	static long		checkpointsWritten;
+	static long		tilesResumed;
+	static long		passesResumed;
+	static bool		sceneFromCache;
+	static long		meshesReused;
+	static long		meshesUpdated;
+	static long		meshHashesReused;
 	static long		totalRayCount;
 	static long		totalPolyCount;
 	static long		totalDepths;
@@ -115,7 +175,7 @@ class RayTracer : public MPxCommand
 
 	struct ImagePlaneDataT
 	{
-		enum { UNIFORM, JITTERED, RANDOM, ADAPTIVE, UNDEFINED} ssType;
+		enum { UNIFORM, JITTERED, RANDOM, ADAPTIVE, SOBOL, HALTON, BLUE_NOISE, ADAPTIVE_TILES, UNDEFINED} ssType;
 
 		int			imgWidth;
 		int			imgHeight;
@@ -145,22 +205,37 @@ class RayTracer : public MPxCommand
 		int			ssAdaptiveMinSamples;
 		int			ssAdaptiveMaxSamples;
 		double		ssAdaptiveErrorProbability;
+		double		ssAdaptiveTarget;		// fraction of the pixels that may still fail the variance test when adaptive tile sampling stops
 
-		ImagePlaneDataT()
+		// Number of points getPointsOnIP gives for every pixel
+		int		samplesPerPixel() const
 		{
-			srand (time(NULL));
+			switch (ssType)
+			{
+			case RayTracer::ImagePlaneDataT::UNIFORM:
+			case RayTracer::ImagePlaneDataT::JITTERED:
+				return supersamplingCoeff * supersamplingCoeff;
+			case RayTracer::ImagePlaneDataT::RANDOM:
+			case RayTracer::ImagePlaneDataT::SOBOL:
+			case RayTracer::ImagePlaneDataT::HALTON:
+				return supersamplingCoeff;
+			case RayTracer::ImagePlaneDataT::BLUE_NOISE:
+				return std::min(supersamplingCoeff, MAX_BLUE_NOISE_SAMPLES);
+			default:
+				return 0;
+			}
 		}
 
-		void	getPointsOnIP(const int w, const int h, vector<MPoint>& out ) const
+		// Writes the samplesPerPixel() points of the pixel to out, which has room for them
+		void	getPointsOnIP(const int w, const int h, Pcg32& rng, MPoint* out ) const
 		{
-			out.clear();
 			switch (ssType)
 			{
 			case RayTracer::ImagePlaneDataT::UNIFORM: {
 					MPoint pixelLB = lb + h * dy + w * dx;
 					for(int ww = 1; ww <= supersamplingCoeff; ++ ww) {
 						for(int hh = 1; hh <= supersamplingCoeff; ++hh) {
-							out.push_back(pixelLB + hh * ssdx + ww * ssdy);
+							*out++ = pixelLB + hh * ssdx + ww * ssdy;
 						}
 					}
 				}
@@ -169,7 +244,7 @@ class RayTracer : public MPxCommand
 					MPoint pixelLB = lb + h * dy + w * dx;
 					for(int ww = 1; ww <= supersamplingCoeff; ++ ww) {
 						for(int hh = 1; hh <= supersamplingCoeff; ++hh) {
-							out.push_back(pixelLB + ((double) hh + RAND) * ssdx + ((double) ww + RAND) * ssdy);
+							*out++ = pixelLB + ((double) hh + rng.nextDouble()) * ssdx + ((double) ww + rng.nextDouble()) * ssdy;
 						}
 					}
 				}
@@ -178,7 +253,40 @@ class RayTracer : public MPxCommand
 			case RayTracer::ImagePlaneDataT::RANDOM: {
 					MPoint pixelLB = lb + h * dy + w * dx;
 					for(int r = 0; r < supersamplingCoeff; ++r) {
-						out.push_back(pixelLB + (RAND * dx) + (RAND * dy));
+						*out++ = pixelLB + (rng.nextDouble() * dx) + (rng.nextDouble() * dy);
+					}
+				}
+				break;
+			case RayTracer::ImagePlaneDataT::SOBOL: {
+					MPoint pixelLB = lb + h * dy + w * dx;
+					unsigned int scrambleX = rng.next();
+					unsigned int scrambleY = rng.next();
+					for(int r = 0; r < supersamplingCoeff; ++r) {
+						double sx, sy;
+						sampling::sobol(r, scrambleX, scrambleY, sx, sy);
+						*out++ = pixelLB + (sx * dx) + (sy * dy);
+					}
+				}
+				break;
+			case RayTracer::ImagePlaneDataT::HALTON: {
+					MPoint pixelLB = lb + h * dy + w * dx;
+					double shiftX = rng.nextDouble();
+					double shiftY = rng.nextDouble();
+					for(int r = 0; r < supersamplingCoeff; ++r) {
+						double sx, sy;
+						sampling::halton(r, shiftX, shiftY, sx, sy);
+						*out++ = pixelLB + (sx * dx) + (sy * dy);
+					}
+				}
+				break;
+			case RayTracer::ImagePlaneDataT::BLUE_NOISE: {
+					MPoint pixelLB = lb + h * dy + w * dx;
+					double shiftX = rng.nextDouble();
+					double shiftY = rng.nextDouble();
+					for(int r = 0; r < supersamplingCoeff && r < MAX_BLUE_NOISE_SAMPLES; ++r) {
+						double sx, sy;
+						sampling::blueNoise(r, shiftX, shiftY, sx, sy);
+						*out++ = pixelLB + (sx * dx) + (sy * dy);
 					}
 				}
 				break;
@@ -189,9 +297,37 @@ class RayTracer : public MPxCommand
 			}
 		}
 
-		MPoint nextRandomPointOnIP(const int w, const int h) const {
+		// Sample index of the pixel in progressive rendering. Halton and blue noise continue their own sequence,
+		// every other type uses the Sobol sequence. rng has to be seeded the same way for every index.
+		MPoint getProgressivePointOnIP(const int w, const int h, int index, Pcg32& rng) const {
+			MPoint pixelLB = lb + h * dy + w * dx;
+			double sx, sy;
+			switch (ssType) {
+			case RayTracer::ImagePlaneDataT::HALTON: {
+					double shiftX = rng.nextDouble();
+					double shiftY = rng.nextDouble();
+					sampling::halton(index, shiftX, shiftY, sx, sy);
+				}
+				break;
+			case RayTracer::ImagePlaneDataT::BLUE_NOISE: {
+					double shiftX = rng.nextDouble();
+					double shiftY = rng.nextDouble();
+					sampling::blueNoise(index % MAX_BLUE_NOISE_SAMPLES, shiftX, shiftY, sx, sy);
+				}
+				break;
+			default: {
+					unsigned int scrambleX = rng.next();
+					unsigned int scrambleY = rng.next();
+					sampling::sobol(index, scrambleX, scrambleY, sx, sy);
+				}
+				break;
+			}
+			return pixelLB + (sx * dx) + (sy * dy);
+		}
+
+		MPoint nextRandomPointOnIP(const int w, const int h, Pcg32& rng) const {
 			MPoint pixelLB = lb + h * dy + w * dx;
-			return pixelLB + (RAND * dx) + (RAND * dy);
+			return pixelLB + (rng.nextDouble() * dx) + (rng.nextDouble() * dy);
 		}
 
 	};
@@ -252,76 +388,136 @@ class RayTracer : public MPxCommand
 		//double		dy;
 		//double		dz;
 
-		int rayDepth;
+		enum { GRID, BVH } acceleration;
 
-		double dimensionDeltaHalfs[3];
-		double dimensionDeltas[3];
+		int rayDepth;
 
 		int			voxelsPerDimension;
-		int			voxelsPerDimensionSqr;
+		double		gridDensity;	// cells per face of the automatic grid resolution, 0 to use voxelsPerDimension
+		int			subGridThreshold;	// voxels with more faces get a sub grid, 0 for a single level grid
 
-		SceneParamT() : voxelsPerDimension(1), voxelsPerDimensionSqr(1)
+		bool		useTrianglePacks;	// test the faces of a voxel with the SIMD pack kernel
+		trianglePack::KernelType packKernelType;
+
+		bool		usePackets;		// walk the primary rays of 2x2 pixel blocks through the voxels together; coherent traversal only, the faces are still tested ray by ray
+
+		int			tileSize;		// side of the square pixel tiles handed to the render threads
+		int			threadCount;	// render threads, 0 for one per processor
+
+		unsigned int	seed;		// the sampling of every pixel is drawn from a generator seeded with it and the pixel index
+
+		double		progressiveBudget;	// seconds of progressive rendering, 0 for no time limit
+		double		progressiveError;	// standard error of the luminance at which a pixel stops getting passes, 0 to never stop
+		double		flushInterval;		// seconds between the images written during progressive rendering
+
+		bool		streamOutput;	// write tiles to the file as they are done instead of keeping the image
+
+		MString		checkpointPath;		// where the state of the render is saved, empty for no checkpoints
+		double		checkpointInterval;	// seconds between checkpoints
+		bool		resume;				// go on from the checkpoint instead of starting over
+
+		MString		sceneCacheDirectory;	// where the extracted faces and the acceleration structure are cached, empty for no cache
+
+		MString		sceneFile;		// scene description to render instead of the Maya scene, empty to read the Maya scene
+
+		bool		keepScene;		// keep the faces and the acceleration structure for the next run, which reads again only the meshes that changed; the grid bins only those again, the BVH is rebuilt whole
+
+		SceneParamT() : voxelsPerDimension(1), gridDensity(0), subGridThreshold(0), useTrianglePacks(true), packKernelType(trianglePack::detectKernel()), usePackets(false), tileSize(DEFAULT_TILE_SIZE), threadCount(0), seed(0),
+			progressiveBudget(0), progressiveError(0), flushInterval(DEFAULT_FLUSH_INTERVAL), streamOutput(false),
+			checkpointInterval(DEFAULT_CHECKPOINT_INTERVAL), resume(false), keepScene(false)
 		{
-			dimensionDeltaHalfs[0] = dimensionDeltaHalfs[1] = dimensionDeltaHalfs[2] = 0.5;
-			dimensionDeltas[0] = dimensionDeltas[1] = dimensionDeltas[2] = 1;
 		}
 
-		inline int	flatten3dCubeIndex( int x, int y, int z)
+	} ;
+
+	// Closest hit of a ray, with what shading needs to know about it
+	struct RayHitT
+	{
+		int			x, y, z;	// voxel of the hit, where the shadow rays start walking
+		int			meshIndex;
+		int			faceIndex;
+		MPoint		intersection;
+	};
+
+	// Running sums of the samples of a pixel, for the renderers that sample it over several passes
+	struct PixelAccumT
+	{
+		float		sum[3];
+		float		sumSquares[3];
+		float		sumLuminanceSquares;
+
+		MColor mean(int count) const
 		{
-			return x + voxelsPerDimension*y + voxelsPerDimensionSqr*z;
+			return MColor(sum[0] / count, sum[1] / count, sum[2] / count);
 		}
 
-		inline void incrementIndeces( AxisDirection uDirection, int& x, int& y, int& z, int& cur3dIndex )
+		// Unbiased variance of every channel, count has to be at least 2
+		MColor variance(int count) const
 		{
-			switch (uDirection)
-			{
-			case X_POS:
-				++x;
-				++cur3dIndex;
-				break;
-			case X_NEG:
-				--x;
-				--cur3dIndex;
-				break;
-			case Y_POS:
-				++y;
-				cur3dIndex += voxelsPerDimension;
-				break;
-			case Y_NEG:
-				--y;
-				cur3dIndex -= voxelsPerDimension;
-				break;
-			case Z_POS:
-				++z;
-				cur3dIndex += voxelsPerDimensionSqr;
-				break;
-			case Z_NEG:
-				--z;
-				cur3dIndex -= voxelsPerDimensionSqr;
-				break;
-			default:
-				break;
+			MColor res(0, 0, 0, 0);
+			for (int c = 0; c < 3; ++c) {
+				float m = sum[c] / count;
+				res[c] = std::max(0.0f, (sumSquares[c] - count * m * m) / (count - 1));
 			}
-#pragma omp atomic
-			voxelsTraversed++;
+			return res;
 		}
 
-	} ;
-
-	struct VoxelDataT
-	{
-		Voxel* v;
-		//vector<int> containedMeshIndexes;
-		map<int, vector<int>> meshIdToFaceIds;
-		
+		// Unbiased variance of the luminance, count has to be at least 2
+		double luminanceVariance(int count) const
+		{
+			double m = luminance(sum[0], sum[1], sum[2]) / count;
+			return std::max(0.0, (sumLuminanceSquares - count * m * m) / (count - 1));
+		}
 	};
 
 	CameraDataT activeCameraData;
 	ImagePlaneDataT imagePlane;
 	SceneParamT sceneParams;
 	vector<MeshDataT> meshesData;
-	vector<VoxelDataT> voxelsData;
+	vector<int> meshFaceOffsets;	// scene wide id of the first face of every mesh
+	vector<TriangleT> triangles;	// all the faces of the scene, indexed by scene wide id
 	vector<LightDataT> lightingData;
+	Grid grid;
+	Bvh bvh;
+	TrianglePackKernel packKernel;	// NULL when the voxels are tested one face at a time
+
+	// The faces, triangle table and acceleration structure of the last run over the Maya scene,
+	// with what they were built from, kept until the next run
+	struct ResidentSceneT
+	{
+		bool						valid;
+		unsigned long long			settingsHash;
+		vector<MString>				meshNames;
+		vector<unsigned long long>	meshHashes;
+		vector<vector<Face>>		meshFaces;
+		vector<int>					meshFaceOffsets;
+		vector<TriangleT>			triangles;
+		Grid						grid;
+		Bvh							bvh;
+
+		ResidentSceneT() : valid(false), settingsHash(0)
+		{
+		}
+	};
+
+	static ResidentSceneT residentScene;
+
+	// The part of a mesh hash read from the mesh node, kept until a dirty callback on the node says it changed
+	struct MeshHashMemoT
+	{
+		MObjectHandle		node;
+		MCallbackId			dirtyCallback;
+		bool				watched;	// the callback was added
+		bool				dirty;
+		bool				textured;	// whether the UVs are in the hash
+		unsigned long long	geometryHash;
+
+		MeshHashMemoT() : dirtyCallback(0), watched(false), dirty(true), textured(false), geometryHash(0)
+		{
+		}
+	};
+
+	static std::map<string, MeshHashMemoT> meshHashMemos;	// by mesh path
 public:
 
 #pragma region INTERACTION
@@ -336,9 +532,11 @@ public:
 #pragma endregion
 
 #pragma region MESH
-	void triangulateMesh(const MFnMesh& mesh);
-	void computeAndStoreMeshData();
+	void storeMeshes(vector<MDagPath>& meshPaths);
+	void storeMeshFaces(const vector<MDagPath>& meshPaths, const vector<bool>* onlyMeshes = NULL);
+	void storeTriangles();
 	void computeVoxelMeshIntersections();
+	void updateVoxelMeshIntersections(const vector<bool>& changedMeshes);
 	void storeMeshMaterial(MeshDataT& m, const MDagPath& path);
 #pragma endregion 
 
@@ -357,30 +555,66 @@ public:
 
 #pragma region SCENE
 	void computeAndStoreSceneBoundingBox();
-	void voxelizeScene();
-	void computeAndStoreVoxelParams();
-	void computeAndStoreRawVoxelsData();
+	void voxelizeScene(const vector<bool>* changedMeshes = NULL);
+	bool computeAndStoreVoxelParams(bool keepCells = false);
+	void locateCameraInGrid();
+#pragma endregion 
+
+#pragma region SCENE_FILE
+	bool loadSceneFile(const MString& path);
+#pragma endregion 
+
+#pragma region SCENE_CACHE
+	unsigned long long accelerationSettingsHash() const;
+	void computeMeshHashes(const vector<MDagPath>& meshPaths, vector<unsigned long long>& meshHashes);
+	unsigned long long meshGeometryHash(const MDagPath& meshPath, bool textured);
+	static void meshDirtied(MObject& node, void* clientData);
+	static void releaseMeshHashes();
+	MString sceneCachePath(const vector<unsigned long long>& meshHashes);
+	void saveSceneCache(const MString& path);
+	bool loadSceneCache(const MString& path);
+#pragma endregion 
+
+#pragma region RESIDENT_SCENE
+	int takeResidentScene(const vector<MDagPath>& meshPaths, const vector<unsigned long long>& meshHashes, vector<bool>& changedMeshes);
+	void keepResidentScene(const vector<MDagPath>& meshPaths, const vector<unsigned long long>& meshHashes);
+	static void releaseResidentScene();
 #pragma endregion 
 
 #pragma region ALGO
-	void bresenhaim();
+	bool bresenhaim();
+	void renderTiles(Framebuffer* image, ImageStream* stream, PixelStatisticsT& statistics);
+	void renderProgressive(Framebuffer& image);
+	void renderAdaptiveTiles(Framebuffer& image);
+	CheckpointKeyT checkpointKey(int tileCount) const;
+	void addPixelSample(int w, int h, int index, PixelAccumT& accum, Framebuffer& image);
+	void collectRenderCounters();
+	bool writeImage(const Framebuffer& image);
+	void renderPixel(int w, int h, MPoint* pointsOnPlane, Framebuffer& image);
+	void renderPixelBlock(int w0, int h0, int wEnd, int hEnd, MPoint* samples, Framebuffer& image);
 	MColor shootRay(const MPoint& raySrc, const MVector& rayDir, int depth, int* depthReached=NULL);
+	bool traceRay(const MPoint& raySrc, const MVector& rayDir, RayHitT& hit);
+	void tracePacket(const MPoint raySrc[], const MVector rayDir[], int count, RayHitT hits[], bool found[]);
+	MColor shadeHit(const MPoint& raySrc, const MVector& rayDir, const RayHitT& hit, int depth, int* depthReached);
 	bool closestIntersection(const MPoint& raySource,const MVector& rayDirection,int& x,int& y,int& z , int& meshIndex, int& innerFaceId, MPoint& intersection, double depth = DBL_MAX );
-	bool closestIntersectionInVoxel(const MPoint& raySource, const MVector& rayDirection, VoxelDataT &voxelData, int &meshIndex, int &innerFaceId, MPoint &intersection);
+	bool closestIntersectionAlong(GridWalker& walker, const MPoint& raySource, const MVector& rayDirection, int& x, int& y, int& z, int& meshIndex, int& innerFaceId, MPoint& intersection, double depth = DBL_MAX);
+	bool closestIntersectionInVoxel(const Grid& cellGrid, const MPoint& raySource, const MVector& rayDirection, int x, int y, int z, int cellIndex, int &meshIndex, int &innerFaceId, MPoint &intersection);
+	bool closestIntersectionInVoxelPacks(const Grid& cellGrid, const MPoint& raySource, const MVector& rayDirection, int x, int y, int z, int cellIndex, int &meshIndex, int &innerFaceId, MPoint &intersection);
+	void closestIntersectionInVoxelPacket(const Grid& cellGrid, int x, int y, int z, int cellIndex, const MPoint raySource[], const MVector rayDirection[], const bool active[], int count, RayHitT hits[], bool found[]);
+	bool closestIntersectionInSubGrid(const Grid& subGrid, const MPoint& raySource, const MVector& rayDirection, double entryTime, double depth, int& meshIndex, int& innerFaceId, MPoint& intersection);
+	bool closestIntersectionInBvh(const MPoint& raySource, const MVector& rayDirection, int onlyMesh, int& meshIndex, int& innerFaceId, MPoint& intersection, double depth = DBL_MAX);
+	bool occluded(const MPoint& raySource, const MVector& rayDirection, int x, int y, int z, double depth);
+	bool occludedInSubGrid(const Grid& subGrid, const MPoint& raySource, const MVector& rayDirection, double entryTime, double depth);
+	bool occludedInVoxel(const Grid& cellGrid, int cellIndex, const MPoint& raySource, const MVector& rayDirection, double depth);
+	bool occludedInVoxelPacks(const Grid& cellGrid, int cellIndex, const MPoint& raySource, const MVector& rayDirection, double depth);
+	bool closestIntersectionInMesh(int meshIndex, const MPoint& raySource, const MVector& rayDirection, int& innerFaceId, MPoint& intersection);
+	bool getOutRay(int meshIndex, const MVector& view, const MPoint& inPoint, const MVector& inRay, MPoint& outPoint, MVector& outRay);
 
 	bool findStartingVoxelIndeces(const MPoint& raySrc, const MVector& rayDirection, int& bx, int& by, int& bz);
 
-	bool findIndecesByDimension(const MPoint& point, AxisDirection direction,  int& x, int& y, int& z );
-
-	void initIndeces( AxisDirection direction, int& x, int& y, int& z );
-
-	void orthonormalDirections( AxisDirection direction, AxisDirection& uDirection, AxisDirection& vDirection );
-
-	bool pointInVoxelByDirection( const MPoint& closestIntersection,VoxelDataT& voxel, AxisDirection uDirection );
-
 	void calculateSpecularAndDiffuseCoeffs(const MPoint& intersection, const MVector& lightDir, const double distDepth, const MVector& normal, const MVector& view, int x, int y, int z, double& kd, double& ks);
 
-	void RayTracer::computePixelStatistics(double* pixelTimes,int* pixelSamples, int size);
+	void computePixelStatistics(const PixelStatisticsT& statistics);
 #pragma endregion 
 
 	
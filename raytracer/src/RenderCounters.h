@@ -0,0 +1,30 @@
+#pragma once
+
+// Statistics counted by the render threads. Every thread counts into a block of its own,
+// the blocks are summed into the RayTracer statics once all the tiles are done.
+// Define RAYTRACER_NO_STATS to compile the counting out of the render loop.
+struct RenderCountersT
+{
+	long	intersectionTestCount;
+	long	intersectionFoundCount;
+	long	voxelsTraversed;
+	long	bvhNodesVisited;
+	long	mailboxSkippedTests;
+	long	packetRayCount;
+	long	packetDivergedRays;
+	long	totalRayCount;
+	long	totalDepths;
+	long	renderAllocations;
+
+	inline void clear()
+	{
+		intersectionTestCount = intersectionFoundCount = voxelsTraversed = bvhNodesVisited = mailboxSkippedTests = 0;
+		packetRayCount = packetDivergedRays = totalRayCount = totalDepths = renderAllocations = 0;
+	}
+};
+
+#ifdef RAYTRACER_NO_STATS
+#define		STAT_ADD(counter, amount)
+#else
+#define		STAT_ADD(counter, amount)	(renderCounters.counter += (amount))
+#endif
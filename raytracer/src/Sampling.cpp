@@ -0,0 +1,149 @@
+#include "Sampling.h"
+
+#include <math.h>
+
+static inline double wrap(double v)
+{
+	return v - floor(v);
+}
+
+static inline double toUnit(unsigned int bits)
+{
+	return bits * (1.0 / 4294967296.0);
+}
+
+static unsigned int reverseBits(unsigned int v)
+{
+	v = ((v >> 1) & 0x55555555) | ((v & 0x55555555) << 1);
+	v = ((v >> 2) & 0x33333333) | ((v & 0x33333333) << 2);
+	v = ((v >> 4) & 0x0f0f0f0f) | ((v & 0x0f0f0f0f) << 4);
+	v = ((v >> 8) & 0x00ff00ff) | ((v & 0x00ff00ff) << 8);
+	return (v >> 16) | (v << 16);
+}
+
+// Nested uniform (Owen) scramble of the bits of a sample, with the hash of Laine and Karras
+// as Burley uses it: every bit is flipped depending on the bits above it
+static unsigned int owenScramble(unsigned int bits, unsigned int seed)
+{
+	unsigned int x = reverseBits(bits);
+	x += seed;
+	x ^= x * 0x6c50b47cu;
+	x ^= x * 0xb82f1e52u;
+	x ^= x * 0xc7afe638u;
+	x ^= x * 0x8d22f6e6u;
+	return reverseBits(x);
+}
+
+// Mitchell's best candidate on the torus, every sample the farthest of 16 * i candidates from the ones
+// placed before it, drawn from Pcg32 seeded with 0x5eed. Precomputed, building it is quadratic in the samples.
+static const double blueNoisePoints[2 * MAX_BLUE_NOISE_SAMPLES] =
+{
+	0.24007610487751663, 0.48187189293093979, 0.69018429168500006, 0.053962292382493615, 0.82473152596503496, 0.55327574186958373, 0.19586628582328558, 0.90720415650866926,
+	0.48256489750929177, 0.72609021235257387, 0.018008305225521326, 0.19495274941436946, 0.54297099588438869, 0.3758605825714767, 0.38197015877813101, 0.14677845244295895,
+	0.92758724745362997, 0.91641898266971111, 0.49185963603667915, 0.93754433607682586, 0.80561765725724399, 0.31710470980033278, 0.0081445474643260241, 0.43595719314180315,
+	0.083373025758191943, 0.70574786933138967, 0.71855148742906749, 0.77031734841875732, 0.59350801235996187, 0.56988492025993764, 0.19339533103629947, 0.26428566174581647,
+	0.2724514554720372, 0.6903012169059366, 0.67737306957133114, 0.21924015902914107, 0.35309395007789135, 0.3589834519661963, 0.41917176963761449, 0.53397965058684349,
+	0.91517566121183336, 0.73233151366002858, 0.19925725716166198, 0.085550697520375252, 0.35900281788781285, 0.86065299971960485, 0.83406528900377452, 0.14687929395586252,
+	0.53211592137813568, 0.10435126419179142, 0.69115825742483139, 0.44523780047893524, 0.76284990645945072, 0.92140481784008443, 0.02621384640224278, 0.031053910264745355,
+	0.057491238694638014, 0.85022501228377223, 0.10390397510491312, 0.55987466825172305, 0.32040400058031082, 0.021063888212665915, 0.62131951982155442, 0.89551234897226095,
+	0.48057411448098719, 0.25454901601187885, 0.98027588147670031, 0.61073475005105138, 0.13195003219880164, 0.40308976988308132, 0.9361953183542937, 0.29389280127361417,
+	0.7031345060095191, 0.63036912842653692, 0.8662253690417856, 0.43871211539953947, 0.90068102465011179, 0.045315587194636464, 0.59790739649906754, 0.76845357776619494,
+	0.25576139334589243, 0.80517227994278073, 0.84490359202027321, 0.83328787796199322, 0.37589302123524249, 0.63869550172239542, 0.13341089664027095, 0.99735375004820526,
+	0.81828751950524747, 0.66860365215688944, 0.30803943309001625, 0.24357306701131165, 0.055369635811075568, 0.30162566248327494, 0.49002800276502967, 0.6187989073805511,
+	0.43142865877598524, 0.030943036312237382, 0.23930743196979165, 0.36998014571145177, 0.68025103257969022, 0.32771195075474679, 0.12929151486605406, 0.17437004996463656,
+	0.58386380039155483, 0.99963373597711325, 0.36990386852994561, 0.74947744514793158, 0.22096767066977918, 0.59070626529864967, 0.51870778994634748, 0.48101170989684761,
+	0.14787971251644194, 0.785911945393309, 0.79330606921575963, 0.026454965118318796, 0.45791080524213612, 0.83049608021974564, 0.28024686127901077, 0.13913689041510224,
+	0.92794705671258271, 0.52080433000810444, 0.5800671607721597, 0.23691243957728148, 0.43437562044709921, 0.42510369326919317, 0.94125682767480612, 0.13705247081816196,
+	0.31611400051042438, 0.56203545164316893, 0.95844759861938655, 0.8279605838470161, 0.61179560841992497, 0.66530205449089408, 0.73373880726285279, 0.13767234003171325,
+	0.62871327996253967, 0.12962128035724163, 0.23015820188447833, 0.99544309894554317, 0.34764857590198517, 0.46165075059980154, 0.72741553536616266, 0.53876646794378757,
+	0.17207684274762869, 0.68085953267291188, 0.86806689598597586, 0.2285483090672642, 0.7749071775469929, 0.40498773171566427, 0.77180731715634465, 0.21902200323529541,
+	0.38482523895800114, 0.94713903195224702, 0.020133063662797213, 0.93665552465245128, 0.093790255021303892, 0.092989236116409302, 0.93368738610297441, 0.38396932161413133,
+	0.67000789009034634, 0.96824380615726113, 0.88975820923224092, 0.61436003306880593, 0.28515918832272291, 0.92041613766923547, 0.021519962698221207, 0.52928836573846638,
+	0.54582151956856251, 0.8489478665869683, 0.0068753825034946203, 0.74884885875508189, 0.43503608321771026, 0.32923128851689398, 0.60635711578652263, 0.47005034284666181,
+	0.84509545494802296, 0.94873854331672192, 0.1120688843075186, 0.91124779591336846, 0.81391843757592142, 0.75402492401190102, 0.47233116324059665, 0.1649343678727746,
+	0.39043065719306469, 0.25718021322973073, 0.10056406049989164, 0.47724904585629702, 0.7122823242098093, 0.85315105458721519, 0.21568383043631911, 0.18766757985576987,
+	0.1348653647582978, 0.32537196367047727, 0.060865585226565599, 0.6270141948480159, 0.62814565398730338, 0.38707437226548791, 0.79739073081873357, 0.47941079642623663,
+	0.17162843281403184, 0.51970480475574732, 0.94457441871054471, 0.21283929375931621, 0.5072240186855197, 0.021153092384338379, 0.95792899443767965, 0.99376411596313119,
+	0.67504634871147573, 0.70475708460435271, 0.60031038266606629, 0.31429674290120602, 0.77451580157503486, 0.60853789071552455, 0.21537716896273196, 0.7410302204079926,
+	0.013912414433434606, 0.11695655924268067, 0.0083218470681458712, 0.36129391496069729, 0.74953168001957238, 0.69675338198430836, 0.076047620270401239, 0.77958679897710681,
+	0.11857955693267286, 0.2470396114513278, 0.8760960940271616, 0.337263114284724, 0.2877689644228667, 0.31318808649666607, 0.36594901815988123, 0.075203608255833387,
+	0.0013288338668644428, 0.67963314079679549, 0.52332544699311256, 0.55222322978079319, 0.73920247284695506, 0.28573215426877141, 0.54283352196216583, 0.67489718366414309,
+	0.28859316394664347, 0.41841105208732188, 0.65801333729177713, 0.80727334460243583, 0.52801010874100029, 0.78109098458662629, 0.44018027815036476, 0.66726952092722058,
+	0.1317799030803144, 0.62582570756785572, 0.77194078871980309, 0.81647770665585995, 0.65459930221550167, 0.52965071145445108, 0.44340829434804618, 0.099984403001144528,
+	0.611628333106637, 0.061653651762753725, 0.55808058846741915, 0.16927356645464897, 0.51996664074249566, 0.31185712898150086, 0.56025961390696466, 0.93133918172679842,
+	0.19240044406615198, 0.83903663791716099, 0.79107784223742783, 0.096506765345111489, 0.93432601075619459, 0.666728904703632, 0.30229398258961737, 0.62912836740724742,
+	0.42332314210943878, 0.89103398355655372, 0.94370611105114222, 0.4514143040869385, 0.30315403989516199, 0.75279714120551944, 0.99830252700485289, 0.26212883554399014,
+	0.26230806927196681, 0.06992989219725132, 0.064835196593776345, 0.39995320909656584, 0.17810866050422192, 0.45145420171320438, 0.96609242120757699, 0.069601467112079263,
+	0.74142257031053305, 0.98905667336657643, 0.42847589845769107, 0.77349368762224913, 0.71271043037995696, 0.38426181906834245, 0.89989373018033803, 0.79613365791738033,
+	0.072224807692691684, 0.98193459934554994, 0.33453067415393889, 0.68519310210831463, 0.9883994844276458, 0.88267208100296557, 0.903216797625646, 0.85947321937419474,
+	0.4279642824549228, 0.60135750425979495, 0.47750553442165256, 0.37589348503388464, 0.45676760701462626, 0.48160086455754936, 0.85544815543107688, 0.49987810011953115,
+	0.8224676160607487, 0.89109301916323602, 0.41775996726937592, 0.19931396935135126, 0.29450470907613635, 0.85492390277795494, 0.32543876045383513, 0.17858402198180556,
+	0.33598532690666616, 0.80430095107294619, 0.12620548158884048, 0.85012375889346004, 0.64365267800167203, 0.60532593005336821, 0.89307369012385607, 0.98553283349610865,
+	0.83459770237095654, 0.38628741842694581, 0.070410990389063954, 0.1544352846685797, 0.68560020206496119, 0.9062608671374619, 0.88395868707448244, 0.10493863536976278,
+	0.29972288710996509, 0.50198031263425946, 0.55034696171060205, 0.61204970115795732, 0.61842644168063998, 0.18882134417071939, 0.89204553118906915, 0.17083952808752656,
+	0.63958355877548456, 0.26708418689668179, 0.1430885826703161, 0.058448660653084517, 0.86091430601663888, 0.71124765509739518, 0.34796799719333649, 0.29908375302329659,
+	0.56879384792409837, 0.51575070107355714, 0.01669957977719605, 0.80731015792116523, 0.37208921951241791, 0.58129554102197289, 0.064285933272913098, 0.22893644729629159,
+	0.37612303742207587, 0.0056524432729929686, 0.19596479344181716, 0.32585541601292789, 0.84083852986805141, 0.059752501547336578, 0.2482839843723923, 0.24872040119953454,
+	0.22492238250561059, 0.65235826745629311, 0.49237331934273243, 0.8793086635414511, 0.55516944429837167, 0.73079909686930478, 0.5577165731228888, 0.43423258187249303,
+	0.6795366620644927, 0.159839948406443, 0.36357361357659101, 0.51738671003840864, 0.24532220768742263, 0.5377470450475812, 0.37714397674426436, 0.41106882365420461,
+	0.52536030416376889, 0.21781161613762379, 0.15036769793368876, 0.11901209922507405, 0.44007063959725201, 0.96537158382125199, 0.60472833761014044, 0.83390734042041004,
+	0.81926326174288988, 0.25952534307725728, 0.75367590296082199, 0.34274001303128898, 0.16533538210205734, 0.5761899531353265, 0.18698108335956931, 0.39247482130303979,
+	0.73223474249243736, 0.48254246031865478, 0.32556710042990744, 0.96022383961826563, 0.1418237870093435, 0.73028400470502675, 0.46811478235758841, 0.56161602586507797,
+	0.083477514330297709, 0.038694809190928936, 0.17786378692835569, 0.96131712268106639, 0.93482610792852938, 0.5761510191950947, 0.41835694783367217, 0.71826805826276541,
+	0.40205692569725215, 0.8231210052035749, 0.23063130094669759, 0.42564842361025512, 0.26972282491624355, 0.19878799770958722, 0.61499593546614051, 0.95385914971120656,
+	0.50066759251058102, 0.42913282942026854, 0.24002054543234408, 0.8710380841512233, 0.74393099802546203, 0.061659773346036673, 0.64829714712686837, 0.75151989073492587,
+	0.88012362364679575, 0.55566150229424238, 0.95232263812795281, 0.77094331965781748, 0.64736682688817382, 0.018237065058201551, 0.5531039300840348, 0.050011779414489865,
+	0.044413934228941798, 0.47982943151146173, 0.83431989513337612, 0.61202156613580883, 0.98134654015302658, 0.49201736180111766, 0.4014010364189744, 0.47350350231863558,
+	0.88466600817628205, 0.27956108655780554, 0.16583283268846571, 0.21465065330266953, 0.67829299555160105, 0.10612665535882115, 0.78372380044311285, 0.16529808100312948,
+	0.79691299051046371, 0.96971919550560415, 0.48911707801744342, 0.07450544461607933, 0.19055764749646187, 0.031087263021618128, 0.72478426387533545, 0.19042829819954932,
+	0.33002648968249559, 0.11520350351929665, 0.82244458561763167, 0.20123920775949955, 0.69077212456613779, 0.26831498742103577, 0.21453206054866314, 0.1364534511230886,
+	0.038557205814868212, 0.57826320338062942, 0.29820495378226042, 0.3658371502533555, 0.6952509731054306, 0.57783311442472041, 0.66072627017274499, 0.8591592216398567,
+	0.34118885570205748, 0.91084778704680502, 0.083366901846602559, 0.34866408933885396, 0.23297377722337842, 0.94505008473061025, 0.53490249183960259, 0.97585177421569824,
+	0.84649660880677402, 0.0081201058346778154, 0.77899891952984035, 0.52839449956081808, 0.87553736288100481, 0.90731345070526004, 0.36627894244156778, 0.20692891115322709,
+	0.28015872603282332, 0.98531874478794634, 0.49377805669791996, 0.67806411115452647, 0.76110656489618123, 0.86577721056528389, 0.98266798350960016, 0.3166109265293926,
+	0.61081505217589438, 0.7178671017754823, 0.40107339737005532, 0.3681460190564394, 0.58213652181439102, 0.10521630034781992, 0.062740224180743098, 0.89952769433148205
+};
+
+namespace sampling
+{
+	double radicalInverse(int index, int base)
+	{
+		double inverse = 1.0 / base;
+		double factor = inverse;
+		double result = 0;
+		for (; index > 0; index /= base)
+		{
+			result += (index % base) * factor;
+			factor *= inverse;
+		}
+		return result;
+	}
+
+	void sobol(unsigned int index, unsigned int scrambleX, unsigned int scrambleY, double& x, double& y)
+	{
+		x = toUnit(owenScramble(reverseBits(index), scrambleX));
+
+		// Second dimension from the direction numbers of the polynomial x + 1
+		unsigned int bitsY = 0;
+		for (unsigned int v = 1u << 31; index != 0; index >>= 1, v ^= v >> 1)
+		{
+			if (index & 1) {
+				bitsY ^= v;
+			}
+		}
+		y = toUnit(owenScramble(bitsY, scrambleY));
+	}
+
+	void halton(int index, double shiftX, double shiftY, double& x, double& y)
+	{
+		x = wrap(radicalInverse(index, 2) + shiftX);
+		y = wrap(radicalInverse(index, 3) + shiftY);
+	}
+
+	void blueNoise(int index, double shiftX, double shiftY, double& x, double& y)
+	{
+		index %= MAX_BLUE_NOISE_SAMPLES;
+		x = wrap(blueNoisePoints[2 * index] + shiftX);
+		y = wrap(blueNoisePoints[2 * index + 1] + shiftY);
+	}
+}
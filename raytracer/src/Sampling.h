@@ -0,0 +1,20 @@
+#pragma once
+
+#define		MAX_BLUE_NOISE_SAMPLES		256
+
+// Sample sets over the unit square for pixel supersampling. The sets are the same for every
+// pixel; each pixel randomizes its own copy (scramble or toroidal shift) from its generator.
+namespace sampling
+{
+	// Sample i of the (0,2) Sobol sequence, both coordinates Owen scrambled with their own seed
+	void	sobol(unsigned int index, unsigned int scrambleX, unsigned int scrambleY, double& x, double& y);
+
+	// Sample i of the Halton sequence in bases 2 and 3, shifted by (shiftX, shiftY) modulo 1
+	void	halton(int index, double shiftX, double shiftY, double& x, double& y);
+
+	// Sample i of a progressive blue noise set (best candidate), shifted by (shiftX, shiftY) modulo 1.
+	// Any prefix of the set is evenly spread, the set has MAX_BLUE_NOISE_SAMPLES samples.
+	void	blueNoise(int index, double shiftX, double shiftY, double& x, double& y);
+
+	double	radicalInverse(int index, int base);
+}
@@ -0,0 +1,157 @@
+#include "TileScheduler.h"
+
+#include <algorithm>
+#include <omp.h>
+
+// Interleaves the bits of x and y
+static unsigned int mortonCode(unsigned int x, unsigned int y)
+{
+	unsigned int code = 0;
+	for (int b = 0; b < 16; ++b)
+	{
+		code |= ((x >> b) & 1) << (2 * b);
+		code |= ((y >> b) & 1) << (2 * b + 1);
+	}
+	return code;
+}
+
+static inline long long packRange(int begin, int end)
+{
+	return ((long long) begin << 32) | (unsigned int) end;
+}
+
+static inline void unpackRange(long long range, int& begin, int& end)
+{
+	begin = (int) (range >> 32);
+	end = (int) (range & 0xffffffff);
+}
+
+TileScheduler::TileScheduler() : runs(NULL), threads(0), stolen(0)
+{
+}
+
+TileScheduler::~TileScheduler()
+{
+	delete [] runs;
+}
+
+void TileScheduler::init(int width, int height, int tileSize, int threadCount)
+{
+	tileSize = std::max(1, tileSize);
+
+	int tilesX = (width + tileSize - 1) / tileSize;
+	int tilesY = (height + tileSize - 1) / tileSize;
+	vector<std::pair<unsigned int, TileT>> ordered;
+	for (int ty = 0; ty < tilesY; ++ty)
+	{
+		for (int tx = 0; tx < tilesX; ++tx)
+		{
+			TileT tile;
+			tile.x0 = tx * tileSize;
+			tile.y0 = ty * tileSize;
+			tile.x1 = std::min(width, tile.x0 + tileSize);
+			tile.y1 = std::min(height, tile.y0 + tileSize);
+			ordered.push_back(std::make_pair(mortonCode(tx, ty), tile));
+		}
+	}
+	std::sort(ordered.begin(), ordered.end(),
+		[](const std::pair<unsigned int, TileT>& a, const std::pair<unsigned int, TileT>& b) { return a.first < b.first; });
+
+	tiles.resize(ordered.size());
+	for (int i = 0; i < (int) ordered.size(); ++i) {
+		tiles[i] = ordered[i].second;
+	}
+	distribute(threadCount);
+}
+
+void TileScheduler::init(const vector<TileT>& tileList, int threadCount)
+{
+	tiles = tileList;
+	distribute(threadCount);
+}
+
+// Splits the tiles into one contiguous run per thread
+void TileScheduler::distribute(int threadCount)
+{
+	threads = (threadCount < 1) ? omp_get_num_procs() : threadCount;
+	stolen = 0;
+
+	delete [] runs;
+	runs = new RunT[threads];
+	int count = (int) tiles.size();
+	for (int t = 0; t < threads; ++t) {
+		runs[t].range = packRange((int) ((long long) count * t / threads), (int) ((long long) count * (t + 1) / threads));
+	}
+}
+
+bool TileScheduler::popFront(int run, int& tile)
+{
+	long long range = runs[run].range;
+	int begin, end;
+	for (;;)
+	{
+		unpackRange(range, begin, end);
+		if (begin >= end) {
+			return false;
+		}
+		if (runs[run].range.compare_exchange_weak(range, packRange(begin + 1, end))) {
+			tile = begin;
+			return true;
+		}
+	}
+}
+
+bool TileScheduler::popBack(int run, int& tile)
+{
+	long long range = runs[run].range;
+	int begin, end;
+	for (;;)
+	{
+		unpackRange(range, begin, end);
+		if (begin >= end) {
+			return false;
+		}
+		if (runs[run].range.compare_exchange_weak(range, packRange(begin, end - 1))) {
+			tile = end - 1;
+			return true;
+		}
+	}
+}
+
+bool TileScheduler::nextTile(int thread, TileT& tile)
+{
+	int index;
+	return nextTile(thread, tile, index);
+}
+
+bool TileScheduler::nextTile(int thread, TileT& tile, int& index)
+{
+	if (thread < threads && popFront(thread, index)) {
+		tile = tiles[index];
+		return true;
+	}
+
+	// Steal from the run with the most tiles left, until there is nothing left anywhere
+	for (;;)
+	{
+		int victim = -1;
+		int mostLeft = 0;
+		for (int t = 0; t < threads; ++t)
+		{
+			int begin, end;
+			unpackRange(runs[t].range, begin, end);
+			if (end - begin > mostLeft) {
+				mostLeft = end - begin;
+				victim = t;
+			}
+		}
+		if (victim < 0) {
+			return false;
+		}
+		if (popBack(victim, index)) {
+			stolen++;
+			tile = tiles[index];
+			return true;
+		}
+	}
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <atomic>
+#include <vector>
+
+using std::vector;
+
+#define		DEFAULT_TILE_SIZE		16
+
+// Rectangle of pixels [x0, x1) x [y0, y1)
+struct TileT
+{
+	int		x0;
+	int		y0;
+	int		x1;
+	int		y1;
+};
+
+// Splits the image into square tiles laid out in Morton order, so consecutive tiles are close on screen.
+// Every thread gets a contiguous run of tiles it takes from the front; a thread that runs out steals
+// from the back of the run with the most tiles left. Runs are kept as one 64 bit (begin, end) pair
+// updated with compare and swap, so neither the owner nor the thieves ever lock.
+class TileScheduler
+{
+	struct RunT
+	{
+		std::atomic<long long>	range;		// begin in the high half, end in the low half
+		char					padding[64 - sizeof(std::atomic<long long>)];	// one run per cache line
+	};
+
+	vector<TileT>	tiles;
+	RunT*			runs;
+	int				threads;
+	std::atomic<long>	stolen;
+
+	bool	popFront(int run, int& tile);
+	bool	popBack(int run, int& tile);
+	void	distribute(int threadCount);
+
+public:
+	TileScheduler();
+	~TileScheduler();
+
+	// threadCount < 1 uses all the processors of the machine
+	void	init(int width, int height, int tileSize, int threadCount);
+	// Hands out the given tiles in their order
+	void	init(const vector<TileT>& tileList, int threadCount);
+
+	// Next tile for the given thread, false when the whole image is taken
+	bool	nextTile(int thread, TileT& tile);
+	// Also gives the position of the tile in the tile list
+	bool	nextTile(int thread, TileT& tile, int& index);
+
+	inline const TileT& tileAt(int index) const
+	{
+		return tiles[index];
+	}
+
+	inline int threadCount() const
+	{
+		return threads;
+	}
+
+	inline int tileCount() const
+	{
+		return (int) tiles.size();
+	}
+
+	inline long stolenTiles() const
+	{
+		return stolen;
+	}
+};
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <maya/MPoint.h>
+#include <maya/MVector.h>
+#include <maya/MPointArray.h>
+#include <math.h>
+#include "Util.h"
+
+// Triangle prepared for the Moller-Trumbore test: the first vertex and the two edges
+// leaving it, as plain doubles. Built once per face, so the intersection kernel does
+// not touch the MPointArray of the face nor recompute the edges on every test.
+struct TriangleT
+{
+	double	v0[3];
+	double	e1[3];		// v1 - v0
+	double	e2[3];		// v2 - v0
+
+	// Faces that are not triangles get a degenerate record that is never hit
+	inline void init(const MPointArray& vertices)
+	{
+		for (int a = 0; a < 3; ++a)
+		{
+			v0[a] = e1[a] = e2[a] = 0;
+			if (vertices.length() == 3) {
+				v0[a] = vertices[0][a];
+				e1[a] = vertices[1][a] - vertices[0][a];
+				e2[a] = vertices[2][a] - vertices[0][a];
+			}
+		}
+	}
+
+	// Same test as util::rayIntersectsTriangle. Returns the hit time in (DOUBLE_NUMERICAL_THRESHHOLD, maxTime).
+	inline bool intersect(const MPoint& src, const MVector& dir, double maxTime, double& time) const
+	{
+		double h[3] = {	dir.y * e2[2] - dir.z * e2[1],
+						dir.z * e2[0] - dir.x * e2[2],
+						dir.x * e2[1] - dir.y * e2[0] };
+		double a = e1[0] * h[0] + e1[1] * h[1] + e1[2] * h[2];
+		if (fabs(a) < DOUBLE_NUMERICAL_THRESHHOLD) {
+			return false;
+		}
+		double f = 1 / a;
+		double s[3] = { src.x - v0[0], src.y - v0[1], src.z - v0[2] };
+		double u = f * (s[0] * h[0] + s[1] * h[1] + s[2] * h[2]);
+		if (u < 0.0 || u > 1.0) {
+			return false;
+		}
+		double q[3] = {	s[1] * e1[2] - s[2] * e1[1],
+						s[2] * e1[0] - s[0] * e1[2],
+						s[0] * e1[1] - s[1] * e1[0] };
+		double v = f * (dir.x * q[0] + dir.y * q[1] + dir.z * q[2]);
+		if (v < 0.0 || u + v > 1.0) {
+			return false;
+		}
+		double t = f * (e2[0] * q[0] + e2[1] * q[1] + e2[2] * q[2]);
+		if (t <= DOUBLE_NUMERICAL_THRESHHOLD || t >= maxTime) {
+			return false;
+		}
+		time = t;
+		return true;
+	}
+};
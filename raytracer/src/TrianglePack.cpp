@@ -0,0 +1,191 @@
+#include "TrianglePack.h"
+
+#include <float.h>
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define TARGET_AVX
+#else
+#define TARGET_AVX __attribute__((target("avx")))
+#endif
+
+// Slack of the float test on the barycentric coordinates and on the hit time.
+// Anything the double test could accept has to pass. The rounding error of the barycentric coordinates
+// is about 6e-8 times the distance from the ray source to the pack over the size of the triangle,
+// since the pack and the ray source are both relative to the origin of the pack.
+#define PACK_UV_EPSILON		1e-4f
+#define PACK_TIME_EPSILON	1e-3f
+
+void TrianglePackT::clear(const MPoint& packOrigin)
+{
+	for (int a = 0; a < 3; ++a)
+	{
+		origin[a] = packOrigin[a];
+		for (int l = 0; l < TRIANGLE_PACK_WIDTH; ++l)
+		{
+			v0[a][l] = e1[a][l] = e2[a][l] = 0;
+		}
+	}
+}
+
+void TrianglePackT::set(int lane, const TriangleT& triangle)
+{
+	for (int a = 0; a < 3; ++a)
+	{
+		v0[a][lane] = (float) (triangle.v0[a] - origin[a]);
+		e1[a][lane] = (float) triangle.e1[a];
+		e2[a][lane] = (float) triangle.e2[a];
+	}
+}
+
+static int scalarKernel(const TrianglePackT& p, const PackRayT& ray)
+{
+	const float* o = ray.src;
+	const float* d = ray.dir;
+	int mask = 0;
+	for (int l = 0; l < TRIANGLE_PACK_WIDTH; ++l)
+	{
+		float hx = d[1] * p.e2[2][l] - d[2] * p.e2[1][l];
+		float hy = d[2] * p.e2[0][l] - d[0] * p.e2[2][l];
+		float hz = d[0] * p.e2[1][l] - d[1] * p.e2[0][l];
+		float a = p.e1[0][l] * hx + p.e1[1][l] * hy + p.e1[2][l] * hz;
+		if (a == 0) {
+			continue;
+		}
+		float f = 1 / a;
+		float sx = o[0] - p.v0[0][l];
+		float sy = o[1] - p.v0[1][l];
+		float sz = o[2] - p.v0[2][l];
+		float u = f * (sx * hx + sy * hy + sz * hz);
+		float qx = sy * p.e1[2][l] - sz * p.e1[1][l];
+		float qy = sz * p.e1[0][l] - sx * p.e1[2][l];
+		float qz = sx * p.e1[1][l] - sy * p.e1[0][l];
+		float v = f * (d[0] * qx + d[1] * qy + d[2] * qz);
+		float t = f * (p.e2[0][l] * qx + p.e2[1][l] * qy + p.e2[2][l] * qz);
+		if (u >= -PACK_UV_EPSILON && v >= -PACK_UV_EPSILON && u + v <= 1 + PACK_UV_EPSILON
+			&& t > -PACK_TIME_EPSILON && t < ray.maxTime)
+		{
+			mask |= 1 << l;
+		}
+	}
+	return mask;
+}
+
+// One half of the pack, starting at lane first
+static inline int sseKernel4(const TrianglePackT& p, const PackRayT& ray, int first)
+{
+	__m128 dx = _mm_set1_ps(ray.dir[0]), dy = _mm_set1_ps(ray.dir[1]), dz = _mm_set1_ps(ray.dir[2]);
+	__m128 e1x = _mm_loadu_ps(&p.e1[0][first]), e1y = _mm_loadu_ps(&p.e1[1][first]), e1z = _mm_loadu_ps(&p.e1[2][first]);
+	__m128 e2x = _mm_loadu_ps(&p.e2[0][first]), e2y = _mm_loadu_ps(&p.e2[1][first]), e2z = _mm_loadu_ps(&p.e2[2][first]);
+
+	__m128 hx = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+	__m128 hy = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+	__m128 hz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+	__m128 a = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, hx), _mm_mul_ps(e1y, hy)), _mm_mul_ps(e1z, hz));
+	__m128 f = _mm_div_ps(_mm_set1_ps(1), a);
+
+	__m128 sx = _mm_sub_ps(_mm_set1_ps(ray.src[0]), _mm_loadu_ps(&p.v0[0][first]));
+	__m128 sy = _mm_sub_ps(_mm_set1_ps(ray.src[1]), _mm_loadu_ps(&p.v0[1][first]));
+	__m128 sz = _mm_sub_ps(_mm_set1_ps(ray.src[2]), _mm_loadu_ps(&p.v0[2][first]));
+	__m128 u = _mm_mul_ps(f, _mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, hx), _mm_mul_ps(sy, hy)), _mm_mul_ps(sz, hz)));
+
+	__m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+	__m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+	__m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+	__m128 v = _mm_mul_ps(f, _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)));
+	__m128 t = _mm_mul_ps(f, _mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)));
+
+	// Ordered compares, so the NaNs of degenerate lanes fail
+	__m128 eps = _mm_set1_ps(-PACK_UV_EPSILON);
+	__m128 hit = _mm_cmpneq_ps(a, _mm_setzero_ps());
+	hit = _mm_and_ps(hit, _mm_cmpge_ps(u, eps));
+	hit = _mm_and_ps(hit, _mm_cmpge_ps(v, eps));
+	hit = _mm_and_ps(hit, _mm_cmple_ps(_mm_add_ps(u, v), _mm_set1_ps(1 + PACK_UV_EPSILON)));
+	hit = _mm_and_ps(hit, _mm_cmpgt_ps(t, _mm_set1_ps(-PACK_TIME_EPSILON)));
+	hit = _mm_and_ps(hit, _mm_cmplt_ps(t, _mm_set1_ps(ray.maxTime)));
+	return _mm_movemask_ps(hit);
+}
+
+static int sseKernel(const TrianglePackT& p, const PackRayT& ray)
+{
+	return sseKernel4(p, ray, 0) | (sseKernel4(p, ray, 4) << 4);
+}
+
+TARGET_AVX static int avxKernel(const TrianglePackT& p, const PackRayT& ray)
+{
+	__m256 dx = _mm256_set1_ps(ray.dir[0]), dy = _mm256_set1_ps(ray.dir[1]), dz = _mm256_set1_ps(ray.dir[2]);
+	__m256 e1x = _mm256_loadu_ps(p.e1[0]), e1y = _mm256_loadu_ps(p.e1[1]), e1z = _mm256_loadu_ps(p.e1[2]);
+	__m256 e2x = _mm256_loadu_ps(p.e2[0]), e2y = _mm256_loadu_ps(p.e2[1]), e2z = _mm256_loadu_ps(p.e2[2]);
+
+	__m256 hx = _mm256_sub_ps(_mm256_mul_ps(dy, e2z), _mm256_mul_ps(dz, e2y));
+	__m256 hy = _mm256_sub_ps(_mm256_mul_ps(dz, e2x), _mm256_mul_ps(dx, e2z));
+	__m256 hz = _mm256_sub_ps(_mm256_mul_ps(dx, e2y), _mm256_mul_ps(dy, e2x));
+	__m256 a = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1x, hx), _mm256_mul_ps(e1y, hy)), _mm256_mul_ps(e1z, hz));
+	__m256 f = _mm256_div_ps(_mm256_set1_ps(1), a);
+
+	__m256 sx = _mm256_sub_ps(_mm256_set1_ps(ray.src[0]), _mm256_loadu_ps(p.v0[0]));
+	__m256 sy = _mm256_sub_ps(_mm256_set1_ps(ray.src[1]), _mm256_loadu_ps(p.v0[1]));
+	__m256 sz = _mm256_sub_ps(_mm256_set1_ps(ray.src[2]), _mm256_loadu_ps(p.v0[2]));
+	__m256 u = _mm256_mul_ps(f, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(sx, hx), _mm256_mul_ps(sy, hy)), _mm256_mul_ps(sz, hz)));
+
+	__m256 qx = _mm256_sub_ps(_mm256_mul_ps(sy, e1z), _mm256_mul_ps(sz, e1y));
+	__m256 qy = _mm256_sub_ps(_mm256_mul_ps(sz, e1x), _mm256_mul_ps(sx, e1z));
+	__m256 qz = _mm256_sub_ps(_mm256_mul_ps(sx, e1y), _mm256_mul_ps(sy, e1x));
+	__m256 v = _mm256_mul_ps(f, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, qx), _mm256_mul_ps(dy, qy)), _mm256_mul_ps(dz, qz)));
+	__m256 t = _mm256_mul_ps(f, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2x, qx), _mm256_mul_ps(e2y, qy)), _mm256_mul_ps(e2z, qz)));
+
+	__m256 eps = _mm256_set1_ps(-PACK_UV_EPSILON);
+	__m256 hit = _mm256_cmp_ps(a, _mm256_setzero_ps(), _CMP_NEQ_OQ);
+	hit = _mm256_and_ps(hit, _mm256_cmp_ps(u, eps, _CMP_GE_OQ));
+	hit = _mm256_and_ps(hit, _mm256_cmp_ps(v, eps, _CMP_GE_OQ));
+	hit = _mm256_and_ps(hit, _mm256_cmp_ps(_mm256_add_ps(u, v), _mm256_set1_ps(1 + PACK_UV_EPSILON), _CMP_LE_OQ));
+	hit = _mm256_and_ps(hit, _mm256_cmp_ps(t, _mm256_set1_ps(-PACK_TIME_EPSILON), _CMP_GT_OQ));
+	hit = _mm256_and_ps(hit, _mm256_cmp_ps(t, _mm256_set1_ps(ray.maxTime), _CMP_LT_OQ));
+	return _mm256_movemask_ps(hit);
+}
+
+namespace trianglePack
+{
+	KernelType detectKernel()
+	{
+#if defined(_MSC_VER)
+		int info[4];
+		__cpuid(info, 1);
+		bool osSavesYmm = (info[2] & (1 << 27)) && ((_xgetbv(0) & 6) == 6);
+		if (osSavesYmm && (info[2] & (1 << 28))) {
+			return AVX;
+		}
+		return (info[3] & (1 << 26)) ? SSE : SCALAR;
+#else
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx")) {
+			return AVX;
+		}
+		return __builtin_cpu_supports("sse2") ? SSE : SCALAR;
+#endif
+	}
+
+	TrianglePackKernel kernel(KernelType type)
+	{
+		switch (type) {
+		case AVX:
+			return avxKernel;
+		case SSE:
+			return sseKernel;
+		default:
+			return scalarKernel;
+		}
+	}
+
+	const char* kernelName(KernelType type)
+	{
+		switch (type) {
+		case AVX:
+			return "avx";
+		case SSE:
+			return "sse";
+		default:
+			return "scalar";
+		}
+	}
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "Triangle.h"
+
+#define		TRIANGLE_PACK_WIDTH		8
+
+// Eight triangles in single precision, laid out as structure of arrays so that one ray
+// can be tested against all of them with SSE (two halves) or AVX (all eight at once).
+// Unused lanes are degenerate and never hit.
+// The first vertices are relative to the origin of the pack, the corner of its cell, so that they
+// keep their precision far away from the world origin.
+struct TrianglePackT
+{
+	double	origin[3];
+	float	v0[3][TRIANGLE_PACK_WIDTH];
+	float	e1[3][TRIANGLE_PACK_WIDTH];
+	float	e2[3][TRIANGLE_PACK_WIDTH];
+
+	void	clear(const MPoint& packOrigin);
+	void	set(int lane, const TriangleT& triangle);
+};
+
+// Ray in single precision as the pack kernels read it. The source is relative to the origin of the pack.
+struct PackRayT
+{
+	float	src[3];
+	float	dir[3];
+	float	maxTime;
+
+	// Subtracts in double before rounding, the rounding error then only grows with the distance to the pack
+	inline void setSource(const MPoint& raySource, const TrianglePackT& pack)
+	{
+		for (int a = 0; a < 3; ++a) {
+			src[a] = (float) (raySource[a] - pack.origin[a]);
+		}
+	}
+};
+
+// Returns the mask of the lanes the ray may hit. The test is done in float with some slack,
+// so a set bit is only a candidate that has to be confirmed with TriangleT::intersect,
+// while a cleared bit is a sure miss.
+typedef int (*TrianglePackKernel)(const TrianglePackT& pack, const PackRayT& ray);
+
+namespace trianglePack
+{
+	enum KernelType { SCALAR, SSE, AVX };
+
+	// Best kernel the CPU running us supports
+	KernelType			detectKernel();
+	TrianglePackKernel	kernel(KernelType type);
+	const char*			kernelName(KernelType type);
+}
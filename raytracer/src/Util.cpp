@@ -1,6 +1,7 @@
 #include "Util.h"
 
 #include <math.h>
+#include <algorithm>
 #include <stdio.h>
 
 namespace util 
@@ -320,6 +321,7 @@ namespace util
 			return false;
 		}
 	}
+
 		
 	void calculateBaricentricCoordinates(const MPointArray& triangleVertices, const MPoint& point, double baricentricCoords[3] )
 	{
@@ -364,6 +366,12 @@ namespace util
 		return (lightDir + viewdDir).normal();
 	}
 
+	// Rec. 709 luma of a linear color
+	float luminance(float r, float g, float b)
+	{
+		return 0.2126f * r + 0.7152f * g + 0.0722f * b;
+	}
+
 	MColor sumColors( const MColor& c1 , const MColor& c2 )
 	{
 		MColor res;
@@ -452,6 +460,18 @@ namespace util
 		return true;
 	}
 
+	// Largest ratio of a channel variance to the bound varianceIsSmallEnough checks it against,
+	// below 1 exactly when the variance is small enough
+	double varianceErrorRatio(MColor colorVariance, int numSamples, double thresh, double errorProbability)
+	{
+		double bound = thresh * Chi2Inv::chi2inv(errorProbability, std::max(1, numSamples));
+		double ratio = 0;
+		for (int i = 0; i < 4; i++) {
+			ratio = std::max(ratio, colorVariance[i] / bound);
+		}
+		return ratio;
+	}
+
 
 //scary
 #pragma region 
@@ -650,12 +670,10 @@ namespace util
 	}
 
 
+	// Called from the parallel voxel binning, so it must not touch the (not thread safe) Profiler
 	bool triangleBoxOverlap( const MPoint& center , const double boxhalfsize[3], const MPointArray& triangleVertices)
 	{
-		Profiler::startTimer("SELF::triangleBoxOverlap");
-		bool res = inner_triangleBoxOverlap(center, boxhalfsize, triangleVertices);
-		Profiler::finishTimer("SELF::triangleBoxOverlap");
-		return res;
+		return inner_triangleBoxOverlap(center, boxhalfsize, triangleVertices);
 	}
 
 	
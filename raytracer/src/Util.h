@@ -40,8 +40,8 @@ namespace util
 	MString							vectorToString(MVector p);
 	MString							colorToString(MColor c);
 	pair<MPoint, MPoint>			computeWfAxisAlignedBoundingBox(MDagPath meshPath, MStatus* statusPtr = NULL);
-	inline double					minimize(double* oldPtr, double newVal);
-	inline double					maximize(double* oldPtr, double newVal);
+	double							minimize(double* oldPtr, double newVal);
+	double							maximize(double* oldPtr, double newVal);
 
 	bool							valueInInterval(double value, double intervalMin, double intervalMax);
 	bool							intervalsOverlap(double x1, double y1, double x2, double y2);
@@ -64,6 +64,7 @@ namespace util
 	//bool							getLambertShaderTexture(MFnLambertShader& lambert, MImage& img);
 
 	MColor							sumColors(const MColor& c1 , const MColor& c2);
+	float							luminance(float r, float g, float b);
 	MColor							textureNearesNeighborAtPoint(const MImage* texture, double u, double v, bool repeat = true);
 	MColor							getBilinearFilteredPixelColor(const MImage* texture, double u, double v);
 
@@ -75,5 +76,6 @@ namespace util
 	MColor							nextColorVariance(MColor prevVariance, MColor prevExpectation, MColor nextExpectation, int numSamples, MColor lastSample);
 	MColor							nextColorAverage(MColor prevAverage, int numSamples, MColor lastSample) ;
 	bool							varianceIsSmallEnough(MColor colorVariance, int numSamples, double thresh, double errorProbability);
+	double							varianceErrorRatio(MColor colorVariance, int numSamples, double thresh, double errorProbability);
 };
 
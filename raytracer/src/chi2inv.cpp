@@ -1,5 +1,7 @@
 #include "chi2inv.h"
 
+#include <math.h>
+
 static void chi2invTable(vector<vector<double>>& chi2inv);
 static vector<vector<double>> initializeChi2InvVector();
 
@@ -1,4 +1,4 @@
-#include "raytracer.h"
+#include "RayTracer.h"
 
 #include <maya/MFnPlugin.h>
 
@@ -33,6 +33,9 @@ MStatus uninitializePlugin(MObject obj)
 {
 	MFnPlugin plugin(obj);
 
+	RayTracer::releaseResidentScene();
+	RayTracer::releaseMeshHashes();
+
 	MStatus status = plugin.deregisterCommand("r");
 	status = plugin.deregisterCommand("raytrace");
 	CHECK_MSTATUS_AND_RETURN_IT(status);
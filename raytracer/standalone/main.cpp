@@ -0,0 +1,99 @@
+// Renders a scene file without Maya:
+//
+//	raytrace <scene file> [flags]
+//
+// The flags are the ones of the raytrace command in Maya, see RayTracer::newSyntax. The scene file
+// names the OBJ meshes, the camera and the lights, see RayTracer::loadSceneFile. The image goes to
+// the file -o names, by default to a PNG named like the scene file in the current directory, and
+// the statistics to the file -sp names, by default to a .stat.txt file next to the image.
+
+#include <string.h>
+#include <string>
+#include "RayTracer.h"
+
+MStatus initializePlugin(MObject obj);
+
+// The argument as a double quoted MEL string
+static MString quoted(const char* arg)
+{
+	std::string text = "\"";
+	for (const char* p = arg; *p != '\0'; ++p)
+	{
+		if (*p == '"' || *p == '\\') {
+			text += '\\';
+		}
+		text += *p;
+	}
+	text += '"';
+	return MString(text.c_str());
+}
+
+static std::string defaultOutputPath(const char* scenePath)
+{
+	std::string name(scenePath);
+	size_t slash = name.find_last_of("/\\");
+	if (slash != std::string::npos) {
+		name = name.substr(slash + 1);
+	}
+	size_t dot = name.rfind('.');
+	if (dot != std::string::npos && dot > 0) {
+		name = name.substr(0, dot);
+	}
+	return name + ".png";
+}
+
+static std::string defaultStatisticsPath(const std::string& outputPath)
+{
+	std::string name(outputPath);
+	size_t slash = name.find_last_of("/\\");
+	size_t dot = name.rfind('.');
+	if (dot != std::string::npos && (slash == std::string::npos || dot > slash + 1)) {
+		name = name.substr(0, dot);
+	}
+	return name + ".stat.txt";
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc < 2 || argv[1][0] == '-')
+	{
+		cerr << "usage: " << argv[0] << " <scene file> [raytrace flags]" << endl;
+		return 2;
+	}
+
+	MObject plugin;
+	MStatus status = initializePlugin(plugin);
+	if (!status) {
+		return 1;
+	}
+
+	MString command = "raytrace ";
+	command += sceneFileFlag;
+	command += " " + quoted(argv[1]);
+	std::string outputPath;
+	bool hasStatistics = false;
+	for (int i = 2; i < argc; ++i)
+	{
+		if ((strcmp(argv[i], outputFlag) == 0 || strcmp(argv[i], "-output") == 0) && i + 1 < argc) {
+			outputPath = argv[i + 1];
+		}
+		hasStatistics = hasStatistics || strcmp(argv[i], statisticsFlag) == 0 || strcmp(argv[i], "-statistics") == 0;
+		command += " " + quoted(argv[i]);
+	}
+	if (outputPath.empty())
+	{
+		outputPath = defaultOutputPath(argv[1]);
+		command += " ";
+		command += outputFlag;
+		command += " " + quoted(outputPath.c_str());
+	}
+	if (!hasStatistics)
+	{
+		command += " ";
+		command += statisticsFlag;
+		command += " " + quoted(defaultStatisticsPath(outputPath).c_str());
+	}
+
+	status = MGlobal::executeCommand(command, true);
+	return status ? 0 : 1;
+}
@@ -0,0 +1,479 @@
+#include "MayaShim.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <map>
+#include <sys/time.h>
+
+#pragma region STRINGS
+MString& MString::operator+=(double value)
+{
+	char text[64];
+	sprintf(text, "%g", value);
+	s += text;
+	return *this;
+}
+
+MString& MString::operator+=(int value)
+{
+	char text[32];
+	sprintf(text, "%d", value);
+	s += text;
+	return *this;
+}
+
+MString& MString::operator+=(unsigned int value)
+{
+	char text[32];
+	sprintf(text, "%u", value);
+	s += text;
+	return *this;
+}
+
+MString MString::toLowerCase() const
+{
+	std::string lower(s);
+	for (size_t i = 0; i < lower.size(); ++i) {
+		lower[i] = (char) tolower((unsigned char) lower[i]);
+	}
+	return MString(lower.c_str());
+}
+
+bool MString::isInt() const
+{
+	char* end = NULL;
+	strtol(s.c_str(), &end, 10);
+	return !s.empty() && *end == '\0';
+}
+
+bool MString::isDouble() const
+{
+	char* end = NULL;
+	strtod(s.c_str(), &end);
+	return !s.empty() && *end == '\0';
+}
+#pragma endregion
+
+#pragma region TIMER
+static double wallSeconds()
+{
+	timeval now;
+	gettimeofday(&now, NULL);
+	return now.tv_sec + now.tv_usec * 1e-6;
+}
+
+void MTimer::beginTimer()
+{
+	start = end = wallSeconds();
+}
+
+void MTimer::endTimer()
+{
+	end = wallSeconds();
+}
+#pragma endregion
+
+#pragma region IMAGE
+MStatus MImage::create(unsigned int width, unsigned int height, unsigned int channels, MPixelType type)
+{
+	if (channels != 4 || type != kByte) {
+		return MS::kNotImplemented;
+	}
+	w = width;
+	h = height;
+	bytes.assign((size_t) width * height * 4, 0);
+	return MS::kSuccess;
+}
+
+MStatus MImage::setPixels(unsigned char* pixels, unsigned int width, unsigned int height)
+{
+	w = width;
+	h = height;
+	bytes.assign(pixels, pixels + (size_t) width * height * 4);
+	return MS::kSuccess;
+}
+
+// Skips whitespace and comments between the fields of a PPM header
+static bool readHeaderNumber(FILE* file, int& value)
+{
+	int c = fgetc(file);
+	while (c != EOF && (isspace(c) || c == '#'))
+	{
+		if (c == '#') {
+			while (c != EOF && c != '\n') {
+				c = fgetc(file);
+			}
+		}
+		c = fgetc(file);
+	}
+	if (c == EOF || !isdigit(c)) {
+		return false;
+	}
+	value = 0;
+	while (c != EOF && isdigit(c))
+	{
+		value = value * 10 + (c - '0');
+		c = fgetc(file);
+	}
+	return true;
+}
+
+MStatus MImage::readFromFile(MString pathName, MPixelType type)
+{
+	if (type != kByte) {
+		return MS::kNotImplemented;
+	}
+	FILE* file = fopen(pathName.asChar(), "rb");
+	if (file == NULL) {
+		return MS::kNotFound;
+	}
+	int width = 0, height = 0, maxValue = 0;
+	bool ok = fgetc(file) == 'P' && fgetc(file) == '6' && readHeaderNumber(file, width) && readHeaderNumber(file, height)
+		&& readHeaderNumber(file, maxValue) && width > 0 && height > 0 && maxValue > 0 && maxValue < 256;
+	std::vector<unsigned char> rgb;
+	if (ok)
+	{
+		rgb.resize((size_t) width * height * 3);
+		ok = fread(&rgb[0], 1, rgb.size(), file) == rgb.size();
+	}
+	fclose(file);
+	if (!ok) {
+		return MS::kFailure;
+	}
+
+	// PPM rows go from the top down
+	create(width, height);
+	for (int y = 0; y < height; ++y)
+	{
+		const unsigned char* src = &rgb[(size_t) (height - 1 - y) * width * 3];
+		unsigned char* dst = &bytes[(size_t) y * width * 4];
+		for (int x = 0; x < width; ++x)
+		{
+			for (int c = 0; c < 3; ++c) {
+				dst[x * 4 + c] = (unsigned char) (src[x * 3 + c] * 255 / maxValue);
+			}
+			dst[x * 4 + 3] = 255;
+		}
+	}
+	return MS::kSuccess;
+}
+
+MStatus MImage::writeToFile(MString, MString) const
+{
+	return MS::kNotImplemented;
+}
+#pragma endregion
+
+#pragma region COMMANDS
+MString MArgList::asString(unsigned int index, MStatus* status) const
+{
+	if (index >= args.size())
+	{
+		if (status) *status = MS::kInvalidParameter;
+		return MString();
+	}
+	if (status) *status = MS::kSuccess;
+	return args[index];
+}
+
+MStatus MSyntax::addFlag(const char* shortName, const char* longName, MArgType argType1, MArgType argType2,
+	MArgType argType3, MArgType argType4, MArgType argType5, MArgType argType6)
+{
+	if (flag(shortName) != NULL || flag(longName) != NULL) {
+		return MS::kInvalidParameter;
+	}
+	FlagT f;
+	f.shortName = shortName;
+	f.longName = longName;
+	MArgType types[] = { argType1, argType2, argType3, argType4, argType5, argType6 };
+	for (int i = 0; i < 6 && types[i] != kNoArg; ++i) {
+		f.argTypes.push_back(types[i]);
+	}
+	flags.push_back(f);
+	return MS::kSuccess;
+}
+
+const MSyntax::FlagT* MSyntax::flag(const char* name) const
+{
+	for (size_t i = 0; i < flags.size(); ++i)
+	{
+		if (flags[i].shortName == name || flags[i].longName == name) {
+			return &flags[i];
+		}
+	}
+	return NULL;
+}
+
+static bool isBoolean(const MString& arg)
+{
+	MString value = arg.toLowerCase();
+	return value == "true" || value == "on" || value == "yes" || value == "1"
+		|| value == "false" || value == "off" || value == "no" || value == "0";
+}
+
+static bool fitsType(const MString& arg, MSyntax::MArgType type)
+{
+	switch (type) {
+	case MSyntax::kBoolean:
+		return isBoolean(arg);
+	case MSyntax::kLong:
+	case MSyntax::kUnsigned:
+		return arg.isInt();
+	case MSyntax::kDouble:
+	case MSyntax::kDistance:
+	case MSyntax::kAngle:
+	case MSyntax::kTime:
+		return arg.isDouble();
+	default:
+		return true;
+	}
+}
+
+MArgParser::MArgParser(const MSyntax& syntax, const MArgList& args, MStatus* status)
+{
+	MStatus result = MS::kSuccess;
+	for (unsigned int i = 0; i < args.length(); )
+	{
+		MString name = args.asString(i++);
+		const MSyntax::FlagT* flag = syntax.flag(name.asChar());
+		if (flag == NULL)
+		{
+			MGlobal::displayError("Invalid flag: " + name);
+			result = MS::kInvalidParameter;
+			break;
+		}
+		if (i + flag->argTypes.size() > args.length())
+		{
+			MString message = "Flag " + name + " needs ";
+			message += (unsigned int) flag->argTypes.size();
+			message += " arguments";
+			MGlobal::displayError(message);
+			result = MS::kInvalidParameter;
+			break;
+		}
+		FlagArgsT parsedFlag;
+		parsedFlag.flag = *flag;
+		for (size_t a = 0; a < flag->argTypes.size(); ++a)
+		{
+			MString arg = args.asString(i++);
+			if (!fitsType(arg, flag->argTypes[a]))
+			{
+				MGlobal::displayError("Invalid argument for flag " + name + ": " + arg);
+				result = MS::kInvalidParameter;
+			}
+			parsedFlag.args.push_back(arg);
+		}
+		if (!result) {
+			break;
+		}
+		parsed.push_back(parsedFlag);
+	}
+	if (status) *status = result;
+}
+
+const MArgParser::FlagArgsT* MArgParser::find(const char* name) const
+{
+	// The last one counts when a flag is given twice
+	for (size_t i = parsed.size(); i-- > 0; )
+	{
+		if (parsed[i].flag.shortName == name || parsed[i].flag.longName == name) {
+			return &parsed[i];
+		}
+	}
+	return NULL;
+}
+
+bool MArgParser::isFlagSet(const char* name, MStatus* status) const
+{
+	if (status) *status = MS::kSuccess;
+	return find(name) != NULL;
+}
+
+MStatus MArgParser::argument(const char* name, unsigned int index, MSyntax::MArgType& type, MString& arg) const
+{
+	const FlagArgsT* f = find(name);
+	if (f == NULL || index >= f->args.size()) {
+		return MS::kFailure;
+	}
+	type = f->flag.argTypes[index];
+	arg = f->args[index];
+	return MS::kSuccess;
+}
+
+MStatus MArgParser::getFlagArgument(const char* name, unsigned int index, bool& result) const
+{
+	MSyntax::MArgType type;
+	MString arg;
+	if (!argument(name, index, type, arg)) {
+		return MS::kFailure;
+	}
+	if (!isBoolean(arg)) {
+		return MS::kInvalidParameter;
+	}
+	MString value = arg.toLowerCase();
+	result = value == "true" || value == "on" || value == "yes" || value == "1";
+	return MS::kSuccess;
+}
+
+MStatus MArgParser::getFlagArgument(const char* name, unsigned int index, int& result) const
+{
+	MSyntax::MArgType type;
+	MString arg;
+	if (!argument(name, index, type, arg)) {
+		return MS::kFailure;
+	}
+	if (!arg.isInt()) {
+		return MS::kInvalidParameter;
+	}
+	result = arg.asInt();
+	return MS::kSuccess;
+}
+
+MStatus MArgParser::getFlagArgument(const char* name, unsigned int index, unsigned int& result) const
+{
+	int value;
+	MStatus status = getFlagArgument(name, index, value);
+	if (status) {
+		result = (unsigned int) value;
+	}
+	return status;
+}
+
+MStatus MArgParser::getFlagArgument(const char* name, unsigned int index, double& result) const
+{
+	MSyntax::MArgType type;
+	MString arg;
+	if (!argument(name, index, type, arg)) {
+		return MS::kFailure;
+	}
+	if (!arg.isDouble()) {
+		return MS::kInvalidParameter;
+	}
+	result = arg.asDouble();
+	return MS::kSuccess;
+}
+
+MStatus MArgParser::getFlagArgument(const char* name, unsigned int index, MString& result) const
+{
+	MSyntax::MArgType type;
+	return argument(name, index, type, result);
+}
+
+struct RegisteredCommandT
+{
+	void*	(*creator)();
+	MSyntax	(*createSyntax)();
+};
+
+static std::map<std::string, RegisteredCommandT>& registeredCommands()
+{
+	static std::map<std::string, RegisteredCommandT> commands;
+	return commands;
+}
+
+MFnPlugin::MFnPlugin(MObject&, const char*, const char*, const char*, MStatus* status)
+{
+	if (status) *status = MS::kSuccess;
+}
+
+MStatus MFnPlugin::registerCommand(const MString& commandName, void* (*creator)(), MSyntax (*createSyntax)())
+{
+	RegisteredCommandT command = { creator, createSyntax };
+	registeredCommands()[commandName.asChar()] = command;
+	return MS::kSuccess;
+}
+
+MStatus MFnPlugin::deregisterCommand(const MString& commandName)
+{
+	return registeredCommands().erase(commandName.asChar()) > 0 ? MS::kSuccess : MS::kFailure;
+}
+
+void MGlobal::displayInfo(const MString& message)
+{
+	cerr << message << endl;
+}
+
+void MGlobal::displayWarning(const MString& message)
+{
+	cerr << "Warning: " << message << endl;
+}
+
+void MGlobal::displayError(const MString& message)
+{
+	cerr << "Error: " << message << endl;
+}
+
+// Words of a line of MEL. Double quotes group words and \ escapes the next character in them.
+static bool splitCommand(const char* line, std::vector<std::string>& words)
+{
+	const char* p = line;
+	while (true)
+	{
+		while (isspace((unsigned char) *p)) {
+			++p;
+		}
+		if (*p == '\0' || *p == ';') {
+			return true;
+		}
+		std::string word;
+		if (*p == '"')
+		{
+			for (++p; *p != '"'; ++p)
+			{
+				if (*p == '\\' && p[1] != '\0') {
+					++p;
+				}
+				if (*p == '\0') {
+					return false;
+				}
+				word += *p;
+			}
+			++p;
+		}
+		else
+		{
+			while (*p != '\0' && *p != ';' && !isspace((unsigned char) *p)) {
+				word += *p++;
+			}
+		}
+		words.push_back(word);
+	}
+}
+
+MStatus MGlobal::executeCommand(const MString& command, bool displayEnabled, bool)
+{
+	std::vector<std::string> words;
+	if (!splitCommand(command.asChar(), words) || words.empty()) {
+		return MS::kInvalidParameter;
+	}
+	std::map<std::string, RegisteredCommandT>::const_iterator it = registeredCommands().find(words[0]);
+	if (it == registeredCommands().end())
+	{
+		if (displayEnabled) {
+			displayError(MString("Cannot find procedure \"") + words[0].c_str() + "\".");
+		}
+		return MS::kNotFound;
+	}
+
+	MArgList args;
+	for (size_t i = 1; i < words.size(); ++i) {
+		args.addArg(words[i].c_str());
+	}
+	MSyntax syntax;
+	if (it->second.createSyntax != NULL) {
+		syntax = it->second.createSyntax();
+	}
+	// Like Maya, a command line that does not fit the syntax never gets to doIt
+	MStatus parsed;
+	MArgParser parser(syntax, args, &parsed);
+	if (!parsed) {
+		return parsed;
+	}
+	MPxCommand* cmd = (MPxCommand*) it->second.creator();
+	cmd->commandSyntax = syntax;
+	MStatus status = cmd->doIt(args);
+	delete cmd;
+	return status;
+}
+#pragma endregion
@@ -0,0 +1,759 @@
+#pragma once
+
+// The part of the Maya API the raytracer uses, for building it without Maya.
+// The value types (points, vectors, colors, matrices, arrays, strings and images) and the command
+// machinery (MArgList, MSyntax, MArgParser, MPxCommand, MFnPlugin) work like Maya's. The scene is
+// empty: the DAG iterators find nothing and the function sets read nothing, so scenes come from the
+// scene file (-sf) only.
+
+#include <math.h>
+#include <float.h>
+#include <string.h>
+#include <stdlib.h>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+using std::cout;
+using std::cerr;
+using std::endl;
+using std::min;
+using std::max;
+
+typedef unsigned int uint;
+
+#pragma region STATUS
+namespace MS
+{
+	enum MStatusCode { kSuccess, kFailure, kInsufficientMemory, kInvalidParameter, kLicenseFailure, kUnknownParameter, kNotImplemented, kNotFound, kEndOfFile };
+}
+
+class MStatus
+{
+public:
+	enum MStatusCode { kSuccess, kFailure, kInsufficientMemory, kInvalidParameter, kLicenseFailure, kUnknownParameter, kNotImplemented, kNotFound, kEndOfFile };
+
+	MStatus() : code(kSuccess) {}
+	MStatus(MStatusCode c) : code(c) {}
+	MStatus(MS::MStatusCode c) : code((MStatusCode) c) {}
+
+	bool operator==(MStatusCode c) const { return code == c; }
+	bool operator!=(MStatusCode c) const { return code != c; }
+	bool operator==(MS::MStatusCode c) const { return code == (MStatusCode) c; }
+	bool operator!=(MS::MStatusCode c) const { return code != (MStatusCode) c; }
+	bool operator==(const MStatus& other) const { return code == other.code; }
+	bool operator!=(const MStatus& other) const { return code != other.code; }
+	operator bool() const { return code == kSuccess; }
+	bool error() const { return code != kSuccess; }
+	MStatusCode statusCode() const { return code; }
+
+private:
+	MStatusCode code;
+};
+
+#define CHECK_MSTATUS(_status) \
+	do { if ((_status) != MS::kSuccess) { cerr << "Status failed in " << __FILE__ << " line " << __LINE__ << endl; } } while (0)
+
+#define CHECK_MSTATUS_AND_RETURN_IT(_status) \
+	do { MStatus _s = (_status); if (_s != MS::kSuccess) { CHECK_MSTATUS(_s); return _s; } } while (0)
+#pragma endregion
+
+#pragma region STRINGS
+class MString
+{
+	std::string s;
+
+public:
+	MString() {}
+	MString(const char* chars) : s(chars ? chars : "") {}
+	MString(const char* chars, int length) : s(chars, length) {}
+
+	MString& operator=(const char* chars) { s = chars ? chars : ""; return *this; }
+	MString& operator+=(const MString& other) { s += other.s; return *this; }
+	MString& operator+=(const char* chars) { s += chars; return *this; }
+	MString& operator+=(double value);
+	MString& operator+=(int value);
+	MString& operator+=(unsigned int value);
+	MString& operator+=(float value) { return *this += (double) value; }
+
+	bool operator==(const MString& other) const { return s == other.s; }
+	bool operator!=(const MString& other) const { return s != other.s; }
+	bool operator==(const char* chars) const { return s == chars; }
+	bool operator!=(const char* chars) const { return s != chars; }
+
+	const char* asChar() const { return s.c_str(); }
+	unsigned int length() const { return (unsigned int) s.size(); }
+	unsigned int numChars() const { return length(); }
+	MString toLowerCase() const;
+	MString substring(int start, int end) const { return MString(s.substr(start, end - start + 1).c_str()); }
+	int index(char c) const { size_t i = s.find(c); return i == std::string::npos ? -1 : (int) i; }
+	int rindex(char c) const { size_t i = s.rfind(c); return i == std::string::npos ? -1 : (int) i; }
+	bool isInt() const;
+	bool isDouble() const;
+	int asInt() const { return atoi(s.c_str()); }
+	double asDouble() const { return atof(s.c_str()); }
+};
+
+inline MString operator+(const MString& a, const MString& b) { MString r(a); r += b; return r; }
+inline MString operator+(const MString& a, const char* b) { MString r(a); r += b; return r; }
+inline MString operator+(const char* a, const MString& b) { MString r(a); r += b; return r; }
+inline std::ostream& operator<<(std::ostream& os, const MString& s) { return os << s.asChar(); }
+
+class MStringArray
+{
+	std::vector<MString> items;
+
+public:
+	unsigned int length() const { return (unsigned int) items.size(); }
+	MStatus setLength(unsigned int n) { items.resize(n); return MS::kSuccess; }
+	MString& operator[](unsigned int i) { return items[i]; }
+	const MString& operator[](unsigned int i) const { return items[i]; }
+	MStatus append(const MString& s) { items.push_back(s); return MS::kSuccess; }
+	MStatus clear() { items.clear(); return MS::kSuccess; }
+};
+#pragma endregion
+
+#pragma region MATH
+class MMatrix
+{
+public:
+	double matrix[4][4];
+
+	MMatrix() { setToIdentity(); }
+	MMatrix& setToIdentity()
+	{
+		for (int r = 0; r < 4; ++r) {
+			for (int c = 0; c < 4; ++c) {
+				matrix[r][c] = (r == c) ? 1 : 0;
+			}
+		}
+		return *this;
+	}
+	double operator()(unsigned int r, unsigned int c) const { return matrix[r][c]; }
+	double& operator()(unsigned int r, unsigned int c) { return matrix[r][c]; }
+	MMatrix operator*(const MMatrix& right) const
+	{
+		MMatrix res;
+		for (int r = 0; r < 4; ++r) {
+			for (int c = 0; c < 4; ++c) {
+				res.matrix[r][c] = 0;
+				for (int k = 0; k < 4; ++k) {
+					res.matrix[r][c] += matrix[r][k] * right.matrix[k][c];
+				}
+			}
+		}
+		return res;
+	}
+};
+
+class MFloatMatrix
+{
+public:
+	float matrix[4][4];
+
+	MFloatMatrix()
+	{
+		for (int r = 0; r < 4; ++r) {
+			for (int c = 0; c < 4; ++c) {
+				matrix[r][c] = (r == c) ? 1.0f : 0.0f;
+			}
+		}
+	}
+	float operator()(unsigned int r, unsigned int c) const { return matrix[r][c]; }
+};
+
+class MPoint;
+
+class MVector
+{
+public:
+	double x, y, z;
+
+	MVector() : x(0), y(0), z(0) {}
+	MVector(double xx, double yy, double zz = 0) : x(xx), y(yy), z(zz) {}
+	MVector(const MPoint& p);
+
+	double& operator[](unsigned int i) { return (&x)[i]; }
+	double operator[](unsigned int i) const { return (&x)[i]; }
+	double operator()(unsigned int i) const { return (&x)[i]; }
+
+	MVector operator+(const MVector& o) const { return MVector(x + o.x, y + o.y, z + o.z); }
+	MVector operator-(const MVector& o) const { return MVector(x - o.x, y - o.y, z - o.z); }
+	MVector operator-() const { return MVector(-x, -y, -z); }
+	MVector operator*(double d) const { return MVector(x * d, y * d, z * d); }
+	MVector operator/(double d) const { return MVector(x / d, y / d, z / d); }
+	double operator*(const MVector& o) const { return x * o.x + y * o.y + z * o.z; }
+	MVector operator^(const MVector& o) const { return MVector(y * o.z - z * o.y, z * o.x - x * o.z, x * o.y - y * o.x); }
+	MVector operator*(const MMatrix& m) const
+	{
+		return MVector(x * m.matrix[0][0] + y * m.matrix[1][0] + z * m.matrix[2][0],
+			x * m.matrix[0][1] + y * m.matrix[1][1] + z * m.matrix[2][1],
+			x * m.matrix[0][2] + y * m.matrix[1][2] + z * m.matrix[2][2]);
+	}
+	MVector& operator+=(const MVector& o) { x += o.x; y += o.y; z += o.z; return *this; }
+	MVector& operator-=(const MVector& o) { x -= o.x; y -= o.y; z -= o.z; return *this; }
+	MVector& operator*=(double d) { x *= d; y *= d; z *= d; return *this; }
+	MVector& operator/=(double d) { x /= d; y /= d; z /= d; return *this; }
+	MVector& operator*=(const MMatrix& m) { return *this = *this * m; }
+	bool operator==(const MVector& o) const { return x == o.x && y == o.y && z == o.z; }
+	bool operator!=(const MVector& o) const { return !(*this == o); }
+
+	double length() const { return sqrt(x * x + y * y + z * z); }
+	MVector normal() const { double l = length(); return (l > 0) ? *this / l : *this; }
+	MStatus normalize() { *this = normal(); return MS::kSuccess; }
+	double angle(const MVector& o) const
+	{
+		double l = length() * o.length();
+		return (l > 0) ? acos(std::max(-1.0, std::min(1.0, (*this * o) / l))) : 0;
+	}
+	bool isEquivalent(const MVector& o, double tolerance = 1e-10) const { return (*this - o).length() <= tolerance; }
+};
+
+inline MVector operator*(double d, const MVector& v) { return v * d; }
+
+class MPoint
+{
+public:
+	double x, y, z, w;
+
+	MPoint() : x(0), y(0), z(0), w(1) {}
+	MPoint(double xx, double yy, double zz = 0, double ww = 1) : x(xx), y(yy), z(zz), w(ww) {}
+	MPoint(const MVector& v) : x(v.x), y(v.y), z(v.z), w(1) {}
+
+	double& operator[](unsigned int i) { return (&x)[i]; }
+	double operator[](unsigned int i) const { return (&x)[i]; }
+
+	MVector operator-(const MPoint& o) const { return MVector(x - o.x, y - o.y, z - o.z); }
+	MPoint operator+(const MVector& v) const { return MPoint(x + v.x, y + v.y, z + v.z, w); }
+	MPoint operator-(const MVector& v) const { return MPoint(x - v.x, y - v.y, z - v.z, w); }
+	MPoint operator+(const MPoint& o) const { return MPoint(x + o.x, y + o.y, z + o.z, w); }
+	MPoint operator*(double d) const { return MPoint(x * d, y * d, z * d, w); }
+	MPoint operator/(double d) const { return MPoint(x / d, y / d, z / d, w); }
+	MPoint operator*(const MMatrix& m) const
+	{
+		MPoint res;
+		for (int c = 0; c < 4; ++c) {
+			res[c] = x * m.matrix[0][c] + y * m.matrix[1][c] + z * m.matrix[2][c] + w * m.matrix[3][c];
+		}
+		return res;
+	}
+	MPoint& operator+=(const MVector& v) { x += v.x; y += v.y; z += v.z; return *this; }
+	MPoint& operator-=(const MVector& v) { x -= v.x; y -= v.y; z -= v.z; return *this; }
+	MPoint& operator*=(const MMatrix& m) { return *this = *this * m; }
+	bool operator==(const MPoint& o) const { return x == o.x && y == o.y && z == o.z && w == o.w; }
+	bool operator!=(const MPoint& o) const { return !(*this == o); }
+
+	double distanceTo(const MPoint& o) const { return (*this - o).length(); }
+	MPoint& cartesianize()
+	{
+		if (w != 0 && w != 1) {
+			x /= w; y /= w; z /= w; w = 1;
+		}
+		return *this;
+	}
+	bool isEquivalent(const MPoint& o, double tolerance = 1e-10) const { return distanceTo(o) <= tolerance; }
+};
+
+inline MVector::MVector(const MPoint& p) : x(p.x), y(p.y), z(p.z) {}
+inline MPoint operator*(double d, const MPoint& p) { return p * d; }
+
+class MFloatVector
+{
+public:
+	float x, y, z;
+
+	MFloatVector() : x(0), y(0), z(0) {}
+	MFloatVector(float xx, float yy, float zz = 0) : x(xx), y(yy), z(zz) {}
+	MFloatVector(const MVector& v) : x((float) v.x), y((float) v.y), z((float) v.z) {}
+	float& operator[](unsigned int i) { return (&x)[i]; }
+	float operator[](unsigned int i) const { return (&x)[i]; }
+};
+
+class MFloatPoint
+{
+public:
+	float x, y, z, w;
+
+	MFloatPoint() : x(0), y(0), z(0), w(1) {}
+	MFloatPoint(float xx, float yy, float zz = 0, float ww = 1) : x(xx), y(yy), z(zz), w(ww) {}
+	float& operator[](unsigned int i) { return (&x)[i]; }
+	float operator[](unsigned int i) const { return (&x)[i]; }
+};
+
+class MColor
+{
+public:
+	float r, g, b, a;
+
+	MColor() : r(0), g(0), b(0), a(1) {}
+	MColor(float rr, float gg, float bb = 0, float aa = 1) : r(rr), g(gg), b(bb), a(aa) {}
+
+	float& operator[](unsigned int i) { return (&r)[i]; }
+	float operator[](unsigned int i) const { return (&r)[i]; }
+
+	// Scaling leaves alpha alone, like Maya does
+	MColor operator*(float d) const { return MColor(r * d, g * d, b * d, a); }
+	MColor operator*(double d) const { return *this * (float) d; }
+	MColor operator/(float d) const { return MColor(r / d, g / d, b / d, a); }
+	MColor operator/(double d) const { return *this / (float) d; }
+	MColor operator*(const MColor& o) const { return MColor(r * o.r, g * o.g, b * o.b, a * o.a); }
+	MColor operator+(const MColor& o) const { return MColor(r + o.r, g + o.g, b + o.b, a + o.a); }
+	MColor operator-(const MColor& o) const { return MColor(r - o.r, g - o.g, b - o.b, a - o.a); }
+	MColor& operator*=(float d) { r *= d; g *= d; b *= d; return *this; }
+	MColor& operator*=(double d) { return *this *= (float) d; }
+	MColor& operator/=(float d) { r /= d; g /= d; b /= d; return *this; }
+	MColor& operator*=(const MColor& o) { r *= o.r; g *= o.g; b *= o.b; a *= o.a; return *this; }
+	MColor& operator+=(const MColor& o) { r += o.r; g += o.g; b += o.b; a += o.a; return *this; }
+	MColor& operator-=(const MColor& o) { r -= o.r; g -= o.g; b -= o.b; a -= o.a; return *this; }
+	bool operator==(const MColor& o) const { return r == o.r && g == o.g && b == o.b && a == o.a; }
+	bool operator!=(const MColor& o) const { return !(*this == o); }
+};
+
+inline MColor operator*(float d, const MColor& c) { return c * d; }
+inline MColor operator*(double d, const MColor& c) { return c * d; }
+
+// Maya's arrays of values: indexed, resizable and appendable
+template <typename T>
+class MShimArray
+{
+	std::vector<T> items;
+
+public:
+	MShimArray() {}
+	MShimArray(unsigned int n, const T& value = T()) : items(n, value) {}
+
+	unsigned int length() const { return (unsigned int) items.size(); }
+	MStatus setLength(unsigned int n) { items.resize(n); return MS::kSuccess; }
+	T& operator[](unsigned int i) { return items[i]; }
+	const T& operator[](unsigned int i) const { return items[i]; }
+	MStatus append(const T& value) { items.push_back(value); return MS::kSuccess; }
+	MStatus set(const T& value, unsigned int i) { items[i] = value; return MS::kSuccess; }
+	MStatus remove(unsigned int i) { items.erase(items.begin() + i); return MS::kSuccess; }
+	MStatus clear() { items.clear(); return MS::kSuccess; }
+};
+
+class MPointArray : public MShimArray<MPoint> {};
+class MVectorArray : public MShimArray<MVector> {};
+class MFloatArray : public MShimArray<float> {};
+class MDoubleArray : public MShimArray<double> {};
+class MIntArray : public MShimArray<int> {};
+class MFloatPointArray : public MShimArray<MFloatPoint> {};
+class MFloatVectorArray : public MShimArray<MFloatVector> {};
+#pragma endregion
+
+#pragma region TIMER
+class MTimer
+{
+	double start;
+	double end;
+
+public:
+	MTimer() : start(0), end(0) {}
+	void beginTimer();
+	void endTimer();
+	double elapsedTime() const { return end - start; }
+	void clear() { start = end = 0; }
+};
+#pragma endregion
+
+#pragma region SCENE
+// Nothing here ever refers to a node of a scene
+namespace MFn
+{
+	enum Type { kInvalid, kBase, kNamedObject, kDependencyNode, kDagNode, kTransform, kShape, kMesh, kCamera, kLight,
+		kAmbientLight, kDirectionalLight, kPointLight, kSpotLight, kAreaLight, kLambert, kReflect, kPhong, kBlinn,
+		kFileTexture, kPluginHwShaderNode };
+}
+
+class MSpace
+{
+public:
+	enum Space { kInvalid, kTransform, kPreTransform, kPostTransform, kWorld, kObject = kPreTransform };
+};
+
+class MObject
+{
+public:
+	bool hasFn(MFn::Type) const { return false; }
+	bool isNull() const { return true; }
+	MFn::Type apiType() const { return MFn::kInvalid; }
+};
+
+class MObjectArray : public MShimArray<MObject> {};
+
+class MObjectHandle
+{
+public:
+	MObjectHandle() {}
+	MObjectHandle(const MObject&) {}
+	bool isValid() const { return false; }
+	bool operator==(const MObject&) const { return false; }
+};
+
+typedef unsigned long long MCallbackId;
+
+// There are no nodes to watch, so no callback is ever added
+class MMessage
+{
+public:
+	static MStatus removeCallback(MCallbackId) { return MS::kSuccess; }
+};
+
+class MNodeMessage : public MMessage
+{
+public:
+	typedef void (*MNodeFunction)(MObject& node, void* clientData);
+
+	static MCallbackId addNodeDirtyCallback(MObject&, MNodeFunction, void* = NULL, MStatus* status = NULL) { if (status) *status = MS::kFailure; return 0; }
+};
+
+class MDagPath
+{
+public:
+	bool hasFn(MFn::Type, MStatus* status = NULL) const { if (status) *status = MS::kSuccess; return false; }
+	MMatrix inclusiveMatrix(MStatus* status = NULL) const { if (status) *status = MS::kSuccess; return MMatrix(); }
+	MObject transform(MStatus* status = NULL) const { if (status) *status = MS::kFailure; return MObject(); }
+	MObject node(MStatus* status = NULL) const { if (status) *status = MS::kFailure; return MObject(); }
+	MString fullPathName(MStatus* status = NULL) const { if (status) *status = MS::kSuccess; return MString(); }
+	MString partialPathName(MStatus* status = NULL) const { if (status) *status = MS::kSuccess; return MString(); }
+	bool isValid(MStatus* status = NULL) const { if (status) *status = MS::kSuccess; return false; }
+};
+
+class MDagPathArray : public MShimArray<MDagPath> {};
+
+class MPlugArray;
+
+class MPlug
+{
+public:
+	MObject node(MStatus* status = NULL) const { if (status) *status = MS::kFailure; return MObject(); }
+	bool connectedTo(MPlugArray& array, bool asDst, bool asSrc, MStatus* status = NULL) const;
+	bool isConnected(MStatus* status = NULL) const { if (status) *status = MS::kSuccess; return false; }
+	MString name(MStatus* status = NULL) const { if (status) *status = MS::kSuccess; return MString(); }
+	MString asString(MStatus* status = NULL) const { if (status) *status = MS::kFailure; return MString(); }
+	double asDouble(MStatus* status = NULL) const { if (status) *status = MS::kFailure; return 0; }
+	float asFloat(MStatus* status = NULL) const { if (status) *status = MS::kFailure; return 0; }
+	int asInt(MStatus* status = NULL) const { if (status) *status = MS::kFailure; return 0; }
+	bool asBool(MStatus* status = NULL) const { if (status) *status = MS::kFailure; return false; }
+	MStatus getValue(MString&) const { return MS::kFailure; }
+};
+
+class MPlugArray : public MShimArray<MPlug> {};
+
+inline bool MPlug::connectedTo(MPlugArray& array, bool, bool, MStatus* status) const
+{
+	array.clear();
+	if (status) *status = MS::kSuccess;
+	return false;
+}
+
+class MFnBase
+{
+	MObject obj;
+
+public:
+	MObject object(MStatus* status = NULL) const { if (status) *status = MS::kSuccess; return obj; }
+	bool hasObj(MFn::Type) const { return false; }
+};
+
+class MFnDependencyNode : public MFnBase
+{
+public:
+	MFnDependencyNode() {}
+	MFnDependencyNode(const MObject&, MStatus* status = NULL) { if (status) *status = MS::kSuccess; }
+	MPlug findPlug(const MString&, MStatus* status = NULL) const { if (status) *status = MS::kInvalidParameter; return MPlug(); }
+	MString name(MStatus* status = NULL) const { if (status) *status = MS::kSuccess; return MString(); }
+	MString typeName(MStatus* status = NULL) const { if (status) *status = MS::kSuccess; return MString(); }
+};
+
+class MFnDagNode : public MFnDependencyNode
+{
+public:
+	MFnDagNode() {}
+	MFnDagNode(const MObject& o, MStatus* status = NULL) : MFnDependencyNode(o, status) {}
+	MFnDagNode(const MDagPath&, MStatus* status = NULL) { if (status) *status = MS::kSuccess; }
+	MMatrix transformationMatrix(MStatus* status = NULL) const { if (status) *status = MS::kSuccess; return MMatrix(); }
+	MString fullPathName(MStatus* status = NULL) const { if (status) *status = MS::kSuccess; return MString(); }
+	MStatus getPath(MDagPath& path) const { path = MDagPath(); return MS::kSuccess; }
+};
+
+class MTransformationMatrix
+{
+	MMatrix m;
+
+public:
+	MTransformationMatrix() {}
+	MTransformationMatrix(const MMatrix& matrix) : m(matrix) {}
+	MMatrix asMatrix() const { return m; }
+};
+
+class MFnTransform : public MFnDagNode
+{
+public:
+	MFnTransform() {}
+	MFnTransform(const MObject& o, MStatus* status = NULL) : MFnDagNode(o, status) {}
+	MFnTransform(const MDagPath& p, MStatus* status = NULL) : MFnDagNode(p, status) {}
+	MTransformationMatrix transformation(MStatus* status = NULL) const { if (status) *status = MS::kSuccess; return MTransformationMatrix(); }
+};
+
+class MFnMesh : public MFnDagNode
+{
+public:
+	MFnMesh() {}
+	MFnMesh(const MObject& o, MStatus* status = NULL) : MFnDagNode(o, status) {}
+	MFnMesh(const MDagPath& p, MStatus* status = NULL) : MFnDagNode(p, status) {}
+
+	int numPolygons(MStatus* status = NULL) const { if (status) *status = MS::kSuccess; return 0; }
+	int numVertices(MStatus* status = NULL) const { if (status) *status = MS::kSuccess; return 0; }
+	int numNormals(MStatus* status = NULL) const { if (status) *status = MS::kSuccess; return 0; }
+	int numUVs(MStatus* status = NULL) const { if (status) *status = MS::kSuccess; return 0; }
+	MStatus getPoints(MPointArray& points, MSpace::Space = MSpace::kObject) const { points.clear(); return MS::kSuccess; }
+	MStatus getNormals(MFloatVectorArray& normals, MSpace::Space = MSpace::kObject) const { normals.clear(); return MS::kSuccess; }
+	MStatus getUVs(MFloatArray& us, MFloatArray& vs, const MString* = NULL) const { us.clear(); vs.clear(); return MS::kSuccess; }
+	MStatus getVertices(MIntArray& counts, MIntArray& ids) const { counts.clear(); ids.clear(); return MS::kSuccess; }
+	MStatus getNormalIds(MIntArray& counts, MIntArray& ids) const { counts.clear(); ids.clear(); return MS::kSuccess; }
+	MStatus getAssignedUVs(MIntArray& counts, MIntArray& ids, const MString* = NULL) const { counts.clear(); ids.clear(); return MS::kSuccess; }
+	MStatus getTriangles(MIntArray& counts, MIntArray& ids) const { counts.clear(); ids.clear(); return MS::kSuccess; }
+	MStatus getTriangleOffsets(MIntArray& counts, MIntArray& offsets) const { counts.clear(); offsets.clear(); return MS::kSuccess; }
+	MStatus getFaceNormalIds(int, MIntArray& ids) const { ids.clear(); return MS::kSuccess; }
+	MStatus getConnectedShaders(unsigned int, MObjectArray& shaders, MIntArray& indices) const { shaders.clear(); indices.clear(); return MS::kSuccess; }
+};
+
+class MItMeshPolygon
+{
+public:
+	MItMeshPolygon(const MDagPath&, MObject = MObject(), MStatus* status = NULL) { if (status) *status = MS::kSuccess; }
+	MItMeshPolygon(const MObject&, MStatus* status = NULL) { if (status) *status = MS::kSuccess; }
+	bool isDone(MStatus* status = NULL) const { if (status) *status = MS::kSuccess; return true; }
+	MStatus next() { return MS::kFailure; }
+	int index(MStatus* status = NULL) const { if (status) *status = MS::kFailure; return -1; }
+	MStatus getPoints(MPointArray& points, MSpace::Space = MSpace::kObject, MStatus* = NULL) const { points.clear(); return MS::kFailure; }
+	MStatus getNormals(MVectorArray& normals, MSpace::Space = MSpace::kObject) const { normals.clear(); return MS::kFailure; }
+	MStatus getUVs(MFloatArray& us, MFloatArray& vs, const MString* = NULL) const { us.clear(); vs.clear(); return MS::kFailure; }
+	MStatus getTriangles(MPointArray& points, MIntArray& ids, MSpace::Space = MSpace::kObject) const { points.clear(); ids.clear(); return MS::kFailure; }
+	MStatus numTriangles(int& count) const { count = 0; return MS::kFailure; }
+};
+
+class MFnCamera : public MFnDagNode
+{
+public:
+	MFnCamera() {}
+	MFnCamera(const MObject& o, MStatus* status = NULL) : MFnDagNode(o, status) {}
+	MFnCamera(const MDagPath& p, MStatus* status = NULL) : MFnDagNode(p, status) {}
+
+	MPoint eyePoint(MSpace::Space = MSpace::kObject, MStatus* = NULL) const { return MPoint(0, 0, 0); }
+	MVector viewDirection(MSpace::Space = MSpace::kObject, MStatus* = NULL) const { return MVector(0, 0, -1); }
+	MVector upDirection(MSpace::Space = MSpace::kObject, MStatus* = NULL) const { return MVector(0, 1, 0); }
+	bool isOrtho(MStatus* = NULL) const { return false; }
+	double orthoWidth(MStatus* = NULL) const { return 30; }
+	double horizontalFilmAperture(MStatus* = NULL) const { return 1.417; }
+	double focalLength(MStatus* = NULL) const { return 35; }
+};
+
+class MFnLight : public MFnDagNode
+{
+public:
+	MFnLight() {}
+	MFnLight(const MObject& o, MStatus* status = NULL) : MFnDagNode(o, status) {}
+	MFnLight(const MDagPath& p, MStatus* status = NULL) : MFnDagNode(p, status) {}
+
+	MColor color(MStatus* = NULL) const { return MColor(1, 1, 1); }
+	float intensity(MStatus* = NULL) const { return 1; }
+};
+
+class MFnLambertShader : public MFnDependencyNode
+{
+public:
+	MFnLambertShader() {}
+	MFnLambertShader(const MObject& o, MStatus* status = NULL) : MFnDependencyNode(o, status) {}
+
+	MColor color(MStatus* = NULL) const { return MColor(0.5f, 0.5f, 0.5f); }
+	float diffuseCoeff(MStatus* = NULL) const { return 0.8f; }
+	MColor ambientColor(MStatus* = NULL) const { return MColor(0, 0, 0); }
+	MColor incandescence(MStatus* = NULL) const { return MColor(0, 0, 0); }
+	MColor transparency(MStatus* = NULL) const { return MColor(0, 0, 0); }
+	float refractiveIndex(MStatus* = NULL) const { return 1; }
+};
+
+class MFnReflectShader : public MFnLambertShader
+{
+public:
+	MFnReflectShader() {}
+	MFnReflectShader(const MObject& o, MStatus* status = NULL) : MFnLambertShader(o, status) {}
+
+	MColor specularColor(MStatus* = NULL) const { return MColor(0.5f, 0.5f, 0.5f); }
+	float reflectivity(MStatus* = NULL) const { return 0.5f; }
+};
+
+class MFnPhongShader : public MFnReflectShader
+{
+public:
+	MFnPhongShader() {}
+	MFnPhongShader(const MObject& o, MStatus* status = NULL) : MFnReflectShader(o, status) {}
+
+	float cosPower(MStatus* = NULL) const { return 20; }
+};
+
+class MFnBlinnShader : public MFnReflectShader
+{
+public:
+	MFnBlinnShader() {}
+	MFnBlinnShader(const MObject& o, MStatus* status = NULL) : MFnReflectShader(o, status) {}
+
+	float eccentricity(MStatus* = NULL) const { return 0.3f; }
+	float specularRollOff(MStatus* = NULL) const { return 0.7f; }
+};
+
+class MItDag
+{
+public:
+	enum TraversalType { kInvalidType, kDepthFirst, kBreadthFirst };
+
+	MItDag(TraversalType = kDepthFirst, MFn::Type = MFn::kInvalid, MStatus* status = NULL) { if (status) *status = MS::kSuccess; }
+	bool isDone(MStatus* status = NULL) const { if (status) *status = MS::kSuccess; return true; }
+	MStatus next() { return MS::kFailure; }
+	MStatus getPath(MDagPath& path) const { path = MDagPath(); return MS::kFailure; }
+};
+
+class M3dView
+{
+public:
+	static M3dView active3dView(MStatus* status = NULL) { if (status) *status = MS::kFailure; return M3dView(); }
+	MStatus getCamera(MDagPath& camera) { camera = MDagPath(); return MS::kFailure; }
+};
+
+class MSelectionList
+{
+public:
+	MStatus clear() { return MS::kSuccess; }
+	unsigned int length(MStatus* = NULL) const { return 0; }
+};
+#pragma endregion
+
+#pragma region IMAGE
+// Images in memory, four channels per pixel and rows from the bottom up like Maya's.
+// Reads binary PPM files, for textures; writes nothing, the renderer writes its own formats.
+class MImage
+{
+	unsigned int			w;
+	unsigned int			h;
+	std::vector<unsigned char>	bytes;
+
+public:
+	enum MPixelType { kUnknown, kByte, kFloat };
+
+	MImage() : w(0), h(0) {}
+
+	MStatus create(unsigned int width, unsigned int height, unsigned int channels = 4, MPixelType type = kByte);
+	MStatus setPixels(unsigned char* pixels, unsigned int width, unsigned int height);
+	MStatus readFromFile(MString pathName, MPixelType type = kByte);
+	MStatus readFromTextureNode(const MObject&, MPixelType = kByte) { return MS::kFailure; }
+	MStatus writeToFile(MString pathName, MString outputFormat = MString("iff")) const;
+	void release() { w = h = 0; bytes.clear(); }
+
+	unsigned char* pixels() const { return bytes.empty() ? NULL : const_cast<unsigned char*>(&bytes[0]); }
+	MStatus getSize(unsigned int& width, unsigned int& height) const { width = w; height = h; return MS::kSuccess; }
+	MPixelType pixelType() const { return bytes.empty() ? kUnknown : kByte; }
+	unsigned int depth() const { return 4; }
+};
+#pragma endregion
+
+#pragma region COMMANDS
+class MArgList
+{
+	std::vector<MString> args;
+
+public:
+	unsigned int length(MStatus* status = NULL) const { if (status) *status = MS::kSuccess; return (unsigned int) args.size(); }
+	MString asString(unsigned int index, MStatus* status = NULL) const;
+	MArgList& addArg(const MString& arg) { args.push_back(arg); return *this; }
+};
+
+class MSyntax
+{
+public:
+	enum MArgType { kInvalidArgType, kNoArg, kBoolean, kLong, kDouble, kString, kUnsigned, kDistance, kAngle, kTime, kSelectionItem, kLastArgType };
+
+	struct FlagT
+	{
+		std::string				shortName;
+		std::string				longName;
+		std::vector<MArgType>	argTypes;
+	};
+
+	MStatus addFlag(const char* shortName, const char* longName, MArgType argType1 = kNoArg, MArgType argType2 = kNoArg,
+		MArgType argType3 = kNoArg, MArgType argType4 = kNoArg, MArgType argType5 = kNoArg, MArgType argType6 = kNoArg);
+
+	// NULL when the syntax has no such flag
+	const FlagT* flag(const char* name) const;
+
+private:
+	std::vector<FlagT> flags;
+};
+
+// Reads the flags of a command line against the syntax of the command. Flags the syntax does not have
+// and flags with too few or malformed arguments fail the parse, like in Maya.
+class MArgParser
+{
+	struct FlagArgsT
+	{
+		MSyntax::FlagT			flag;		// a copy, the syntax is often a temporary
+		std::vector<MString>	args;
+	};
+
+	std::vector<FlagArgsT> parsed;
+
+	const FlagArgsT* find(const char* name) const;
+	MStatus argument(const char* name, unsigned int index, MSyntax::MArgType& type, MString& arg) const;
+
+public:
+	MArgParser(const MSyntax& syntax, const MArgList& args, MStatus* status = NULL);
+
+	bool isFlagSet(const char* name, MStatus* status = NULL) const;
+	MStatus getFlagArgument(const char* name, unsigned int index, bool& result) const;
+	MStatus getFlagArgument(const char* name, unsigned int index, int& result) const;
+	MStatus getFlagArgument(const char* name, unsigned int index, unsigned int& result) const;
+	MStatus getFlagArgument(const char* name, unsigned int index, double& result) const;
+	MStatus getFlagArgument(const char* name, unsigned int index, MString& result) const;
+};
+
+class MPxCommand
+{
+	MSyntax commandSyntax;
+
+	friend class MGlobal;
+
+public:
+	virtual ~MPxCommand() {}
+	virtual MStatus doIt(const MArgList& args) = 0;
+	virtual bool isUndoable() const { return false; }
+	MSyntax syntax(MStatus* status = NULL) const { if (status) *status = MS::kSuccess; return commandSyntax; }
+};
+
+// The display functions stand in for the Script Editor and write to stderr, stdout is the Output
+// Window that the plugin writes to with cout
+class MGlobal
+{
+public:
+	static void displayInfo(const MString& message);
+	static void displayWarning(const MString& message);
+	static void displayError(const MString& message);
+
+	// Runs a command registered by the plugin, given as a line of MEL: the command name and its
+	// arguments, which may be double quoted. Anything else fails.
+	static MStatus executeCommand(const MString& command, bool displayEnabled = false, bool undoEnabled = false);
+
+	static MStatus getActiveSelectionList(MSelectionList& list) { list.clear(); return MS::kSuccess; }
+	static MStatus setActiveSelectionList(const MSelectionList&) { return MS::kSuccess; }
+};
+
+class MFnPlugin
+{
+public:
+	MFnPlugin(MObject& object, const char* vendor = "Unknown", const char* version = "Unknown", const char* requiredApiVersion = "Any", MStatus* status = NULL);
+
+	MStatus registerCommand(const MString& commandName, void* (*creator)(), MSyntax (*createSyntax)() = NULL);
+	MStatus deregisterCommand(const MString& commandName);
+};
+#pragma endregion
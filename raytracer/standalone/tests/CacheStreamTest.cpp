@@ -0,0 +1,115 @@
+// CacheWriter and CacheReader round trips, and the reader on truncated and corrupt buffers.
+
+#include "Check.h"
+#include "CacheStream.h"
+
+static vector<char> sample()
+{
+	vector<char> buffer;
+	CacheWriter writer(buffer);
+	writer.put(42);
+	writer.put(1.5);
+	vector<float> values;
+	for (int i = 0; i < 10; ++i) {
+		values.push_back(i * 0.5f);
+	}
+	writer.putArray(values);
+	writer.putArray(vector<int>());
+	writer.put(3);
+	writer.putRaw("abc", 3);
+	return buffer;
+}
+
+// Reads back what sample wrote, false as soon as a read fails
+static bool readSample(CacheReader& reader)
+{
+	int i = 0, count = 0;
+	double d = 0;
+	char text[3];
+	vector<float> values;
+	vector<int> empty;
+	if (!reader.get(i) || !reader.get(d) || !reader.getArray(values) || !reader.getArray(empty) || !reader.getCount(count, 1) || !reader.getRaw(text, sizeof(text))) {
+		return false;
+	}
+	CHECK(i == 42);
+	CHECK(d == 1.5);
+	CHECK(values.size() == 10 && values[9] == 4.5f);
+	CHECK(empty.empty());
+	CHECK(count == 3 && memcmp(text, "abc", 3) == 0);
+	return true;
+}
+
+int main()
+{
+	vector<char> buffer = sample();
+	{
+		CacheReader reader(&buffer[0], buffer.size());
+		CHECK(readSample(reader));
+		CHECK(reader.ok());
+		CHECK(reader.atEnd());
+	}
+
+	// Cut anywhere, the reads fail and keep failing
+	for (size_t size = 0; size < buffer.size(); ++size)
+	{
+		CacheReader reader(&buffer[0], size);
+		CHECK(!readSample(reader));
+		CHECK(!reader.ok());
+		int value;
+		CHECK(!reader.get(value));
+	}
+
+	// An array count past the bytes left fails before anything is allocated for it
+	{
+		vector<char> corrupt = buffer;
+		long long huge = 1LL << 60;
+		memcpy(&corrupt[sizeof(int) + sizeof(double)], &huge, sizeof(huge));
+		CacheReader reader(&corrupt[0], corrupt.size());
+		CHECK(!readSample(reader));
+		CHECK(!reader.ok());
+	}
+	{
+		vector<char> corrupt = buffer;
+		long long negative = -1;
+		memcpy(&corrupt[sizeof(int) + sizeof(double)], &negative, sizeof(negative));
+		CacheReader reader(&corrupt[0], corrupt.size());
+		CHECK(!readSample(reader));
+	}
+
+	// A count is checked against the size of what it counts
+	{
+		vector<char> counts;
+		CacheWriter writer(counts);
+		writer.put(4);
+		writer.put(0LL);
+		writer.put(0LL);
+		int count = 0;
+		CacheReader fits(&counts[0], counts.size());
+		CHECK(fits.getCount(count, 4) && count == 4);
+		CacheReader tooMany(&counts[0], counts.size());
+		CHECK(!tooMany.getCount(count, 5));
+		CHECK(!tooMany.ok());
+
+		vector<char> negative;
+		CacheWriter negativeWriter(negative);
+		negativeWriter.put(-2);
+		CacheReader reader(&negative[0], negative.size());
+		CHECK(!reader.getCount(count, 1));
+	}
+
+	// Files are replaced whole
+	{
+		const char* path = "cachestream_test.bin";
+		CHECK(writeFileReplacing(path, buffer));
+		vector<char> contents;
+		CHECK(readFile(path, contents));
+		CHECK(contents == buffer);
+		CHECK(writeFileReplacing(path, vector<char>(3, 'x')));
+		CHECK(readFile(path, contents));
+		CHECK(contents == vector<char>(3, 'x'));
+		remove(path);
+		CHECK(!readFile(path, contents));
+	}
+
+	return checkResult();
+}
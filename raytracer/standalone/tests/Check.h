@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdio.h>
+
+// The tests are plain programs, a failed check is printed and the program exits with 1 at the end.
+// assert is not used, the tests are built as Release like the renderer.
+static int checkFailures = 0;
+
+#define CHECK(condition)	\
+	do {	\
+		if (!(condition)) {	\
+			fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition);	\
+			checkFailures++;	\
+		}	\
+	} while (0)
+
+static inline int checkResult()
+{
+	if (checkFailures > 0) {
+		fprintf(stderr, "%d checks failed\n", checkFailures);
+	}
+	return (checkFailures > 0) ? 1 : 0;
+}
@@ -0,0 +1,121 @@
+// Checkpoints saved and loaded back, and the ones that must not be resumed: other settings,
+// truncated files and corrupt sizes.
+
+#include <string.h>
+#include <string>
+#include "Check.h"
+#include "CacheStream.h"
+#include "Checkpoint.h"
+
+#define	CHECKPOINT_PATH		"checkpoint_test.rtck"
+
+static CheckpointKeyT testKey()
+{
+	CheckpointKeyT key;
+	memset(&key, 0, sizeof(key));
+	key.width = 20;
+	key.height = 10;
+	key.tileSize = 8;
+	key.tileCount = 6;
+	key.supersamplingCoeff = 2;
+	key.rayDepth = 3;
+	key.seed = 7;
+	return key;
+}
+
+static bool loadInto(const CheckpointKeyT& key, vector<char>& doneTiles, Framebuffer& image, vector<char>& state)
+{
+	image.init(key.width, key.height);
+	return checkpoint::load(CHECKPOINT_PATH, key, doneTiles, image, state);
+}
+
+int main()
+{
+	CheckpointKeyT key = testKey();
+	vector<char> doneTiles(key.tileCount, 0);
+	doneTiles[1] = doneTiles[4] = 1;
+	Framebuffer image;
+	image.init(key.width, key.height);
+	for (int i = 0; i < key.width * key.height; ++i)
+	{
+		image.set(i, MColor(i * 0.01f, 0.5f, 1));
+		image.time(i) = i * 1e-3;
+		image.samples(i) = i % 5;
+	}
+	vector<char> state;
+	CacheWriter writer(state);
+	writer.put(123);
+	writer.putArray(vector<double>(5, 0.25));
+
+	CHECK(checkpoint::save(CHECKPOINT_PATH, key, doneTiles, image, state));
+
+	{
+		vector<char> loadedTiles, loadedState;
+		Framebuffer loaded;
+		CHECK(loadInto(key, loadedTiles, loaded, loadedState));
+		CHECK(loadedTiles == doneTiles);
+		CHECK(loadedState == state);
+		for (int i = 0; i < key.width * key.height; ++i)
+		{
+			CHECK(memcmp(loaded.pixel(i), image.pixel(i), 3 * sizeof(float)) == 0);
+			CHECK(loaded.pixelTime(i) == image.pixelTime(i));
+			CHECK(loaded.pixelSamples(i) == image.pixelSamples(i));
+		}
+	}
+
+	// Other settings
+	{
+		CheckpointKeyT other = key;
+		other.seed++;
+		vector<char> loadedTiles, loadedState;
+		Framebuffer loaded;
+		CHECK(!loadInto(other, loadedTiles, loaded, loadedState));
+		other = key;
+		other.progressive = 1;
+		CHECK(!loadInto(other, loadedTiles, loaded, loadedState));
+	}
+
+	vector<char> contents;
+	CHECK(readFile(CHECKPOINT_PATH, contents));
+
+	// Cut anywhere
+	for (size_t size = 0; size < contents.size(); ++size)
+	{
+		CHECK(writeFileReplacing(CHECKPOINT_PATH, vector<char>(contents.begin(), contents.begin() + size)));
+		vector<char> loadedTiles, loadedState;
+		Framebuffer loaded;
+		CHECK(!loadInto(key, loadedTiles, loaded, loadedState));
+	}
+
+	// A state size past the end of the file, or negative, is not allocated
+	size_t stateSizeOffset = contents.size() - state.size() - sizeof(long long);
+	long long badSizes[] = { 1LL << 60, (long long) state.size() + 1, -1 };
+	for (int bi = 0; bi < 3; ++bi)
+	{
+		vector<char> corrupt = contents;
+		memcpy(&corrupt[stateSizeOffset], &badSizes[bi], sizeof(long long));
+		CHECK(writeFileReplacing(CHECKPOINT_PATH, corrupt));
+		vector<char> loadedTiles, loadedState;
+		Framebuffer loaded;
+		CHECK(!loadInto(key, loadedTiles, loaded, loadedState));
+	}
+
+	// Not a checkpoint
+	{
+		vector<char> corrupt = contents;
+		corrupt[0] ^= 1;
+		CHECK(writeFileReplacing(CHECKPOINT_PATH, corrupt));
+		vector<char> loadedTiles, loadedState;
+		Framebuffer loaded;
+		CHECK(!loadInto(key, loadedTiles, loaded, loadedState));
+	}
+
+	checkpoint::remove(CHECKPOINT_PATH);
+	{
+		vector<char> loadedTiles, loadedState;
+		Framebuffer loaded;
+		CHECK(!loadInto(key, loadedTiles, loaded, loadedState));
+	}
+
+	return checkResult();
+}
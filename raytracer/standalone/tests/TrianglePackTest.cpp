@@ -0,0 +1,86 @@
+// Every pack kernel the CPU runs against TriangleT::intersect: a face the double test hits is never
+// ruled out, and the kernels agree lane for lane.
+
+#include <float.h>
+#include "Check.h"
+#include "Random.h"
+#include "TrianglePack.h"
+
+#define	PACK_COUNT		2000
+#define	RAYS_PER_PACK	64
+
+static double uniform(Pcg32& rng, double low, double high)
+{
+	return low + (high - low) * rng.nextDouble();
+}
+
+static MPoint randomPoint(Pcg32& rng, const MPoint& center, double radius)
+{
+	return MPoint(center.x + uniform(rng, -radius, radius), center.y + uniform(rng, -radius, radius), center.z + uniform(rng, -radius, radius));
+}
+
+static TriangleT randomTriangle(Pcg32& rng, const MPoint& center)
+{
+	MPointArray vertices;
+	for (int v = 0; v < 3; ++v) {
+		vertices.append(randomPoint(rng, center, 1));
+	}
+	TriangleT triangle;
+	triangle.init(vertices);
+	return triangle;
+}
+
+int main()
+{
+	trianglePack::KernelType best = trianglePack::detectKernel();
+	Pcg32 rng;
+	rng.seed(1, 0);
+	long hits = 0;
+
+	for (int pi = 0; pi < PACK_COUNT; ++pi)
+	{
+		// Far from the world origin too, the packs keep their precision relative to their own origin
+		MPoint center = randomPoint(rng, MPoint(0, 0, 0), (pi % 2 == 0) ? 10 : 10000);
+		TrianglePackT pack;
+		pack.clear(randomPoint(rng, center, 1));
+		TriangleT triangles[TRIANGLE_PACK_WIDTH];
+		// The last lane stays empty like the padding of a cell
+		int used = TRIANGLE_PACK_WIDTH - 1;
+		for (int lane = 0; lane < used; ++lane)
+		{
+			triangles[lane] = randomTriangle(rng, center);
+			pack.set(lane, triangles[lane]);
+		}
+
+		for (int ri = 0; ri < RAYS_PER_PACK; ++ri)
+		{
+			MPoint src = randomPoint(rng, center, 4);
+			MVector dir = (randomPoint(rng, center, 1) - src).normal();
+			PackRayT ray;
+			ray.setSource(src, pack);
+			for (int a = 0; a < 3; ++a) {
+				ray.dir[a] = (float) dir[a];
+			}
+			ray.maxTime = FLT_MAX;
+
+			int scalarMask = trianglePack::kernel(trianglePack::SCALAR)(pack, ray);
+			CHECK((scalarMask & (1 << used)) == 0);
+			for (int lane = 0; lane < used; ++lane)
+			{
+				double time;
+				if (triangles[lane].intersect(src, dir, DBL_MAX, time)) {
+					CHECK(scalarMask & (1 << lane));
+					hits++;
+				}
+			}
+			for (int type = trianglePack::SSE; type <= best; ++type) {
+				CHECK(trianglePack::kernel((trianglePack::KernelType) type)(pack, ray) == scalarMask);
+			}
+		}
+	}
+
+	// The rays aim at the packs, most of them have to hit something for the test to mean anything
+	CHECK(hits > PACK_COUNT * RAYS_PER_PACK / 4);
+	printf("kernels up to %s, %ld hits\n", trianglePack::kernelName(best), hits);
+	return checkResult();
+}